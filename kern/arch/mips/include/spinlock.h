@@ -46,6 +46,11 @@ SPINLOCK_INLINE
 spinlock_data_t spinlock_data_get(volatile spinlock_data_t *sd);
 SPINLOCK_INLINE
 spinlock_data_t spinlock_data_testandset(volatile spinlock_data_t *sd);
+SPINLOCK_INLINE
+spinlock_data_t spinlock_data_fetchadd(volatile spinlock_data_t *sd,
+				       unsigned val);
+SPINLOCK_INLINE
+spinlock_data_t spinlock_data_incnonzero(volatile spinlock_data_t *sd);
 
 ////////////////////////////////////////////////////////////
 
@@ -118,5 +123,62 @@ spinlock_data_testandset(volatile spinlock_data_t *sd)
 	return x;
 }
 
+/*
+ * Atomically add VAL to a spinlock_data_t and return the old value.
+ * Also uses LL/SC; unlike test-and-set, this can't just give up when
+ * the SC fails, so it loops until the store goes through.
+ */
+SPINLOCK_INLINE
+spinlock_data_t
+spinlock_data_fetchadd(volatile spinlock_data_t *sd, unsigned val)
+{
+	spinlock_data_t x;
+	spinlock_data_t y;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set volatile;"	/* avoid unwanted optimization */
+		".set noreorder;"	/* we fill the delay slot */
+		"1: ll %0, 0(%2);"	/*   x = *sd */
+		"addu %1, %0, %3;"	/*   y = x + val */
+		"sc %1, 0(%2);"		/*   *sd = y; y = success? */
+		"beqz %1, 1b;"		/*   if the store failed, retry */
+		"nop;"			/*   (delay slot) */
+		".set pop"		/* restore assembler mode */
+		: "=&r" (x), "=&r" (y) : "r" (sd), "r" (val) : "memory");
+	return x;
+}
+
+/*
+ * Atomically add 1 to a spinlock_data_t unless it is 0, and return the
+ * old value (so 0 means nothing was done). For reference counts that a
+ * lookup may race with the last release: once the count has reached 0
+ * it stays there.
+ */
+SPINLOCK_INLINE
+spinlock_data_t
+spinlock_data_incnonzero(volatile spinlock_data_t *sd)
+{
+	spinlock_data_t x;
+	spinlock_data_t y;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set volatile;"	/* avoid unwanted optimization */
+		".set noreorder;"	/* we fill the delay slots */
+		"1: ll %0, 0(%2);"	/*   x = *sd */
+		"beqz %0, 2f;"		/*   if x == 0, give up */
+		"addiu %1, %0, 1;"	/*   (delay slot) y = x + 1 */
+		"sc %1, 0(%2);"		/*   *sd = y; y = success? */
+		"beqz %1, 1b;"		/*   if the store failed, retry */
+		"nop;"			/*   (delay slot) */
+		"2:"
+		".set pop"		/* restore assembler mode */
+		: "=&r" (x), "=&r" (y) : "r" (sd) : "memory");
+	return x;
+}
+
 
 #endif /* _MIPS_SPINLOCK_H_ */
@@ -37,6 +37,7 @@
 #include <spl.h>
 #include <thread.h>
 #include <current.h>
+#include <proc.h>
 #include <vm.h>
 #include <mainbus.h>
 #include <syscall.h>
@@ -196,6 +197,17 @@ mips_trap(struct trapframe *tf)
 		}
 
 		curthread->t_in_interrupt = old_in;
+
+		/*
+		 * If we interrupted a user thread whose process is
+		 * exiting, don't go back to it. Bring the interrupt
+		 * state back in sync first, as below.
+		 */
+		if (!iskern && curproc != NULL && curproc->p_exiting) {
+			spl = splhigh();
+			splx(spl);
+			uthread_exitcheck();
+		}
 		goto done2;
 	}
 
@@ -316,6 +328,13 @@ mips_trap(struct trapframe *tf)
 	panic("I can't handle this... I think I'll just die now...\n");
 
  done:
+	/*
+	 * Don't go back to user mode in a process that is exiting.
+	 */
+	if (!iskern) {
+		uthread_exitcheck();
+	}
+
 	/*
 	 * Turn interrupts off on the processor, without affecting the
 	 * stored interrupt state.
@@ -129,6 +129,43 @@ syscall(struct trapframe *tf)
 				err = 0;
             break;
 
+	    case SYS_pwrite:
+	    case SYS_pread:
+			//the 64-bit offset doesn't fit in a3, so it's on the stack
+			err = copyin((const_userptr_t)tf->tf_sp+16, &offset, sizeof(off_t));
+			if (err)
+				break;
+			if (callno == SYS_pwrite)
+				retval = sys_pwrite((int)tf->tf_a0, (userptr_t)tf->tf_a1, (size_t)tf->tf_a2, offset, &err);
+			else
+				retval = sys_pread((int)tf->tf_a0, (userptr_t)tf->tf_a1, (size_t)tf->tf_a2, offset, &err);
+			if (retval >= 0)
+				err = 0;
+			break;
+
+	    case SYS_writev:
+	    case SYS_readv:
+			if (callno == SYS_writev)
+				retval = sys_writev((int)tf->tf_a0, (userptr_t)tf->tf_a1, (int)tf->tf_a2, &err);
+			else
+				retval = sys_readv((int)tf->tf_a0, (userptr_t)tf->tf_a1, (int)tf->tf_a2, &err);
+			if (retval >= 0)
+				err = 0;
+			break;
+
+	    case SYS_pwritev:
+	    case SYS_preadv:
+			err = copyin((const_userptr_t)tf->tf_sp+16, &offset, sizeof(off_t));
+			if (err)
+				break;
+			if (callno == SYS_pwritev)
+				retval = sys_pwritev((int)tf->tf_a0, (userptr_t)tf->tf_a1, (int)tf->tf_a2, offset, &err);
+			else
+				retval = sys_preadv((int)tf->tf_a0, (userptr_t)tf->tf_a1, (int)tf->tf_a2, offset, &err);
+			if (retval >= 0)
+				err = 0;
+			break;
+
 	    case SYS__exit:
 			sys__exit((int)tf->tf_a0);
 			break;
@@ -159,6 +196,12 @@ syscall(struct trapframe *tf)
 				err = 0;         
 			break;
 
+	    case SYS_ioctl:
+			retval = sys_ioctl((int)tf->tf_a0, (int)tf->tf_a1, (userptr_t)tf->tf_a2, &err);
+			if(retval == 0)
+				err = 0;
+			break;
+
  	    case SYS___getcwd:
 			retval = sys__getcwd((char*) tf->tf_a0, (size_t) tf->tf_a1, &err);
 			if(retval >= 0) 
@@ -177,6 +220,32 @@ syscall(struct trapframe *tf)
 				err = 0;         
 			break;
 
+	    case SYS_pipe:
+			retval = sys_pipe((userptr_t) tf->tf_a0, &err);
+			if(retval >= 0)
+				err = 0;
+			break;
+
+	    case SYS_poll:
+			retval = sys_poll((userptr_t)tf->tf_a0, (unsigned)tf->tf_a1, (int)tf->tf_a2, &err);
+			if(retval >= 0)
+				err = 0;
+			break;
+
+	    case SYS_select:
+		{
+			userptr_t timeout;
+
+			//the fifth argument (the timeout) is on the stack
+			err = copyin((const_userptr_t)tf->tf_sp+16, &timeout, sizeof(userptr_t));
+			if (err)
+				break;
+			retval = sys_select((int)tf->tf_a0, (userptr_t)tf->tf_a1, (userptr_t)tf->tf_a2, (userptr_t)tf->tf_a3, timeout, &err);
+			if(retval >= 0)
+				err = 0;
+			break;
+		}
+
 	    case SYS_lseek:
 			//the offset parameter is on 64 bits so we have to put it into a2 and a3 and pass the other parameter(whence) using the stack
 			offset = (off_t)tf->tf_a2 << 32 | tf->tf_a3;
@@ -197,10 +266,80 @@ syscall(struct trapframe *tf)
 			   err = 0;         
 		 	break;
 
+	    case SYS_vfork:
+			retlowpart = sys_vfork(&retval, tf, &err);
+			if(retlowpart >= 0)
+				err = 0;
+			break;
+
 		case SYS_execv:
 
 			err = sys_execv((char*) tf->tf_a0 , (char**) tf->tf_a1);
 			break;
+
+	    case SYS_spawn:
+			retval = sys_spawn((char*) tf->tf_a0, (char**) tf->tf_a1, (int*) tf->tf_a2, (int) tf->tf_a3, &err);
+			if(retval >= 0)
+				err = 0;
+			break;
+
+	    case SYS_thread_create:
+			retval = sys_thread_create((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1, &err);
+			if(retval >= 0)
+				err = 0;
+			break;
+
+	    case SYS_thread_exit:
+			sys_thread_exit((int)tf->tf_a0);
+			break;
+
+	    case SYS_thread_join:
+			retval = sys_thread_join((int)tf->tf_a0, (userptr_t)tf->tf_a1, &err);
+			if(retval >= 0)
+				err = 0;
+			break;
+
+	    case SYS_ipc_send:
+			retval = sys_ipc_send((pid_t)tf->tf_a0, (userptr_t)tf->tf_a1, &err);
+			if(retval >= 0)
+				err = 0;
+			break;
+
+	    case SYS_ipc_call:
+			retval = sys_ipc_call((pid_t)tf->tf_a0, (userptr_t)tf->tf_a1, &err);
+			if(retval >= 0)
+				err = 0;
+			break;
+
+	    case SYS_ipc_recv:
+			retval = sys_ipc_recv((userptr_t)tf->tf_a0, &err);
+			if(retval >= 0)
+				err = 0;
+			break;
+
+	    case SYS_ipc_reply:
+			retval = sys_ipc_reply((userptr_t)tf->tf_a0, &err);
+			if(retval >= 0)
+				err = 0;
+			break;
+
+	    case SYS_ipc_replyrecv:
+			retval = sys_ipc_replyrecv((userptr_t)tf->tf_a0, &err);
+			if(retval >= 0)
+				err = 0;
+			break;
+
+	    case SYS_futex_wait:
+			retval = sys_futex_wait((userptr_t)tf->tf_a0, (int)tf->tf_a1, &err);
+			if(retval >= 0)
+				err = 0;
+			break;
+
+	    case SYS_futex_wake:
+			retval = sys_futex_wake((userptr_t)tf->tf_a0, (int)tf->tf_a1, &err);
+			if(retval >= 0)
+				err = 0;
+			break;
 #endif 
 	    default:
 		kprintf("Unknown syscall %d\n", callno);
@@ -59,6 +59,14 @@
 /* (this must be > 64K so argument blocks of size ARG_MAX will fit) */
 #define DUMBVM_STACKPAGES    18
 
+/*
+ * Extra stacks for additional user threads are 16k each, packed
+ * below the main stack. Each has an unmapped guard page on top, so
+ * running off the bottom of the stack above it faults.
+ */
+#define DUMBVM_TSTACKPAGES   4
+#define DUMBVM_TSTACKSPAN    ((DUMBVM_TSTACKPAGES + 1) * PAGE_SIZE)
+
 /*
  * Wrap ram_stealmem in a spinlock.
  */
@@ -231,10 +239,78 @@ vm_tlbshootdown(const struct tlbshootdown *ts)
 	panic("dumbvm tried to do tlb shootdown?!\n");
 }
 
+/*
+ * Base virtual address of thread stack SLOT.
+ */
+static
+vaddr_t
+dumbvm_tstackbase(unsigned slot)
+{
+	return USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE
+		- (slot + 1) * DUMBVM_TSTACKSPAN;
+}
+
+/*
+ * Physical address for FAULTADDRESS if it falls in one of AS's thread
+ * stacks, 0 otherwise.
+ */
+static
+paddr_t
+dumbvm_tstack_paddr(struct addrspace *as, vaddr_t faultaddress)
+{
+	vaddr_t stackbase, tstackbase;
+	unsigned slot;
+
+	stackbase = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
+	if (faultaddress >= stackbase ||
+	    faultaddress < dumbvm_tstackbase(DUMBVM_THREADSTACKS - 1)) {
+		return 0;
+	}
+
+	slot = (stackbase - faultaddress - 1) / DUMBVM_TSTACKSPAN;
+	tstackbase = dumbvm_tstackbase(slot);
+	if (faultaddress >= tstackbase + DUMBVM_TSTACKPAGES * PAGE_SIZE) {
+		/* guard page */
+		return 0;
+	}
+	if (as->as_tstackpbase[slot] == 0) {
+		return 0;
+	}
+	return (faultaddress - tstackbase) + as->as_tstackpbase[slot];
+}
+
+/*
+ * Physical address for user address VADDR in AS, or 0 if it isn't
+ * mapped.
+ */
+static
+paddr_t
+dumbvm_paddr(struct addrspace *as, vaddr_t vaddr)
+{
+	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
+
+	vbase1 = as->as_vbase1;
+	vtop1 = vbase1 + as->as_npages1 * PAGE_SIZE;
+	vbase2 = as->as_vbase2;
+	vtop2 = vbase2 + as->as_npages2 * PAGE_SIZE;
+	stackbase = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
+	stacktop = USERSTACK;
+
+	if (vaddr >= vbase1 && vaddr < vtop1) {
+		return (vaddr - vbase1) + as->as_pbase1;
+	}
+	if (vaddr >= vbase2 && vaddr < vtop2) {
+		return (vaddr - vbase2) + as->as_pbase2;
+	}
+	if (vaddr >= stackbase && vaddr < stacktop) {
+		return (vaddr - stackbase) + as->as_stackpbase;
+	}
+	return dumbvm_tstack_paddr(as, vaddr);
+}
+
 int
 vm_fault(int faulttype, vaddr_t faultaddress)
 {
-	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
 	paddr_t paddr;
 	int i;
 	uint32_t ehi, elo;
@@ -288,23 +364,8 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	KASSERT((as->as_pbase2 & PAGE_FRAME) == as->as_pbase2);
 	KASSERT((as->as_stackpbase & PAGE_FRAME) == as->as_stackpbase);
 
-	vbase1 = as->as_vbase1;
-	vtop1 = vbase1 + as->as_npages1 * PAGE_SIZE;
-	vbase2 = as->as_vbase2;
-	vtop2 = vbase2 + as->as_npages2 * PAGE_SIZE;
-	stackbase = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
-	stacktop = USERSTACK;
-
-	if (faultaddress >= vbase1 && faultaddress < vtop1) {
-		paddr = (faultaddress - vbase1) + as->as_pbase1;
-	}
-	else if (faultaddress >= vbase2 && faultaddress < vtop2) {
-		paddr = (faultaddress - vbase2) + as->as_pbase2;
-	}
-	else if (faultaddress >= stackbase && faultaddress < stacktop) {
-		paddr = (faultaddress - stackbase) + as->as_stackpbase;
-	}
-	else {
+	paddr = dumbvm_paddr(as, faultaddress);
+	if (paddr == 0) {
 		return EFAULT;
 	}
 
@@ -336,6 +397,8 @@ struct addrspace *
 as_create(void)
 {
 	struct addrspace *as = kmalloc(sizeof(struct addrspace));
+	unsigned i;
+
 	if (as==NULL) {
 		return NULL;
 	}
@@ -347,6 +410,10 @@ as_create(void)
 	as->as_pbase2 = 0;
 	as->as_npages2 = 0;
 	as->as_stackpbase = 0;
+	for (i=0; i<DUMBVM_THREADSTACKS; i++) {
+		as->as_tstackpbase[i] = 0;
+	}
+	as->as_tstackused = 0;
 
 	return as;
 }
@@ -354,10 +421,17 @@ as_create(void)
 void
 as_destroy(struct addrspace *as)
 {
+	unsigned i;
+
 	dumbvm_can_sleep();
 	freeppages(as->as_pbase1, as->as_npages1);
   	freeppages(as->as_pbase2, as->as_npages2);
   	freeppages(as->as_stackpbase, DUMBVM_STACKPAGES);
+	for (i=0; i<DUMBVM_THREADSTACKS; i++) {
+		if (as->as_tstackpbase[i] != 0) {
+			freeppages(as->as_tstackpbase[i], DUMBVM_TSTACKPAGES);
+		}
+	}
 	kfree(as);
 }
 
@@ -484,10 +558,71 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+/*
+ * Thread stacks are never freed before the address space is; a stack
+ * whose thread has exited is kept for the next thread. Besides saving
+ * the allocation, this means a stale TLB entry on another cpu can
+ * never point at memory that has gone back to the allocator.
+ *
+ * The caller serializes calls on the same address space.
+ */
+int
+as_define_thread_stack(struct addrspace *as, int *slot, vaddr_t *stackptr)
+{
+	unsigned i;
+
+	dumbvm_can_sleep();
+
+	for (i=0; i<DUMBVM_THREADSTACKS; i++) {
+		if ((as->as_tstackused & (1U << i)) == 0) {
+			break;
+		}
+	}
+	if (i == DUMBVM_THREADSTACKS) {
+		return EAGAIN;
+	}
+
+	if (as->as_tstackpbase[i] == 0) {
+		as->as_tstackpbase[i] = getppages(DUMBVM_TSTACKPAGES);
+		if (as->as_tstackpbase[i] == 0) {
+			return ENOMEM;
+		}
+		as_zero_region(as->as_tstackpbase[i], DUMBVM_TSTACKPAGES);
+	}
+	as->as_tstackused |= 1U << i;
+
+	*slot = i;
+	*stackptr = dumbvm_tstackbase(i) + DUMBVM_TSTACKPAGES * PAGE_SIZE;
+	return 0;
+}
+
+void
+as_release_thread_stack(struct addrspace *as, int slot)
+{
+	KASSERT(slot >= 0 && slot < DUMBVM_THREADSTACKS);
+	KASSERT(as->as_tstackused & (1U << slot));
+
+	as->as_tstackused &= ~(1U << slot);
+}
+
+int
+as_translate(struct addrspace *as, vaddr_t vaddr, paddr_t *ret)
+{
+	paddr_t paddr;
+
+	paddr = dumbvm_paddr(as, vaddr);
+	if (paddr == 0) {
+		return EFAULT;
+	}
+	*ret = paddr;
+	return 0;
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
 	struct addrspace *new;
+	unsigned i;
 
 	dumbvm_can_sleep();
 
@@ -523,6 +658,22 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 		(const void *)PADDR_TO_KVADDR(old->as_stackpbase),
 		DUMBVM_STACKPAGES*PAGE_SIZE);
 
+	/* The copying thread may be running on one of the thread stacks */
+	for (i=0; i<DUMBVM_THREADSTACKS; i++) {
+		if (old->as_tstackpbase[i] == 0) {
+			continue;
+		}
+		new->as_tstackpbase[i] = getppages(DUMBVM_TSTACKPAGES);
+		if (new->as_tstackpbase[i] == 0) {
+			as_destroy(new);
+			return ENOMEM;
+		}
+		memmove((void *)PADDR_TO_KVADDR(new->as_tstackpbase[i]),
+			(const void *)PADDR_TO_KVADDR(old->as_tstackpbase[i]),
+			DUMBVM_TSTACKPAGES*PAGE_SIZE);
+	}
+	new->as_tstackused = old->as_tstackused;
+
 	*ret = new;
 	return 0;
 }
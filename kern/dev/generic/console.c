@@ -49,6 +49,7 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/poll.h>
 #include <lib.h>
 #include <uio.h>
 #include <cpu.h>
@@ -174,6 +175,7 @@ con_input(void *vcs, int ch)
 	cs->cs_gotchars_head = nexthead;
 
 	V(cs->cs_rsem);
+	pollq_wakeup(&cs->cs_pollq);
 }
 
 /*
@@ -225,6 +227,24 @@ getch(void)
 	return getch_intr(cs);
 }
 
+int
+console_poll(int events, struct pollwait *pw)
+{
+	struct con_softc *cs = the_console;
+	int ret;
+
+	KASSERT(cs != NULL);
+
+	ret = events & POLLOUT;
+	if (events & POLLIN) {
+		pollq_register(&cs->cs_pollq, pw);
+		if (cs->cs_gotchars_head != cs->cs_gotchars_tail) {
+			ret |= POLLIN;
+		}
+	}
+	return ret;
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -302,10 +322,19 @@ con_ioctl(struct device *dev, int op, userptr_t data)
 	return EINVAL;
 }
 
+static
+int
+con_poll(struct device *dev, int events, struct pollwait *pw)
+{
+	(void)dev;
+	return console_poll(events, pw);
+}
+
 static const struct device_ops console_devops = {
 	.devop_eachopen = con_eachopen,
 	.devop_io = con_io,
 	.devop_ioctl = con_ioctl,
+	.devop_poll = con_poll,
 };
 
 static
@@ -386,6 +415,7 @@ config_con(struct con_softc *cs, int unit)
 	cs->cs_wsem = wsem;
 	cs->cs_gotchars_head = 0;
 	cs->cs_gotchars_tail = 0;
+	pollq_init(&cs->cs_pollq);
 
 	the_console = cs;
 	con_userlock_read = rlk;
@@ -68,3 +68,20 @@ gettime(struct timespec *ts)
 	KASSERT(the_clock!=NULL);
 	the_clock->rtc_gettime(the_clock->rtc_devdata, ts);
 }
+
+/*
+ * Fetch the current time as a single count of nanoseconds. This is
+ * meant for statistics and is usable before the clock attaches, in
+ * which case it returns 0.
+ */
+uint64_t
+gettime_ns(void)
+{
+	struct timespec ts;
+
+	if (the_clock == NULL) {
+		return 0;
+	}
+	the_clock->rtc_gettime(the_clock->rtc_devdata, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
@@ -33,6 +33,7 @@
 #include <array.h>
 #include <fs.h>
 #include <vnode.h>
+#include <poll.h>
 
 #ifndef SEMFS_INLINE
 #define SEMFS_INLINE INLINE
@@ -43,6 +44,7 @@
  */
 
 #define SEMFS_ROOTDIR	0xffffffffU		/* semnum for root dir */
+#define SEMFS_DIRHASH	64			/* Buckets in dir hash */
 
 /*
  * A user-facing semaphore.
@@ -55,6 +57,9 @@ struct semfs_sem {
 	struct lock *sems_lock;			/* Lock to protect count */
 	struct cv *sems_cv;			/* CV to wait */
 	unsigned sems_count;			/* Semaphore count */
+	unsigned sems_waiters;			/* Threads in cv_wait */
+	unsigned sems_timedwaiters;		/* ...of which in timed P */
+	struct pollq sems_pollq;		/* Threads in poll() */
 	bool sems_hasvnode;			/* The vnode exists */
 	bool sems_linked;			/* In the directory */
 };
@@ -62,10 +67,15 @@ DECLARRAY(semfs_sem, SEMFS_INLINE);
 
 /*
  * Directory entry; name and reference to a semaphore.
+ *
+ * The entries are kept packed in an array, for getdirentry, and also
+ * hashed by name, for lookup.
  */
 struct semfs_direntry {
 	char *semd_name;			/* Name */
 	unsigned semd_semnum;			/* Which semaphore */
+	unsigned semd_slot;			/* Index in semfs_dents */
+	struct semfs_direntry *semd_hashnext;	/* Hash chain */
 };
 DECLARRAY(semfs_direntry, SEMFS_INLINE);
 
@@ -89,12 +99,13 @@ struct semfs_vnode {
 struct semfs {
 	struct fs semfs_absfs;			/* Abstract fs object */
 
-	struct lock *semfs_tablelock;		/* Lock for following */
+	struct rwlock *semfs_tablelock;	/* Lock for following */
 	struct vnodearray *semfs_vnodes;	/* Currently extant vnodes */
 	struct semfs_semarray *semfs_sems;	/* Semaphores */
 
 	struct lock *semfs_dirlock;		/* Lock for following */
 	struct semfs_direntryarray *semfs_dents; /* The root directory */
+	struct semfs_direntry *semfs_dirhash[SEMFS_DIRHASH]; /* By name */
 };
 
 /*
@@ -63,6 +63,9 @@ semfs_sem_create(const char *name)
 		goto fail_lock;
 	}
 	sem->sems_count = 0;
+	sem->sems_waiters = 0;
+	sem->sems_timedwaiters = 0;
+	pollq_init(&sem->sems_pollq);
 	sem->sems_hasvnode = false;
 	sem->sems_linked = false;
 	return sem;
@@ -81,6 +84,7 @@ semfs_sem_create(const char *name)
 void
 semfs_sem_destroy(struct semfs_sem *sem)
 {
+	pollq_cleanup(&sem->sems_pollq);
 	cv_destroy(sem->sems_cv);
 	lock_destroy(sem->sems_lock);
 	kfree(sem);
@@ -94,7 +98,7 @@ semfs_sem_insert(struct semfs *semfs, struct semfs_sem *sem, unsigned *ret)
 {
 	unsigned i, num;
 
-	KASSERT(lock_do_i_hold(semfs->semfs_tablelock));
+	KASSERT(rwlock_do_i_hold_write(semfs->semfs_tablelock));
 	num = semfs_semarray_num(semfs->semfs_sems);
 	if (num == SEMFS_ROOTDIR) {
 		/* Too many */
@@ -131,6 +135,8 @@ semfs_direntry_create(const char *name, unsigned semnum)
 		return NULL;
 	}
 	dent->semd_semnum = semnum;
+	dent->semd_slot = 0;
+	dent->semd_hashnext = NULL;
 	return dent;
 }
 
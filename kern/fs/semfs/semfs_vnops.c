@@ -30,12 +30,17 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/fcntl.h>
+#include <kern/ioctl.h>
+#include <kern/poll.h>
 #include <stat.h>
 #include <uio.h>
 #include <synch.h>
 #include <thread.h>
 #include <proc.h>
 #include <current.h>
+#include <clock.h>
+#include <copyinout.h>
+#include <workqueue.h>
 #include <vfs.h>
 #include <vnode.h>
 
@@ -62,16 +67,6 @@ semfs_eachopen(struct vnode *vn, int openflags)
 	return 0;
 }
 
-static
-int
-semfs_ioctl(struct vnode *vn, int op, userptr_t data)
-{
-	(void)vn;
-	(void)op;
-	(void)data;
-	return EINVAL;
-}
-
 static
 int
 semfs_gettype(struct vnode *vn, mode_t *ret)
@@ -116,9 +111,9 @@ semfs_getsembynum(struct semfs *semfs, unsigned semnum)
 {
 	struct semfs_sem *sem;
 
-	lock_acquire(semfs->semfs_tablelock);
+	rwlock_acquire_read(semfs->semfs_tablelock);
 	sem = semfs_semarray_get(semfs->semfs_sems, semnum);
-	lock_release(semfs->semfs_tablelock);
+	rwlock_release_read(semfs->semfs_tablelock);
 
 	return sem;
 }
@@ -133,24 +128,54 @@ semfs_getsem(struct semfs_vnode *semv)
 }
 
 /*
- * Wakeup helper. We only need to wake up if there are sleepers, which
- * should only be the case if the old count is 0; and we only
- * potentially need to wake more than one sleeper if the new count
- * will be more than 1.
+ * Wakeup helper, for when the count goes up to NEWCOUNT. Each sleeper
+ * takes at least one, so there's no point waking more than NEWCOUNT
+ * of them; a V of N thus costs one pass and at most N wakeups instead
+ * of N passes or a thundering herd.
+ *
+ * sems_waiters counts the threads still asleep on the CV, so it goes
+ * down here rather than when they wake up.
+ *
+ * A timed P needs its whole count at once, so it can take a wakeup,
+ * find too little and go back to sleep, and the wakeup is lost to a
+ * plain P that could have used it. So while any timed P is waiting,
+ * wake everybody and let them sort it out.
  */
 static
 void
 semfs_wakeup(struct semfs_sem *sem, unsigned newcount)
 {
-	if (sem->sems_count > 0 || newcount == 0) {
+	unsigned i, n;
+
+	if (newcount <= sem->sems_count) {
 		return;
 	}
-	if (newcount == 1) {
-		cv_signal(sem->sems_cv, sem->sems_lock);
+	pollq_wakeup(&sem->sems_pollq);
+	n = newcount < sem->sems_waiters ? newcount : sem->sems_waiters;
+	if (n == 0) {
+		return;
 	}
-	else {
+	if (n == sem->sems_waiters || sem->sems_timedwaiters > 0) {
 		cv_broadcast(sem->sems_cv, sem->sems_lock);
+		n = sem->sems_waiters;
+	}
+	else {
+		for (i=0; i<n; i++) {
+			cv_signal(sem->sems_cv, sem->sems_lock);
+		}
 	}
+	sem->sems_waiters -= n;
+}
+
+/*
+ * Sleep on the semaphore's CV.
+ */
+static
+void
+semfs_sleep(struct semfs_sem *sem)
+{
+	sem->sems_waiters++;
+	cv_wait(sem->sems_cv, sem->sems_lock);
 }
 
 /*
@@ -215,7 +240,7 @@ semfs_read(struct vnode *vn, struct uio *uio)
 		if (sem->sems_count == 0) {
 			DEBUG(DB_SEMFS, "semfs: sem%u: blocking\n",
 			      semv->semv_semnum);
-			cv_wait(sem->sems_cv, sem->sems_lock);
+			semfs_sleep(sem);
 		}
 	}
 	lock_release(sem->sems_lock);
@@ -255,6 +280,198 @@ semfs_write(struct vnode *vn, struct uio *uio)
 	return 0;
 }
 
+/*
+ * Timeout for SEMIOC_TIMEDP. A P that is over first cancels the work
+ * item, but it may already be on its way and fire after the P is
+ * over, so it holds a reference to the vnode to keep the semaphore
+ * around, and whichever of the two is last frees this. The flags are
+ * protected by sems_lock.
+ */
+struct semfs_timeout {
+	struct work semt_work;
+	struct vnode *semt_vn;
+	struct semfs_sem *semt_sem;
+	bool semt_expired;			/* Set by the work item */
+	bool semt_done;				/* Set by the waiter */
+};
+
+static
+void
+semfs_timeout_expire(void *data)
+{
+	struct semfs_timeout *st = data;
+	struct semfs_sem *sem = st->semt_sem;
+	struct vnode *vn = st->semt_vn;
+	bool done;
+
+	lock_acquire(sem->sems_lock);
+	st->semt_expired = true;
+	done = st->semt_done;
+	if (!done) {
+		/* We don't know which sleeper is ours */
+		cv_broadcast(sem->sems_cv, sem->sems_lock);
+		sem->sems_waiters = 0;
+	}
+	lock_release(sem->sems_lock);
+
+	if (done) {
+		kfree(st);
+	}
+	VOP_DECREF(vn);
+}
+
+/*
+ * P of COUNT, all at once, giving up after TIMEOUT_MS.
+ */
+static
+int
+semfs_timedp(struct vnode *vn, unsigned count, unsigned timeout_ms)
+{
+	struct semfs_vnode *semv = vn->vn_data;
+	struct semfs_sem *sem;
+	struct semfs_timeout *st;
+	unsigned ticks;
+	bool expired;
+	int result;
+
+	sem = semfs_getsem(semv);
+
+	/* Round up, so we never wait less than asked */
+	ticks = ((uint64_t)timeout_ms * HZ + 999) / 1000;
+
+	st = kmalloc(sizeof(*st));
+	if (st == NULL) {
+		return ENOMEM;
+	}
+	work_init(&st->semt_work, semfs_timeout_expire, st);
+	VOP_INCREF(vn);
+	st->semt_vn = vn;
+	st->semt_sem = sem;
+	st->semt_expired = false;
+	st->semt_done = false;
+
+	lock_acquire(sem->sems_lock);
+	workqueue_enqueue_delayed(&st->semt_work, ticks);
+	sem->sems_timedwaiters++;
+	while (sem->sems_count < count && !st->semt_expired) {
+		semfs_sleep(sem);
+	}
+	sem->sems_timedwaiters--;
+	if (sem->sems_count >= count) {
+		DEBUG(DB_SEMFS, "semfs: sem%u: timed P, count %u -> %u\n",
+		      semv->semv_semnum, sem->sems_count,
+		      sem->sems_count - count);
+		sem->sems_count -= count;
+		result = 0;
+	}
+	else {
+		result = ETIMEDOUT;
+	}
+	st->semt_done = true;
+	expired = st->semt_expired;
+	lock_release(sem->sems_lock);
+
+	if (!expired && workqueue_cancel(&st->semt_work)) {
+		/* It will never fire; don't leave it queued till it would */
+		VOP_DECREF(st->semt_vn);
+		kfree(st);
+	}
+	else if (expired) {
+		kfree(st);
+	}
+	return result;
+}
+
+/*
+ * P of COUNT, all at once, or EAGAIN.
+ */
+static
+int
+semfs_tryp(struct vnode *vn, unsigned count)
+{
+	struct semfs_vnode *semv = vn->vn_data;
+	struct semfs_sem *sem;
+	int result;
+
+	sem = semfs_getsem(semv);
+
+	lock_acquire(sem->sems_lock);
+	if (sem->sems_count >= count) {
+		DEBUG(DB_SEMFS, "semfs: sem%u: try P, count %u -> %u\n",
+		      semv->semv_semnum, sem->sems_count,
+		      sem->sems_count - count);
+		sem->sems_count -= count;
+		result = 0;
+	}
+	else {
+		result = EAGAIN;
+	}
+	lock_release(sem->sems_lock);
+	return result;
+}
+
+/*
+ * poll() for semaphore vnodes: readable (a read of 1 won't sleep)
+ * while the count is nonzero. V never sleeps, so always writable.
+ */
+static
+int
+semfs_sempoll(struct vnode *vn, int events, struct pollwait *pw)
+{
+	struct semfs_vnode *semv = vn->vn_data;
+	struct semfs_sem *sem;
+	int ret;
+
+	sem = semfs_getsem(semv);
+
+	ret = events & POLLOUT;
+	if (events & POLLIN) {
+		lock_acquire(sem->sems_lock);
+		pollq_register(&sem->sems_pollq, pw);
+		if (sem->sems_count > 0) {
+			ret |= POLLIN;
+		}
+		lock_release(sem->sems_lock);
+	}
+	return ret;
+}
+
+/*
+ * ioctl: the P variants that read() can't express. See <kern/ioctl.h>.
+ */
+static
+int
+semfs_ioctl(struct vnode *vn, int op, userptr_t data)
+{
+	struct semfs_vnode *semv = vn->vn_data;
+	struct semioc_timedp tp;
+	unsigned count;
+	int result;
+
+	if (semv->semv_semnum == SEMFS_ROOTDIR) {
+		return EINVAL;
+	}
+
+	switch (op) {
+	    case SEMIOC_TRYP:
+		result = copyin((const_userptr_t)data, &count, sizeof(count));
+		if (result) {
+			return result;
+		}
+		return semfs_tryp(vn, count);
+	    case SEMIOC_TIMEDP:
+		result = copyin((const_userptr_t)data, &tp, sizeof(tp));
+		if (result) {
+			return result;
+		}
+		if (tp.st_timeout_ms == 0) {
+			return semfs_tryp(vn, tp.st_count);
+		}
+		return semfs_timedp(vn, tp.st_count, tp.st_timeout_ms);
+	}
+	return EINVAL;
+}
+
 /*
  * Truncate. Set the count to the specified value.
  *
@@ -294,6 +511,92 @@ semfs_truncate(struct vnode *vn, off_t len)
 ////////////////////////////////////////////////////////////
 // directory ops
 
+/*
+ * Hash a name (FNV-1a).
+ */
+static
+unsigned
+semfs_namehash(const char *name)
+{
+	unsigned hash = 2166136261U;
+
+	while (*name != 0) {
+		hash = (hash ^ (unsigned char)*name++) * 16777619U;
+	}
+	return hash % SEMFS_DIRHASH;
+}
+
+/*
+ * Find a directory entry by name. Call with the dir locked.
+ */
+static
+struct semfs_direntry *
+semfs_dirfind(struct semfs *semfs, const char *name)
+{
+	struct semfs_direntry *dent;
+
+	KASSERT(lock_do_i_hold(semfs->semfs_dirlock));
+
+	dent = semfs->semfs_dirhash[semfs_namehash(name)];
+	while (dent != NULL && strcmp(dent->semd_name, name) != 0) {
+		dent = dent->semd_hashnext;
+	}
+	return dent;
+}
+
+/*
+ * Add a directory entry. Call with the dir locked.
+ */
+static
+int
+semfs_diradd(struct semfs *semfs, struct semfs_direntry *dent)
+{
+	unsigned h;
+	int result;
+
+	KASSERT(lock_do_i_hold(semfs->semfs_dirlock));
+
+	result = semfs_direntryarray_add(semfs->semfs_dents, dent,
+					 &dent->semd_slot);
+	if (result) {
+		return result;
+	}
+	h = semfs_namehash(dent->semd_name);
+	dent->semd_hashnext = semfs->semfs_dirhash[h];
+	semfs->semfs_dirhash[h] = dent;
+	return 0;
+}
+
+/*
+ * Take a directory entry out (but don't destroy it). The last entry
+ * moves into its slot, so the array stays packed; a getdirentry
+ * running through the directory at the same time may miss it.
+ */
+static
+void
+semfs_dirdel(struct semfs *semfs, struct semfs_direntry *dent)
+{
+	struct semfs_direntry **dp, *last;
+	unsigned num;
+
+	KASSERT(lock_do_i_hold(semfs->semfs_dirlock));
+
+	dp = &semfs->semfs_dirhash[semfs_namehash(dent->semd_name)];
+	while (*dp != dent) {
+		KASSERT(*dp != NULL);
+		dp = &(*dp)->semd_hashnext;
+	}
+	*dp = dent->semd_hashnext;
+	dent->semd_hashnext = NULL;
+
+	num = semfs_direntryarray_num(semfs->semfs_dents);
+	KASSERT(dent->semd_slot < num);
+	last = semfs_direntryarray_get(semfs->semfs_dents, num - 1);
+	last->semd_slot = dent->semd_slot;
+	semfs_direntryarray_set(semfs->semfs_dents, dent->semd_slot, last);
+	semfs_direntryarray_setsize(semfs->semfs_dents, num - 1);
+}
+
 /*
  * Directory read. Note that there's only one directory (the semfs
  * root) that has all the semaphores in it.
@@ -378,7 +681,7 @@ semfs_creat(struct vnode *dirvn, const char *name, bool excl, mode_t mode,
 	struct semfs *semfs = dirsemv->semv_semfs;
 	struct semfs_direntry *dent;
 	struct semfs_sem *sem;
-	unsigned i, num, empty, semnum;
+	unsigned semnum;
 	int result;
 
 	(void)mode;
@@ -387,27 +690,16 @@ semfs_creat(struct vnode *dirvn, const char *name, bool excl, mode_t mode,
 	}
 
 	lock_acquire(semfs->semfs_dirlock);
-	num = semfs_direntryarray_num(semfs->semfs_dents);
-	empty = num;
-	for (i=0; i<num; i++) {
-		dent = semfs_direntryarray_get(semfs->semfs_dents, i);
-		if (dent == NULL) {
-			if (empty == num) {
-				empty = i;
-			}
-			continue;
-		}
-		if (!strcmp(dent->semd_name, name)) {
-			/* found */
-			if (excl) {
-				lock_release(semfs->semfs_dirlock);
-				return EEXIST;
-			}
-			result = semfs_getvnode(semfs, dent->semd_semnum,
-						resultvn);
+	dent = semfs_dirfind(semfs, name);
+	if (dent != NULL) {
+		/* found */
+		if (excl) {
 			lock_release(semfs->semfs_dirlock);
-			return result;
+			return EEXIST;
 		}
+		result = semfs_getvnode(semfs, dent->semd_semnum, resultvn);
+		lock_release(semfs->semfs_dirlock);
+		return result;
 	}
 
 	/* create it */
@@ -416,27 +708,22 @@ semfs_creat(struct vnode *dirvn, const char *name, bool excl, mode_t mode,
 		result = ENOMEM;
 		goto fail_unlock;
 	}
-	lock_acquire(semfs->semfs_tablelock);
+	rwlock_acquire_write(semfs->semfs_tablelock);
 	result = semfs_sem_insert(semfs, sem, &semnum);
-	lock_release(semfs->semfs_tablelock);
+	rwlock_release_write(semfs->semfs_tablelock);
 	if (result) {
 		goto fail_uncreate;
 	}
 
 	dent = semfs_direntry_create(name, semnum);
 	if (dent == NULL) {
+		result = ENOMEM;
 		goto fail_uninsert;
 	}
 
-	if (empty < num) {
-		semfs_direntryarray_set(semfs->semfs_dents, empty, dent);
-	}
-	else {
-		result = semfs_direntryarray_add(semfs->semfs_dents, dent,
-						 &empty);
-		if (result) {
-			goto fail_undent;
-		}
+	result = semfs_diradd(semfs, dent);
+	if (result) {
+		goto fail_undent;
 	}
 
 	result = semfs_getvnode(semfs, semnum, resultvn);
@@ -449,13 +736,13 @@ semfs_creat(struct vnode *dirvn, const char *name, bool excl, mode_t mode,
 	return 0;
 
  fail_undir:
-	semfs_direntryarray_set(semfs->semfs_dents, empty, NULL);
+	semfs_dirdel(semfs, dent);
  fail_undent:
 	semfs_direntry_destroy(dent);
  fail_uninsert:
-	lock_acquire(semfs->semfs_tablelock);
+	rwlock_acquire_write(semfs->semfs_tablelock);
 	semfs_semarray_set(semfs->semfs_sems, semnum, NULL);
-	lock_release(semfs->semfs_tablelock);
+	rwlock_release_write(semfs->semfs_tablelock);
  fail_uncreate:
 	semfs_sem_destroy(sem);
  fail_unlock:
@@ -475,47 +762,37 @@ semfs_remove(struct vnode *dirvn, const char *name)
 	struct semfs *semfs = dirsemv->semv_semfs;
 	struct semfs_direntry *dent;
 	struct semfs_sem *sem;
-	unsigned i, num;
-	int result;
 
 	if (!strcmp(name, ".") || !strcmp(name, "..")) {
 		return EINVAL;
 	}
 
 	lock_acquire(semfs->semfs_dirlock);
-	num = semfs_direntryarray_num(semfs->semfs_dents);
-	for (i=0; i<num; i++) {
-		dent = semfs_direntryarray_get(semfs->semfs_dents, i);
-		if (dent == NULL) {
-			continue;
-		}
-		if (!strcmp(name, dent->semd_name)) {
-			/* found */
-			sem = semfs_getsembynum(semfs, dent->semd_semnum);
-			lock_acquire(sem->sems_lock);
-			KASSERT(sem->sems_linked);
-			sem->sems_linked = false;
-			if (sem->sems_hasvnode == false) {
-				lock_acquire(semfs->semfs_tablelock);
-				semfs_semarray_set(semfs->semfs_sems,
-						   dent->semd_semnum, NULL);
-				lock_release(semfs->semfs_tablelock);
-				lock_release(sem->sems_lock);
-				semfs_sem_destroy(sem);
-			}
-			else {
-				lock_release(sem->sems_lock);
-			}
-			semfs_direntryarray_set(semfs->semfs_dents, i, NULL);
-			semfs_direntry_destroy(dent);
-			result = 0;
-			goto out;
-		}
+	dent = semfs_dirfind(semfs, name);
+	if (dent == NULL) {
+		lock_release(semfs->semfs_dirlock);
+		return ENOENT;
 	}
-	result = ENOENT;
- out:
+
+	sem = semfs_getsembynum(semfs, dent->semd_semnum);
+	lock_acquire(sem->sems_lock);
+	KASSERT(sem->sems_linked);
+	sem->sems_linked = false;
+	if (sem->sems_hasvnode == false) {
+		rwlock_acquire_write(semfs->semfs_tablelock);
+		semfs_semarray_set(semfs->semfs_sems, dent->semd_semnum, NULL);
+		rwlock_release_write(semfs->semfs_tablelock);
+		lock_release(sem->sems_lock);
+		semfs_sem_destroy(sem);
+	}
+	else {
+		lock_release(sem->sems_lock);
+	}
+	semfs_dirdel(semfs, dent);
+	semfs_direntry_destroy(dent);
+
 	lock_release(semfs->semfs_dirlock);
-	return result;
+	return 0;
 }
 
 /*
@@ -528,7 +805,6 @@ semfs_lookup(struct vnode *dirvn, char *path, struct vnode **resultvn)
 	struct semfs_vnode *dirsemv = dirvn->vn_data;
 	struct semfs *semfs = dirsemv->semv_semfs;
 	struct semfs_direntry *dent;
-	unsigned i, num;
 	int result;
 
 	if (!strcmp(path, ".") || !strcmp(path, "..")) {
@@ -538,21 +814,14 @@ semfs_lookup(struct vnode *dirvn, char *path, struct vnode **resultvn)
 	}
 
 	lock_acquire(semfs->semfs_dirlock);
-	num = semfs_direntryarray_num(semfs->semfs_dents);
-	for (i=0; i<num; i++) {
-		dent = semfs_direntryarray_get(semfs->semfs_dents, i);
-		if (dent == NULL) {
-			continue;
-		}
-		if (!strcmp(path, dent->semd_name)) {
-			result = semfs_getvnode(semfs, dent->semd_semnum,
-						resultvn);
-			lock_release(semfs->semfs_dirlock);
-			return result;
-		}
+	dent = semfs_dirfind(semfs, path);
+	if (dent == NULL) {
+		lock_release(semfs->semfs_dirlock);
+		return ENOENT;
 	}
+	result = semfs_getvnode(semfs, dent->semd_semnum, resultvn);
 	lock_release(semfs->semfs_dirlock);
-	return ENOENT;
+	return result;
 }
 
 /*
@@ -601,7 +870,7 @@ semfs_reclaim(struct vnode *vn)
 	struct semfs_sem *sem;
 	unsigned i, num;
 
-	lock_acquire(semfs->semfs_tablelock);
+	rwlock_acquire_write(semfs->semfs_tablelock);
 
 	/* vnode refcount is protected by the vnode's ->vn_countlock */
 	spinlock_acquire(&vn->vn_countlock);
@@ -610,7 +879,7 @@ semfs_reclaim(struct vnode *vn)
 		vn->vn_refcount--;
 
 		spinlock_release(&vn->vn_countlock);
-		lock_release(semfs->semfs_tablelock);
+		rwlock_release_write(semfs->semfs_tablelock);
 		return EBUSY;
 	}
 
@@ -638,7 +907,7 @@ semfs_reclaim(struct vnode *vn)
 	}
 
 	/* done with the table */
-	lock_release(semfs->semfs_tablelock);
+	rwlock_release_write(semfs->semfs_tablelock);
 
 	/* destroy it */
 	semfs_vnode_destroy(semv);
@@ -666,6 +935,7 @@ static const struct vnode_ops semfs_dirops = {
 	.vop_mmap = vopfail_mmap_isdir,
 	.vop_truncate = vopfail_truncate_isdir,
 	.vop_namefile = semfs_namefile,
+	.vop_poll = vopstub_poll_ready,
 
 	.vop_creat = semfs_creat,
 	.vop_symlink = vopfail_symlink_nosys,
@@ -699,6 +969,7 @@ static const struct vnode_ops semfs_semops = {
 	.vop_mmap = vopfail_mmap_perm,
 	.vop_truncate = semfs_truncate,
 	.vop_namefile = vopfail_uio_notdir,
+	.vop_poll = semfs_sempoll,
 
 	.vop_creat = vopfail_creat_notdir,
 	.vop_symlink = vopfail_symlink_notdir,
@@ -746,29 +1017,59 @@ semfs_vnode_create(struct semfs *semfs, unsigned semnum)
 }
 
 /*
- * Look up the vnode for a semaphore by number; if it doesn't exist,
- * create it.
+ * Find the vnode for a semaphore by number in the vnode table, and
+ * take a reference to it. Call with the table locked.
  */
-int
-semfs_getvnode(struct semfs *semfs, unsigned semnum, struct vnode **ret)
+static
+struct vnode *
+semfs_findvnode(struct semfs *semfs, unsigned semnum)
 {
 	struct vnode *vn;
 	struct semfs_vnode *semv;
-	struct semfs_sem *sem;
 	unsigned i, num;
-	int result;
-
-	/* Lock the vnode table */
-	lock_acquire(semfs->semfs_tablelock);
 
-	/* Look for it */
 	num = vnodearray_num(semfs->semfs_vnodes);
 	for (i=0; i<num; i++) {
 		vn = vnodearray_get(semfs->semfs_vnodes, i);
 		semv = vn->vn_data;
 		if (semv->semv_semnum == semnum) {
 			VOP_INCREF(vn);
-			lock_release(semfs->semfs_tablelock);
+			return vn;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Look up the vnode for a semaphore by number; if it doesn't exist,
+ * create it.
+ *
+ * The lookup only needs the table shared, so opens of existing
+ * semaphores don't serialize. Creating the vnode needs it exclusive;
+ * if we can't upgrade, someone else might be creating the same one,
+ * so look again once we have it.
+ */
+int
+semfs_getvnode(struct semfs *semfs, unsigned semnum, struct vnode **ret)
+{
+	struct vnode *vn;
+	struct semfs_vnode *semv;
+	struct semfs_sem *sem;
+	int result;
+
+	rwlock_acquire_read(semfs->semfs_tablelock);
+	vn = semfs_findvnode(semfs, semnum);
+	if (vn != NULL) {
+		rwlock_release_read(semfs->semfs_tablelock);
+		*ret = vn;
+		return 0;
+	}
+	if (!rwlock_tryupgrade(semfs->semfs_tablelock)) {
+		rwlock_release_read(semfs->semfs_tablelock);
+		rwlock_acquire_write(semfs->semfs_tablelock);
+		vn = semfs_findvnode(semfs, semnum);
+		if (vn != NULL) {
+			rwlock_release_write(semfs->semfs_tablelock);
 			*ret = vn;
 			return 0;
 		}
@@ -777,13 +1078,13 @@ semfs_getvnode(struct semfs *semfs, unsigned semnum, struct vnode **ret)
 	/* Make it */
 	semv = semfs_vnode_create(semfs, semnum);
 	if (semv == NULL) {
-		lock_release(semfs->semfs_tablelock);
+		rwlock_release_write(semfs->semfs_tablelock);
 		return ENOMEM;
 	}
 	result = vnodearray_add(semfs->semfs_vnodes, &semv->semv_absvn, NULL);
 	if (result) {
 		semfs_vnode_destroy(semv);
-		lock_release(semfs->semfs_tablelock);
+		rwlock_release_write(semfs->semfs_tablelock);
 		return ENOMEM;
 	}
 	if (semnum != SEMFS_ROOTDIR) {
@@ -792,7 +1093,7 @@ semfs_getvnode(struct semfs *semfs, unsigned semnum, struct vnode **ret)
 		KASSERT(sem->sems_hasvnode == false);
 		sem->sems_hasvnode = true;
 	}
-	lock_release(semfs->semfs_tablelock);
+	rwlock_release_write(semfs->semfs_tablelock);
 
 	*ret = &semv->semv_absvn;
 	return 0;
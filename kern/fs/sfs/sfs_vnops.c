@@ -602,6 +602,7 @@ const struct vnode_ops sfs_fileops = {
 	.vop_mmap = sfs_mmap,
 	.vop_truncate = sfs_truncate,
 	.vop_namefile = vopfail_uio_notdir,
+	.vop_poll = vopstub_poll_ready,
 
 	.vop_creat = vopfail_creat_notdir,
 	.vop_symlink = vopfail_symlink_notdir,
@@ -636,6 +637,7 @@ const struct vnode_ops sfs_dirops = {
 	.vop_mmap = vopfail_mmap_isdir,
 	.vop_truncate = vopfail_truncate_isdir,
 	.vop_namefile = sfs_namefile,
+	.vop_poll = vopstub_poll_ready,
 
 	.vop_creat = sfs_creat,
 	.vop_symlink = vopfail_symlink_nosys,
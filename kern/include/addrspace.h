@@ -40,6 +40,11 @@
 
 struct vnode;
 
+#if OPT_DUMBVM
+/* Number of extra user stacks, for additional threads, per address space */
+#define DUMBVM_THREADSTACKS 16
+#endif
+
 
 /*
  * Address space - data structure associated with the virtual memory
@@ -57,6 +62,8 @@ struct addrspace {
         paddr_t as_pbase2;
         size_t as_npages2;
         paddr_t as_stackpbase;
+        paddr_t as_tstackpbase[DUMBVM_THREADSTACKS]; /* 0 if not allocated */
+        uint32_t as_tstackused;        /* Bitmap of thread stacks in use */
 #else
         /* Put stuff here for your VM system */
 #endif
@@ -99,6 +106,18 @@ struct addrspace {
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_define_thread_stack - set up another user stack, for an
+ *                additional thread of the process. Hands back its
+ *                initial stack pointer and a slot number that
+ *                identifies it.
+ *
+ *    as_release_thread_stack - give back the stack in slot SLOT
+ *                once its thread has exited. The memory may be kept
+ *                around for the next thread.
+ *
+ *    as_translate - find the physical address that user address VADDR
+ *                maps to. Fails with EFAULT if it isn't mapped.
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
@@ -117,6 +136,11 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+int               as_define_thread_stack(struct addrspace *as, int *slot,
+                                         vaddr_t *initstackptr);
+void              as_release_thread_stack(struct addrspace *as, int slot);
+int               as_translate(struct addrspace *as, vaddr_t vaddr,
+                               paddr_t *ret);
 
 
 /*
@@ -48,6 +48,9 @@
 void hardclock_bootstrap(void);
 void hardclock(void);
 
+/* Counts hardclock() calls; per cpu, see percpu.h. */
+extern struct percpu_counter hardclocks;
+
 /*
  * timerclock() is called on one CPU once a second to allow simple
  * timed operations. (This is a fairly simpleminded interface.)
@@ -59,6 +62,12 @@ void timerclock(void);
  */
 void gettime(struct timespec *ret);
 
+/*
+ * gettime_ns() returns the same clock as a plain nanosecond count,
+ * or 0 if no clock is attached yet. Intended for statistics.
+ */
+uint64_t gettime_ns(void);
+
 /*
  * arithmetic on times
  *
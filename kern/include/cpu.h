@@ -34,6 +34,11 @@
 #include <spinlock.h>
 #include <threadlist.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
+#include <schedstats.h>
+#include <lockstat.h>
+
+struct workqueue;	/* Opaque; see workqueue.h */
+struct rcu_cpu;		/* Opaque; see rcu.h */
 
 
 /*
@@ -59,17 +64,41 @@ struct cpu {
 	 */
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
-	unsigned c_hardclocks;		/* Counter of hardclock() calls */
+	unsigned *c_counters;		/* Per-cpu counter slots (percpu.h) */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+#if OPT_SCHEDSTATS
+	struct schedstats c_stats;	/* Scheduler statistics */
+#endif
+#if OPT_LOCKSTAT
+	struct lockstat_table *c_lockstat; /* Lock statistics */
+#endif
+	struct rcu_cpu *c_rcu;		/* RCU callbacks (rcu.h) */
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
+	 *
+	 * Real-time threads (see thread_set_realtime) don't go on
+	 * c_runqueue. Runnable ones go on c_rtqueue, ordered by
+	 * absolute deadline, and are always picked first. Ones that
+	 * used up their budget or finished their job for this period
+	 * wait on c_rtwait until their next release. c_rtutil is the
+	 * sum of the admitted threads' densities (budget/deadline), in
+	 * thousandths.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
 	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	struct threadlist c_rtqueue;	/* Runnable real-time threads */
+	struct threadlist c_rtwait;	/* Real-time threads awaiting release */
+	unsigned c_rtutil;		/* Admitted real-time load */
 	struct spinlock c_runqueue_lock;
 
+	/*
+	 * Deferred work for this cpu (see workqueue.h).
+	 * Protected by its own internal lock.
+	 */
+	struct workqueue *c_workqueue;
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the IPI lock.
@@ -107,6 +136,14 @@ void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
 
+/*
+ * Walk the cpus, for code outside the thread system that needs to
+ * look at all of them (mostly statistics). cpu_count returns the
+ * number of cpus; cpu_get returns the cpu with software number N.
+ */
+unsigned cpu_count(void);
+struct cpu *cpu_get(unsigned n);
+
 /*
  * Produce a string describing the CPU type.
  */
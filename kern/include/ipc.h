@@ -0,0 +1,53 @@
+#ifndef _IPC_H_
+#define _IPC_H_
+
+/*
+ * Synchronous message-passing IPC, in the style of L4.
+ *
+ * Every process has an endpoint. Threads send to an endpoint and
+ * threads of the owning process receive from it. There is no
+ * buffering: a send waits for a receiver, or a receive for a sender,
+ * and the message is copied straight from one thread to the other.
+ *
+ * A thread that receives a call owes the caller a reply; it keeps
+ * the caller in its own state until it replies (or exits, which
+ * fails the call with EPIPE). When a call finds a receiver waiting,
+ * or a reply finds its caller, on the same cpu, the cpu is handed
+ * directly to the other thread (see wchan_sleep_handoff), so a round
+ * trip costs two context switches and no run queue wait.
+ *
+ * Endpoints are reference counted; the process holds one reference
+ * and each thread waiting on the endpoint holds another.
+ *
+ *    ipc_endpoint_create  - make a new endpoint, with one reference.
+ *    ipc_endpoint_ref     - add a reference.
+ *    ipc_endpoint_release - drop a reference.
+ *    ipc_endpoint_close   - refuse further messages and fail the
+ *                           threads waiting on the endpoint.
+ *
+ *    ipc_send, ipc_call, ipc_recv, ipc_reply, ipc_replyrecv
+ *                         - as described in <kern/ipc.h>. BADGE is the
+ *                           sender's pid, handed to the receiver.
+ *    ipc_thread_exit      - clean up the current thread's IPC state.
+ *                           Call before the thread exits.
+ */
+
+#include <kern/ipc.h>
+
+struct ipc_endpoint;	/* Opaque */
+
+struct ipc_endpoint *ipc_endpoint_create(void);
+void ipc_endpoint_ref(struct ipc_endpoint *ep);
+void ipc_endpoint_release(struct ipc_endpoint *ep);
+void ipc_endpoint_close(struct ipc_endpoint *ep);
+
+int ipc_send(struct ipc_endpoint *ep, const struct ipc_msg *msg, pid_t badge);
+int ipc_call(struct ipc_endpoint *ep, struct ipc_msg *msg, pid_t badge);
+int ipc_recv(struct ipc_endpoint *ep, struct ipc_msg *msg, pid_t *badge);
+int ipc_reply(const struct ipc_msg *msg);
+int ipc_replyrecv(struct ipc_endpoint *ep, struct ipc_msg *msg, pid_t *badge);
+
+void ipc_thread_exit(void);
+
+
+#endif /* _IPC_H_ */
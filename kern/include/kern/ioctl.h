@@ -34,6 +34,23 @@
  * ioctl operation codes
  */
 
-/* (none yet) */
+/*
+ * semfs semaphores. Both take the whole count or nothing, unlike
+ * read(), which takes what it can and waits for the rest.
+ *
+ * SEMIOC_TRYP: P without waiting. The argument points to an unsigned
+ * int count; fails with EAGAIN if the semaphore is lower than that.
+ *
+ * SEMIOC_TIMEDP: P, waiting at most a given time. The argument points
+ * to a struct semioc_timedp; fails with ETIMEDOUT if the time runs
+ * out first.
+ */
+#define SEMIOC_TRYP	1
+#define SEMIOC_TIMEDP	2
+
+struct semioc_timedp {
+	unsigned st_count;		/* Amount to take */
+	unsigned st_timeout_ms;		/* Longest wait, in milliseconds */
+};
 
 #endif /* _KERN_IOCTL_H_*/
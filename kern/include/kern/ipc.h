@@ -0,0 +1,27 @@
+#ifndef _KERN_IPC_H_
+#define _KERN_IPC_H_
+
+/*
+ * Definitions for synchronous message-passing IPC.
+ *
+ * A message is a small fixed set of registers, copied directly from
+ * the sender to the receiver. Messages are addressed to processes;
+ * any thread of the destination process that is waiting in
+ * ipc_recv() (or ipc_replyrecv()) can take it.
+ *
+ *    ipc_send      - send a message, waiting until it is received.
+ *    ipc_call      - send a message and wait for the reply, which
+ *                    overwrites the message.
+ *    ipc_recv      - wait for a message. Returns the sender's pid.
+ *    ipc_reply     - answer the last ipc_call this thread received.
+ *    ipc_replyrecv - ipc_reply, then ipc_recv into the same buffer.
+ *                    This is the normal server loop.
+ */
+
+#define IPC_NMR		8	/* Number of message registers */
+
+struct ipc_msg {
+	__u32 mr[IPC_NMR];
+};
+
+#endif /* _KERN_IPC_H_ */
@@ -0,0 +1,42 @@
+#ifndef _KERN_POLL_H_
+#define _KERN_POLL_H_
+
+/*
+ * Definitions for poll() and select().
+ *
+ * poll takes an array of struct pollfd. For each one, the caller sets
+ * fd and the events it is interested in; the kernel sets revents to
+ * those that are ready, plus POLLERR, POLLHUP and POLLNVAL, which are
+ * reported whether asked for or not. Entries with a negative fd are
+ * skipped. The timeout is in milliseconds; negative waits forever and
+ * zero doesn't wait at all.
+ *
+ *    POLLIN   - a read won't block.
+ *    POLLPRI  - accepted, but nothing ever reports it.
+ *    POLLOUT  - a write won't block.
+ *    POLLERR  - a write would fail (e.g. a pipe with no reader).
+ *    POLLHUP  - the other side is gone (e.g. a pipe with no writer);
+ *               reads return what is left and then EOF.
+ *    POLLNVAL - fd isn't open.
+ *
+ * select's fd sets are arrays of 32-bit words, with fd in bit fd % 32
+ * of word fd / 32, as many words as it takes to hold nfds bits. Read,
+ * write and exception sets map to POLLIN, POLLOUT and POLLPRI; fds
+ * that aren't open make select fail with EBADF. The timeout is a
+ * struct timeval (see <kern/time.h>), or NULL to wait forever.
+ */
+
+struct pollfd {
+	int fd;			/* Descriptor to check */
+	short events;		/* What to check for */
+	short revents;		/* What was found */
+};
+
+#define POLLIN		0x01
+#define POLLPRI		0x02
+#define POLLOUT		0x04
+#define POLLERR		0x08
+#define POLLHUP		0x10
+#define POLLNVAL	0x20
+
+#endif /* _KERN_POLL_H_ */
@@ -109,13 +109,13 @@
 #define SYS_close        49
 #define SYS_read         50
 #define SYS_pread        51
-//#define SYS_readv      52
-//#define SYS_preadv     53
+#define SYS_readv        52
+#define SYS_preadv       53
 #define SYS_getdirentry  54
 #define SYS_write        55
 #define SYS_pwrite       56
-//#define SYS_writev     57
-//#define SYS_pwritev    58
+#define SYS_writev       57
+#define SYS_pwritev      58
 #define SYS_lseek        59
 #define SYS_flock        60
 #define SYS_ftruncate    61
@@ -197,6 +197,25 @@
 #define SYS_reboot       119
 //#define SYS___sysctl   120
 
+//                              -- User threads --
+#define SYS_thread_create 121
+#define SYS_thread_exit  122
+#define SYS_thread_join  123
+
+//                              -- IPC --
+#define SYS_ipc_send     124
+#define SYS_ipc_call     125
+#define SYS_ipc_recv     126
+#define SYS_ipc_reply    127
+#define SYS_ipc_replyrecv 128
+
+//                              -- Futexes --
+#define SYS_futex_wait   129
+#define SYS_futex_wake   130
+
+//                              -- Process launch --
+#define SYS_spawn        131
+
 /*CALLEND*/
 
 
@@ -125,9 +125,12 @@ uint32_t random(void);
  *
  * kheap_nextgeneration, dump, and dumpall do nothing unless heap
  * labeling (for leak detection) in kmalloc.c (q.v.) is enabled.
+ * kheap_bootstrap sets up the call counters that kheap_printstats
+ * reports.
  */
 void *kmalloc(size_t size);
 void kfree(void *ptr);
+void kheap_bootstrap(void);
 void kheap_printstats(void);
 void kheap_nextgeneration(void);
 void kheap_dump(void);
@@ -160,9 +163,15 @@ const char *strerror(int errcode);
 
 /*
  * Low-level console access.
+ *
+ * console_poll is poll() for putch and getch: if it reports POLLIN,
+ * getch has a character waiting. putch never waits for long, so it
+ * always reports POLLOUT.
  */
+struct pollwait;
 void putch(int ch);
 int getch(void);
+int console_poll(int events, struct pollwait *pw);
 void beep(void);
 
 /*
@@ -0,0 +1,79 @@
+#ifndef _LOCKSTAT_H_
+#define _LOCKSTAT_H_
+
+/*
+ * Lock contention statistics.
+ *
+ * With the lockstat option, spinlocks, locks, semaphores (P) and
+ * condition variables (cv_wait) report every acquisition here. For
+ * each lock we keep the number of acquisitions, how many of them had
+ * to wait, the total and worst wait, and (for spinlocks and locks,
+ * which have an owner) the total and worst hold time.
+ *
+ * Locks, semaphores and CVs are keyed by name, so e.g. all the
+ * "sys_lock" locks add up into one entry. Spinlocks have no name and
+ * are keyed by address instead, in a table of their own: there are
+ * far more of them, and they mustn't crowd the named locks out. Once
+ * the spinlock table is full, further spinlocks all add up into one
+ * catch-all entry instead of being lost.
+ *
+ * Each cpu records into its own table (hung off struct cpu), with
+ * interrupts off and no locking, so recording can't itself contend
+ * or recurse into a spinlock. The tables are merged for printing.
+ *
+ * Without the option all of this compiles away.
+ */
+
+#include "opt-lockstat.h"
+
+#if OPT_LOCKSTAT
+
+/* Kinds of lock */
+#define LOCKSTAT_SPINLOCK	0
+#define LOCKSTAT_LOCK		1
+#define LOCKSTAT_SEM		2
+#define LOCKSTAT_CV		3
+
+#define LOCKSTAT_NENTRIES	128	/* Per cpu; should be a power of 2 */
+#define LOCKSTAT_NSPIN		128	/* Same, for spinlocks */
+#define LOCKSTAT_NAMELEN	16
+
+struct lockstat_entry {
+	const void *le_addr;		/* Spinlock address, or NULL */
+	char le_name[LOCKSTAT_NAMELEN];	/* Name (truncated) otherwise */
+	unsigned le_kind;		/* LOCKSTAT_* */
+	bool le_used;			/* Slot is in use */
+	unsigned le_acquires;		/* Number of acquisitions */
+	unsigned le_contended;		/* ...that had to wait */
+	uint64_t le_wait_ns;		/* Total time spent waiting */
+	uint64_t le_wait_max_ns;	/* Longest wait */
+	uint64_t le_hold_ns;		/* Total time held */
+	uint64_t le_hold_max_ns;	/* Longest hold */
+};
+
+struct lockstat_table {
+	struct lockstat_entry lt_entries[LOCKSTAT_NENTRIES]; /* By name */
+	struct lockstat_entry lt_spin[LOCKSTAT_NSPIN];	/* By address */
+	struct lockstat_entry lt_spinother;	/* Spinlocks that didn't fit */
+	unsigned lt_dropped;		/* Events lost to a full table */
+};
+
+/* Set up the current cpu's table. */
+struct lockstat_table *lockstat_table_create(void);
+
+/*
+ * Record an acquisition that waited WAIT_NS nanoseconds, and a
+ * release after holding for HOLD_NS. NAME is used for all kinds but
+ * spinlocks, ADDR only for spinlocks.
+ */
+void lockstat_acquired(unsigned kind, const char *name, const void *addr,
+		       uint64_t wait_ns, bool contended);
+void lockstat_released(unsigned kind, const char *name, const void *addr,
+		       uint64_t hold_ns);
+
+/* Print the worst MAX locks by total wait time, then clear the tables. */
+void lockstat_dump(unsigned max);
+
+#endif /* OPT_LOCKSTAT */
+
+#endif /* _LOCKSTAT_H_ */
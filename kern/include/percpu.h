@@ -0,0 +1,79 @@
+#ifndef _PERCPU_H_
+#define _PERCPU_H_
+
+/*
+ * Per-cpu counters, for statistics bumped on hot paths.
+ *
+ * Each cpu has an array of counter slots (c_counters in struct cpu);
+ * a percpu_counter is just an index into it. Bumping a counter only
+ * touches the current cpu's array, with a plain increment: no atomic
+ * operation, no spl change, and no shared cache line, since each
+ * cpu's array is a separate size-aligned kmalloc block. Reading a
+ * counter adds up the slots of all cpus.
+ *
+ * The price is that an increment is a load and a store, so it can be
+ * lost if an interrupt handler on the same cpu bumps the same counter
+ * in between, or if the thread migrates in between. That's fine for
+ * statistics; anything that has to be exact should be bumped with
+ * interrupts off, as hardclock does.
+ *
+ * Slot 0 is never handed out. A zeroed (not yet initialized)
+ * percpu_counter points there, so it's harmless to bump counters that
+ * are used before their subsystem gets around to initializing them.
+ *
+ *    percpu_counter_init     - assign a slot. Returns ENOSPC if there
+ *                              are none left.
+ *    percpu_counter_destroy  - give the slot back.
+ *    percpu_counter_add      - add N on the current cpu.
+ *    percpu_counter_inc      - add 1 on the current cpu.
+ *    percpu_counter_read_cpu - one cpu's count.
+ *    percpu_counter_read     - the total over all cpus.
+ *
+ * Counters are unsigned and wrap like any other unsigned counter.
+ */
+
+#include <cpu.h>
+#include <current.h>
+
+/* Inlining support - for making sure an out-of-line copy gets built */
+#ifndef PERCPU_INLINE
+#define PERCPU_INLINE INLINE
+#endif
+
+/* Number of counter slots per cpu. The array should be a power of 2 bytes. */
+#define PERCPU_COUNTER_SLOTS	64
+
+struct percpu_counter {
+	unsigned pc_slot;
+};
+
+int percpu_counter_init(struct percpu_counter *pc);
+void percpu_counter_destroy(struct percpu_counter *pc);
+unsigned percpu_counter_read_cpu(const struct percpu_counter *pc,
+				 const struct cpu *c);
+unsigned percpu_counter_read(const struct percpu_counter *pc);
+
+/* Called by cpu_create. */
+unsigned *percpu_counters_create(void);
+
+PERCPU_INLINE void percpu_counter_add(struct percpu_counter *pc, unsigned n);
+PERCPU_INLINE void percpu_counter_inc(struct percpu_counter *pc);
+
+PERCPU_INLINE
+void
+percpu_counter_add(struct percpu_counter *pc, unsigned n)
+{
+	/* Before the first cpu is set up there's nowhere to count. */
+	if (CURCPU_EXISTS()) {
+		curcpu->c_counters[pc->pc_slot] += n;
+	}
+}
+
+PERCPU_INLINE
+void
+percpu_counter_inc(struct percpu_counter *pc)
+{
+	percpu_counter_add(pc, 1);
+}
+
+#endif /* _PERCPU_H_ */
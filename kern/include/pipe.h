@@ -0,0 +1,25 @@
+#ifndef _PIPE_H_
+#define _PIPE_H_
+
+/*
+ * Anonymous pipes.
+ *
+ * A pipe is a pair of vnodes, a read end and a write end, over a
+ * PIPE_SIZE ring buffer. They aren't in any filesystem; sys_pipe puts
+ * them straight into the descriptor table.
+ */
+
+#include <vm.h>
+
+struct vnode;
+
+#define PIPE_SIZE	PAGE_SIZE	/* Bytes a pipe holds */
+
+/*
+ * Make a pipe. Each end comes with one reference, dropped with
+ * vfs_close as usual. Once the write end is gone reads return EOF;
+ * once the read end is gone writes fail with EPIPE.
+ */
+int pipe_create(struct vnode **ret_rvn, struct vnode **ret_wvn);
+
+#endif /* _PIPE_H_ */
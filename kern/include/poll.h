@@ -0,0 +1,87 @@
+#ifndef _POLL_H_
+#define _POLL_H_
+
+/*
+ * Readiness notification, for poll() and select().
+ *
+ * Anything that can become readable or writable (a pipe end, the
+ * console, a semaphore) has a struct pollq. Its vop_poll registers
+ * the caller's struct pollwait on that pollq and then reports what
+ * is ready right now; whenever the state changes, the object calls
+ * pollq_wakeup, which wakes every pollwait registered on it. The
+ * poller then checks all its objects again.
+ *
+ * Registering before looking at the state, and waking after changing
+ * it, means a change can't fall in between: pollq_register and
+ * pollq_wakeup both have a barrier for this, so the object doesn't
+ * need to hold a lock across the check. The upshot is that
+ * pollq_wakeup costs a load and a barrier when nobody is polling,
+ * and is safe to call from interrupt handlers.
+ *
+ *    pollq_init       - Set up a pollq.
+ *    pollq_cleanup    - Tear it down. Nobody may be registered.
+ *    pollq_register   - Have pollq_wakeup on PQ wake PW. Does nothing
+ *                       if PW is NULL, which vop_poll gets when the
+ *                       caller only wants to look.
+ *    pollq_wakeup     - Wake everybody registered on PQ.
+ *
+ *    pollwait_init    - Set up a pollwait with room for NENTS
+ *                       registrations, in ENTS.
+ *    pollwait_settimeout - Time out after TICKS hardclocks.
+ *    pollwait_prepare - Forget earlier wakeups. Call before each
+ *                       round of checking.
+ *    pollwait_sleep   - Sleep until woken, unless already woken since
+ *                       pollwait_prepare. Returns 0, or ETIMEDOUT or
+ *                       EINTR if that's what woke us.
+ *    pollwait_interrupt - Wake PW's owner with EINTR, for good.
+ *    pollwait_cleanup - Undo all registrations and the timeout.
+ *
+ * The pollwait belongs to the poller, normally on its stack. A pollq
+ * must outlive the registrations on it, which vop_poll callers ensure
+ * by holding a reference to the vnode until pollwait_cleanup.
+ */
+
+#include <spinlock.h>
+
+struct wchan;
+struct polltimer;
+struct pollwait;
+
+struct pollent {
+	struct pollq *pe_q;		/* Where we're registered */
+	struct pollwait *pe_pw;		/* Who to wake */
+	struct pollent *pe_next;	/* Links on pe_q, under pq_lock */
+	struct pollent **pe_prevp;
+};
+
+struct pollq {
+	struct spinlock pq_lock;
+	struct pollent *volatile pq_list;
+};
+
+struct pollwait {
+	struct spinlock pw_lock;	/* Protects the flags */
+	struct wchan *pw_wchan;		/* The poller sleeps here */
+	bool pw_woken;			/* An object changed */
+	bool pw_timedout;		/* The timeout expired */
+	bool pw_interrupted;		/* pollwait_interrupt was called */
+	struct pollent *pw_ents;	/* Registrations */
+	unsigned pw_nents;		/* How many of pw_ents are in use */
+	unsigned pw_maxents;		/* How many there are */
+	struct polltimer *pw_timer;	/* Timeout, or NULL */
+	struct pollwait *pw_next;	/* For the owner's use */
+};
+
+void pollq_init(struct pollq *pq);
+void pollq_cleanup(struct pollq *pq);
+void pollq_register(struct pollq *pq, struct pollwait *pw);
+void pollq_wakeup(struct pollq *pq);
+
+int pollwait_init(struct pollwait *pw, struct pollent *ents, unsigned nents);
+int pollwait_settimeout(struct pollwait *pw, unsigned ticks);
+void pollwait_prepare(struct pollwait *pw);
+int pollwait_sleep(struct pollwait *pw);
+void pollwait_interrupt(struct pollwait *pw);
+void pollwait_cleanup(struct pollwait *pw);
+
+#endif /* _POLL_H_ */
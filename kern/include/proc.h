@@ -4,46 +4,104 @@
 
 #include <spinlock.h>
 #include <types.h>
+#include <rcu.h>
 #include "limits.h"
 #include "opt-shell.h"
-#define SYSTEM_OPEN_MAX 10 * OPEN_MAX
 
 struct addrspace;
+struct ipc_endpoint;
+struct pollwait;
 struct thread;
 struct vnode;
 
 
 
+/*
+ * An open file. Each open makes a new one; dup2 and fork share it, and
+ * of_refcount counts the descriptors pointing at it plus the system
+ * calls using it right now (see fd_get). The count is changed with
+ * atomic adds (openfile_ref/openfile_release), not under p_lock, which
+ * only serializes I/O on the file. The openfile holds the reference
+ * to the vnode, and the last release closes it. Freed openfiles go
+ * back to a pool and keep their p_lock, so opening a file normally
+ * neither allocates nor takes any global lock.
+ */
 struct openfile{
-    struct vnode *vn;    //vnode of the file
-    int of_pointercount; //used to count how many entries are linked to this openfile.
-    struct lock *p_lock; //lock used to realize mutex
+    struct vnode *vn;    //vnode of the file, referenced
+    volatile spinlock_data_t of_refcount; //descriptors and callers using this openfile
+    struct lock *p_lock; //serializes reads and writes (and the offset)
+    struct openfile *of_next; //free list link while in the pool
 };
 
+/*
+ * A user-level thread. A process only has these once it has more than
+ * one thread; the first call to thread_create gives the initial thread
+ * one too. The record outlives its thread until someone joins it.
+ */
+struct uthread{
+    int ut_tid;     //thread id, unique within the process
+    int ut_slot;    //user stack slot from as_define_thread_stack, -1 for the initial stack
+    int ut_exited;  //1 once the thread has called thread_exit
+    int ut_joined;  //1 once someone is waiting for it in thread_join
+    int ut_retval;  //value passed to thread_exit
+    struct uthread *ut_next;
+};
+
+/*
+ * A descriptor table entry. Entries go with their openfile and are
+ * freed with it, after an RCU grace period so that fd_get can look at
+ * them without a lock. The console entry (of_ref == NULL) is a single
+ * static one that every console descriptor points at.
+ */
 struct process_table{
     int offset; //in which point of the file do you wanna start
     int flag;
     struct openfile *of_ref; //pointer to the openfile struct
+    struct rcu_head pt_rcu;  //frees the entry and its openfile
 };
 
+#define FD_INITIAL 32    //descriptor table slots to start with; a multiple of 32
+#define FD_LIMIT   16384 //most descriptors a process can have open
+
 struct proc{
     char *p_name;           /* Name of this process */
     struct spinlock p_lock; /* Lock for this structure */
     unsigned p_numthreads;  /* Number of threads in this process */
     
-    struct process_table *process_file_table[OPEN_MAX];
+    /*
+     * Descriptor table. It starts with FD_INITIAL slots and doubles
+     * as needed, up to FD_LIMIT. fd_map has a bit per slot in use, so
+     * the lowest free fd is found a word at a time. Changes happen
+     * under fd_lock; lookups (fd_get) don't lock, so when the table
+     * grows the old slot array is freed with call_rcu.
+     */
+    struct process_table **process_file_table; //fd_size slots
+    uint32_t *fd_map;     //slots in use
+    volatile int fd_size; //number of slots
+    int fd_lowfree;       //no free slot below this one
+    int cnt_open;         //the number of entries of the process_file_table used
+    struct lock *fd_lock; //serializes changes to the table
+
     int status; //exit status of the process
-    int last_fd;  //to keep trace of the last index of the process_file_table used of freed
-    int cnt_open; //the number of entries of the process_file_table used
 
     
     struct cv *cv;
     struct lock *lock;
     int exited; //is a flag, is 1 if the process has already exited
+
+    struct uthread *p_uthreads; //user threads, protected by lock
+    int p_nexttid;              //next thread id to hand out
+    volatile int p_exiting;     //set by _exit: all the threads must go
+    int p_vfork;                //1 while a vfork child runs in its parent's address space, protected by lock
+
+    struct ipc_endpoint *p_ipc; //where other processes send us messages
+    struct pollwait *p_polls;   //threads in poll/select, for poll_exit; protected by p_lock
    
     pid_t pid;
     pid_t p_pid; //parent
 
+    struct rcu_head p_rcu; //frees the proc once get_proc callers are done with it
+
 
     /* VM */
     struct addrspace *p_addrspace; /* virtual address space */
@@ -77,13 +135,53 @@ struct addrspace *proc_getas(void);
 /* Change the address space of the current process, and return the old one. */
 struct addrspace *proc_setas(struct addrspace *);
 #if OPT_SHELL
+/*
+ * A pid is a process table slot (below PID_MAX) in the low bits, and
+ * the slot's generation above that. Slot 1 generation 0 is the
+ * kernel, so pid 1 is the kernel as usual, and the first processes
+ * get the pids they always did.
+ */
+#define PID_SLOTBITS	15
+#define PID_NGENS	256
+#define PID_SLOT(pid)	((unsigned)(pid) & ((1U << PID_SLOTBITS) - 1))
+#define PID_GEN(pid)	((unsigned)(pid) >> PID_SLOTBITS)
+#define PID_MAKE(slot, gen) ((pid_t)(((gen) << PID_SLOTBITS) | (slot)))
+
  int proc_wait(struct proc *p);
 void pid_assign(struct proc *p);
 void pid_remove(struct proc *p);
-struct proc *get_proc(pid_t index);
+struct proc *get_proc(pid_t pid);
 int assign_fd(struct proc *proc, struct vnode *vnode, int oflag, int* err);
 int remove_fd(struct proc *p, int index);
+void openfile_ref(struct process_table *pt);
+void openfile_release(struct process_table *pt);
+
+/*
+ * Descriptor table operations.
+ *    fd_get     - the entry for fd, or NULL if it isn't open. Takes a
+ *                 reference, so the file stays open even if another
+ *                 thread closes fd; drop it with openfile_release.
+ *    fd_alloc   - claim the lowest free fd, growing the table if need
+ *                 be, and put pt there. Returns -1 and sets *err
+ *                 (EMFILE or ENOMEM) on failure.
+ *    fd_install - put pt in a given free fd, growing the table to
+ *                 reach it. Same errors, plus EBADF past FD_LIMIT
+ *                 and EBUSY if fd isn't free after all.
+ *    fd_clear   - empty fd and return what was there.
+ *    fd_copy    - give dst (a new process) the same entries as src,
+ *                 sharing the open files. Costs in proportion to the
+ *                 descriptors src has open.
+ *    fd_closeall - close every fd of a process no thread is using.
+ * All but fd_get take fd_lock (fd_copy takes src's).
+ */
+struct process_table *fd_get(struct proc *p, int fd);
+int fd_alloc(struct proc *p, struct process_table *pt, int *err);
+int fd_install(struct proc *p, int fd, struct process_table *pt, int *err);
+struct process_table *fd_clear(struct proc *p, int fd);
+int fd_copy(struct proc *dst, struct proc *src, int *err);
+void fd_closeall(struct proc *p);
 int get_numproc(void);
+struct ipc_endpoint *proc_get_endpoint(pid_t pid);
 #endif
 
 #endif
@@ -0,0 +1,55 @@
+#ifndef _RCU_H_
+#define _RCU_H_
+
+/*
+ * Read-copy-update: deferred freeing for lock-free lookups.
+ *
+ * Readers bracket their use of a shared structure with rcu_read_lock
+ * and rcu_read_unlock and take no locks. Writers unlink an object
+ * under whatever lock they normally use, then hand it to call_rcu
+ * instead of freeing it; the callback runs (in a workqueue thread on
+ * the same cpu) only after every reader that might still be looking
+ * at the object has finished.
+ *
+ * This is quiescent-state based. A read section must not sleep or
+ * yield, and hardclock doesn't preempt a thread that is inside one, so
+ * once every cpu has been through thread_switch (or sat idle) since
+ * the object was unlinked, nobody can be holding a pointer to it. That
+ * span is a grace period. Read sections cost an increment and a
+ * decrement of a per-thread counter and touch no shared memory.
+ *
+ * Writers must publish new objects with membar_store_store between
+ * initializing them and storing the pointer, so a reader never sees a
+ * half-built object.
+ *
+ *    rcu_read_lock     - Enter a read section. They nest.
+ *    rcu_read_unlock   - Leave it.
+ *    call_rcu          - Call FUNC(ARG) after a grace period. RH is
+ *                        caller-owned storage, usually embedded in the
+ *                        object being freed. May be called from
+ *                        interrupt handlers.
+ *
+ * The rest is for the thread system: rcu_quiescent is called by
+ * thread_switch, rcu_tick by hardclock (which also reports the
+ * quiescent state of an idle cpu).
+ */
+
+struct rcu_head {
+	struct rcu_head *rh_next;	/* List link */
+	void (*rh_func)(void *);	/* Function to call */
+	void *rh_arg;			/* Its argument */
+};
+
+/* Per-cpu callback lists; private to rcu.c. */
+struct rcu_cpu;
+
+void rcu_read_lock(void);
+void rcu_read_unlock(void);
+void call_rcu(struct rcu_head *rh, void (*func)(void *), void *arg);
+
+struct rcu_cpu *rcu_cpu_create(void);
+void rcu_quiescent(void);
+void rcu_tick(void);
+
+
+#endif /* _RCU_H_ */
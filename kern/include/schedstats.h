@@ -0,0 +1,47 @@
+#ifndef _SCHEDSTATS_H_
+#define _SCHEDSTATS_H_
+
+/*
+ * Per-cpu scheduler statistics.
+ *
+ * Each cpu keeps a struct schedstats in its struct cpu. The counters
+ * are only updated by the cpu that owns them, except for the
+ * migration-in count, which is updated by the migrating cpu while
+ * holding the target's run queue lock.
+ *
+ * Run queue latency is the time from thread_make_runnable() putting
+ * a thread on a run queue to thread_switch() picking it. It is kept
+ * as a log2 histogram: bucket N counts waits in [2^N, 2^(N+1))
+ * microseconds, with bucket 0 also holding anything under 1us and the
+ * last bucket holding everything longer.
+ */
+
+#include "opt-schedstats.h"
+
+#define SCHEDSTATS_NBUCKETS	24
+
+struct schedstats {
+	unsigned ss_switches;		/* Context switches */
+	unsigned ss_voluntary;		/* ...because the thread blocked/yielded */
+	unsigned ss_involuntary;	/* ...because it was preempted */
+	unsigned ss_migrations_out;	/* Threads migrated away */
+	unsigned ss_migrations_in;	/* Threads migrated here */
+	unsigned ss_ipis_sent;		/* IPIs sent by this cpu */
+	unsigned ss_ipis_received;	/* IPIs handled by this cpu */
+	uint64_t ss_idle_ns;		/* Time spent in cpu_idle() */
+	uint64_t ss_latency_ns;		/* Total run queue latency */
+	uint64_t ss_latency_max_ns;	/* Worst run queue latency */
+	unsigned ss_latency_hist[SCHEDSTATS_NBUCKETS];
+};
+
+#if OPT_SCHEDSTATS
+
+/* Record a run queue wait of NS nanoseconds in STATS. */
+void schedstats_latency(struct schedstats *stats, uint64_t ns);
+
+/* Print the stats of all cpus, then clear them. */
+void schedstats_dump(void);
+
+#endif
+
+#endif /* _SCHEDSTATS_H_ */
@@ -36,6 +36,7 @@
  */
 
 #include <cdefs.h>
+#include "opt-lockstat.h"
 
 /* Inlining support - for making sure an out-of-line copy gets built */
 #ifndef SPINLOCK_INLINE
@@ -48,6 +49,12 @@
 /*
  * Basic spinlock.
  *
+ * This is a ticket lock: a cpu wanting the lock takes the next ticket
+ * from splk_next and spins until splk_serving reaches it. Waiters get
+ * the lock in the order they arrived, so a cpu waits for at most one
+ * critical section per other cpu, and releasing the lock hands it to
+ * exactly one waiter instead of setting them all racing for it.
+ *
  * Note that spinlocks are held by CPUs, not by threads.
  *
  * This structure is made public so spinlocks do not have to be
@@ -55,14 +62,24 @@
  * the structure directly but always use the spinlock API functions.
  */
 struct spinlock {
-	volatile spinlock_data_t splk_lock; /* Memory word where we spin. */
-	struct cpu *splk_holder;	    /* CPU holding this lock. */
+	volatile spinlock_data_t splk_next;	/* Next ticket to hand out. */
+	volatile spinlock_data_t splk_serving;	/* Ticket now holding. */
+	struct cpu *splk_holder;		/* CPU holding this lock. */
+#if OPT_LOCKSTAT
+	uint64_t splk_acqtime;			/* When it was acquired. */
+#endif
 };
 
 /*
  * Initializer for cases where a spinlock needs to be static or global.
  */
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#if OPT_LOCKSTAT
+#define SPINLOCK_INITIALIZER \
+	{ SPINLOCK_DATA_INITIALIZER, SPINLOCK_DATA_INITIALIZER, NULL, 0 }
+#else
+#define SPINLOCK_INITIALIZER \
+	{ SPINLOCK_DATA_INITIALIZER, SPINLOCK_DATA_INITIALIZER, NULL }
+#endif
 
 /*
  * Spinlock functions.
@@ -36,11 +36,14 @@
 
 
 #include <spinlock.h>
+#include <thread.h>
 
+struct cpu;
 
 #include "opt-locks.h"
 #include "opt-cv_impl.h"
 #include "opt-locks_with_spin.h"
+#include "opt-lockstat.h"
 
 /*
  * Dijkstra-style semaphore.
@@ -89,12 +92,30 @@ struct lock {
         // (don't forget to mark things volatile as needed)
 
 #if OPT_LOCKS_WITH_SPIN
-
-	volatile unsigned sem_count;
-	struct thread *current;
+	/*
+	 * Adaptive mutex. A free lock is taken with one test-and-set
+	 * on lk_held. A thread that finds it held spins as long as the
+	 * holder is running on another cpu, and otherwise sleeps on
+	 * sem_wchan.
+	 */
+	volatile spinlock_data_t lk_held;	/* 1 while held */
+	struct thread *volatile current;	/* Holder */
+	struct cpu *volatile lk_cpu;		/* Cpu the holder got it on */
+	volatile unsigned lk_waiters;		/* Number asleep on sem_wchan */
 	struct wchan *sem_wchan;
-	struct spinlock sem_lock;
-	
+	struct spinlock sem_lock;		/* Protects sleeping/waking */
+
+	/*
+	 * Priority inheritance; see synch.c. Sleepers are counted by
+	 * the priority they sleep at, and while there are any the
+	 * lock is on its holder's t_pilocks list.
+	 */
+	unsigned short lk_sleepers[THREAD_NPRI]; /* Sleepers by priority */
+	struct thread *lk_piowner;		/* Whose list we're on */
+	struct lock *lk_pinext;			/* Next on that list */
+#endif
+#if OPT_LOCKSTAT
+	uint64_t lk_acqtime;			/* When it was acquired */
 #endif
 };
 
@@ -117,6 +138,18 @@ void lock_acquire(struct lock *);
 void lock_release(struct lock *);
 bool lock_do_i_hold(struct lock *);
 
+/*
+ * Priority inheritance. A thread that has to sleep for a lock lends
+ * its priority to the holder, and on down the chain if the holder is
+ * itself asleep on a lock, until the holder lets go. (Only with the
+ * locks_with_spin option; otherwise priorities aren't inherited.)
+ *
+ *    lock_pi_setbase - Set thread T's base priority to PRI and
+ *                      recompute its effective priority. Used by
+ *                      thread_set_priority.
+ */
+void lock_pi_setbase(struct thread *t, int pri);
+
 
 /*
  * Condition variable.
@@ -165,5 +198,61 @@ void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers may hold the lock at once, or one writer.
+ * Writers are preferred: once a writer is waiting, new readers wait
+ * behind it, so a steady stream of readers can't starve writers. For
+ * the same reason a reader must not acquire the lock again while it
+ * already holds it for reading.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+struct rwlock {
+	char *rw_name;
+	struct spinlock rw_lock;		/* Protects the following */
+	struct wchan *rw_readwc;		/* Readers wait here */
+	struct wchan *rw_writewc;		/* Writers wait here */
+	struct wchan *rw_upgradewc;		/* The upgrader waits here */
+	unsigned rw_readers;			/* Number of readers holding */
+	unsigned rw_writerswaiting;		/* Number asleep on rw_writewc */
+	struct thread *rw_writer;		/* Writer holding, if any */
+	struct thread *rw_upgrader;		/* Reader upgrading, if any */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read   - Get the lock shared.
+ *    rwlock_release_read   - Drop a shared hold.
+ *    rwlock_acquire_write  - Get the lock exclusive.
+ *    rwlock_release_write  - Drop an exclusive hold.
+ *    rwlock_tryupgrade     - Turn the caller's shared hold into an
+ *                            exclusive one, waiting for the other
+ *                            readers to leave. Only one reader can be
+ *                            upgrading at a time; if another one is,
+ *                            returns false and the caller still holds
+ *                            the lock shared. (It should then release
+ *                            it, acquire it for writing, and recheck
+ *                            whatever it looked at.)
+ *    rwlock_downgrade      - Turn an exclusive hold into a shared one
+ *                            without letting another writer in between.
+ *    rwlock_do_i_hold_write - Return true if the current thread holds
+ *                            the lock exclusive. (Shared holds aren't
+ *                            tracked per thread.)
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_tryupgrade(struct rwlock *);
+void rwlock_downgrade(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
+
+
 #endif /* _SYNCH_H_ */
 
@@ -36,6 +36,8 @@
 
 #include <proc.h>
 struct trapframe; /* from <machine/trapframe.h> */
+struct pollfd;    /* from <kern/poll.h> */
+struct timeval;   /* from <kern/time.h> */
 
 /*
  * The system call dispatcher.
@@ -68,6 +70,12 @@ int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
 #if OPT_SYSCALLS
 int sys_write(int fd, userptr_t buf_ptr, size_t size, int* err);
 int sys_read(int fd, userptr_t buf_ptr, size_t size, int* err);
+int sys_pwrite(int fd, userptr_t buf_ptr, size_t size, off_t pos, int *err);
+int sys_pread(int fd, userptr_t buf_ptr, size_t size, off_t pos, int *err);
+int sys_writev(int fd, userptr_t iov, int iovcnt, int *err);
+int sys_readv(int fd, userptr_t iov, int iovcnt, int *err);
+int sys_pwritev(int fd, userptr_t iov, int iovcnt, off_t pos, int *err);
+int sys_preadv(int fd, userptr_t iov, int iovcnt, off_t pos, int *err);
 void sys__exit(int status);
 int sys_open(char* path, int oflag, int* err);
 int sys_waitpid(pid_t pid,int* status, int options, int* err);
@@ -79,10 +87,41 @@ pid_t sys_getppid(void);
 
 ssize_t sys__getcwd(char *buf, size_t buflen, int* err);
 int sys_dup2(int oldfd, int newfd, int* err);
+int sys_pipe(userptr_t fds_ptr, int *err);
+int sys_poll(userptr_t fds, unsigned nfds, int timeout_ms, int *err);
+int sys_select(int nfds, userptr_t readfds, userptr_t writefds,
+               userptr_t exceptfds, userptr_t timeout, int *err);
+/* The same two on kernel memory, for polltest. */
+int poll_kernel(struct pollfd *fds, unsigned nfds, int timeout_ms, int *err);
+int select_kernel(int nfds, uint32_t *readfds, uint32_t *writefds,
+                  uint32_t *exceptfds, struct timeval *timeout, int *err);
 off_t sys_lseek(int fd, off_t pos, int whence, int *err);
+int sys_ioctl(int fd, int code, userptr_t data, int *err);
 int sys_chdir(const char *pathname, int* err);
 int sys_fork(pid_t* child_pid, struct trapframe* ptf, int* err);
+int sys_vfork(pid_t* child_pid, struct trapframe* ptf, int* err);
 int sys_execv(const char *prog, char **args);
+pid_t sys_spawn(const char *prog, char **args, const int *fds, int nfds, int *err);
+int sys_thread_create(userptr_t entry, userptr_t arg, int *err);
+void sys_thread_exit(int value);
+int sys_thread_join(int tid, userptr_t retval, int *err);
+int sys_ipc_send(pid_t dest, userptr_t umsg, int *err);
+int sys_ipc_call(pid_t dest, userptr_t umsg, int *err);
+pid_t sys_ipc_recv(userptr_t umsg, int *err);
+int sys_ipc_reply(userptr_t umsg, int *err);
+pid_t sys_ipc_replyrecv(userptr_t umsg, int *err);
+int sys_futex_wait(userptr_t uaddr, int val, int *err);
+int sys_futex_wake(userptr_t uaddr, int n, int *err);
+
+/* Set up the futex hash table. */
+void futex_bootstrap(void);
+/* Wake the threads of exiting process P out of futex_wait. */
+void futex_exit(struct proc *p);
+/* Same for poll and select. */
+void poll_exit(struct proc *p);
+
+/* Exit the current thread if its process is exiting. */
+void uthread_exitcheck(void);
 
 
 #endif /* _SYSCALL_H_ */
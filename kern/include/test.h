@@ -54,6 +54,13 @@ int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
 int cvtest2(int, char **);
+int pingpongtest(int, char **);
+int pitest(int, char **);
+int rttest(int, char **);
+int ipctest(int, char **);
+int wqtest(int, char **);
+int pipetest(int, char **);
+int polltest(int, char **);
 
 /* semaphore unit tests */
 int semu1(int, char **);
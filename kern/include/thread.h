@@ -39,8 +39,12 @@
 #include <array.h>
 #include <spinlock.h>
 #include <threadlist.h>
+#include "opt-schedstats.h"
 
 struct cpu;
+struct lock;
+struct uthread;
+struct ipc_thread;
 
 /* get machine-dependent defs */
 #include <machine/thread.h>
@@ -56,6 +60,15 @@ struct cpu;
 #define SAME_STACK(p1, p2)     (((p1) & STACK_MASK) == ((p2) & STACK_MASK))
 
 
+/*
+ * Priorities of ordinary (non-real-time) threads. Bigger is more
+ * important. New threads get their creator's priority.
+ */
+#define THREAD_PRI_MIN		0
+#define THREAD_PRI_DEFAULT	8
+#define THREAD_PRI_MAX		15
+#define THREAD_NPRI		(THREAD_PRI_MAX + 1)
+
 /* States a thread can be in. */
 typedef enum {
 	S_RUN,		/* running */
@@ -83,6 +96,7 @@ struct thread {
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
+	bool t_pinned;			/* Never migrate off t_cpu */
 
 	/*
 	 * Interrupt state fields.
@@ -101,10 +115,50 @@ struct thread {
 	int t_curspl;			/* Current spl*() state */
 	int t_iplhigh_count;		/* # of times IPL has been raised */
 
+#if OPT_SCHEDSTATS
+	uint64_t t_readytime;		/* When we last went on a run queue */
+#endif
+
+	/*
+	 * Real-time scheduling state. All times are in hardclocks of
+	 * t_cpu (real-time threads are pinned). Protected by t_cpu's
+	 * run queue lock.
+	 */
+	bool t_rt;			/* In the real-time class */
+	bool t_rt_throttled;		/* Waiting for the next release */
+	bool t_rt_exhausted;		/* ...for running out of budget */
+	bool t_rt_waspinned;		/* t_pinned before joining the class */
+	unsigned t_rt_period;		/* Period */
+	unsigned t_rt_budget;		/* Run time allowed per period */
+	unsigned t_rt_deadline;		/* Deadline, relative to release */
+	unsigned t_rt_release;		/* Start of the current period */
+	unsigned t_rt_absdeadline;	/* Deadline of the current job */
+	volatile unsigned t_rt_used;	/* Budget used this period */
+	unsigned t_rt_misses;		/* Jobs finished past the deadline */
+	unsigned t_rt_overruns;		/* Times the budget ran out */
+
+	/*
+	 * Priority. t_pri is the priority the thread asked for;
+	 * t_effpri is what the scheduler goes by, which is t_pri
+	 * raised to that of the most important thread asleep on any
+	 * lock this one holds (priority inheritance). The inheritance
+	 * fields are protected by the priority inheritance spinlock in
+	 * synch.c; t_effpri is also read without it by the scheduler.
+	 */
+	int t_pri;			/* Base priority */
+	volatile int t_effpri;		/* Effective priority */
+	struct lock *t_pilocks;		/* Held locks with sleepers */
+	struct lock *t_waitlock;	/* Lock we're asleep on, if any */
+	int t_waitpri;			/* Priority we're counted at there */
+
 	/*
 	 * Public fields
 	 */
 
+	struct uthread *t_uthread;	/* User thread record, if any */
+	struct ipc_thread *t_ipc;	/* IPC state, if any */
+	unsigned t_rcu_nesting;		/* Depth of rcu_read_lock */
+
 	/* add more here as needed */
 };
 
@@ -144,6 +198,14 @@ int thread_fork(const char *name, struct proc *proc,
                 void (*func)(void *, unsigned long),
                 void *data1, unsigned long data2);
 
+/*
+ * Like thread_fork, but the new thread starts on cpu CPU and stays
+ * there; thread_consider_migration leaves it alone.
+ */
+int thread_fork_oncpu(const char *name, struct proc *proc, struct cpu *cpu,
+                      void (*func)(void *, unsigned long),
+                      void *data1, unsigned long data2);
+
 /*
  * Cause the current thread to exit.
  * Interrupts need not be disabled.
@@ -168,5 +230,44 @@ void schedule(void);
  */
 void thread_consider_migration(void);
 
+/*
+ * Priorities.
+ *
+ * The scheduler runs the ready thread with the highest effective
+ * priority, round robin among equals; a running thread is preempted
+ * at the next hardclock if something at least as important is ready.
+ * Real-time threads still come before all of these.
+ *
+ * thread_set_priority sets the current thread's base priority (EINVAL
+ * if out of range). thread_get_priority returns it.
+ */
+int thread_set_priority(int pri);
+int thread_get_priority(void);
+
+/*
+ * Real-time (earliest deadline first) scheduling.
+ *
+ * thread_set_realtime moves the current thread into the real-time
+ * class: every PERIOD hardclocks it is released with a BUDGET of run
+ * time that must be used up within DEADLINE hardclocks of the release
+ * (BUDGET <= DEADLINE <= PERIOD). Runnable real-time threads always
+ * run before ordinary ones, earliest absolute deadline first. A
+ * thread that overruns its budget is throttled at hardclock until its
+ * next release. The thread is pinned to its current cpu; if that
+ * cpu's admitted load plus BUDGET/DEADLINE would exceed 1, the call
+ * fails with EAGAIN and nothing changes.
+ *
+ * thread_rt_waitperiod ends the current job: the thread sleeps until
+ * its next release. thread_clear_realtime returns the thread to the
+ * ordinary class (thread_exit does this automatically).
+ *
+ * thread_rt_tick does the per-hardclock budget accounting and
+ * releases; it is called from hardclock().
+ */
+int thread_set_realtime(unsigned period, unsigned budget, unsigned deadline);
+void thread_clear_realtime(void);
+void thread_rt_waitperiod(void);
+void thread_rt_tick(void);
+
 
 #endif /* _THREAD_H_ */
@@ -138,5 +138,11 @@ int uiomovezeros(size_t len, struct uio *uio);
 void uio_kinit(struct iovec *, struct uio *,
 	       void *kbuf, size_t len, off_t pos, enum uio_rw rw);
 
+/*
+ * Likewise, for I/O from a user buffer in address space AS.
+ */
+void uio_uinit(struct iovec *, struct uio *, struct addrspace *as,
+	       userptr_t ubuf, size_t len, off_t pos, enum uio_rw rw);
+
 
 #endif /* _UIO_H_ */
@@ -33,6 +33,7 @@
 #include <spinlock.h>
 struct uio;
 struct stat;
+struct pollwait;
 
 
 /*
@@ -132,6 +133,13 @@ struct vnode {
  *                      uio. Need not work on objects that are not
  *                      directories.
  *
+ *    vop_poll        - Return which of EVENTS (POLLIN, POLLOUT; see
+ *                      kern/poll.h) would not block right now, plus
+ *                      POLLERR or POLLHUP if they apply. First, if PW
+ *                      isn't NULL, register it with pollq_register so
+ *                      it is woken when that might change. Objects
+ *                      that never block can use vopstub_poll_ready.
+ *
  *****************************************
  *
  *    vop_creat       - Create a regular file named NAME in the passed
@@ -196,6 +204,8 @@ struct vnode_ops {
 	int (*vop_mmap)(struct vnode *file /* add stuff */);
 	int (*vop_truncate)(struct vnode *file, off_t len);
 	int (*vop_namefile)(struct vnode *file, struct uio *uio);
+	int (*vop_poll)(struct vnode *object, int events,
+			struct pollwait *pw);
 
 
 	int (*vop_creat)(struct vnode *dir,
@@ -240,6 +250,7 @@ struct vnode_ops {
 #define VOP_MMAP(vn /*add stuff */)     (__VOP(vn, mmap)(vn /*add stuff */))
 #define VOP_TRUNCATE(vn, pos)           (__VOP(vn, truncate)(vn, pos))
 #define VOP_NAMEFILE(vn, uio)           (__VOP(vn, namefile)(vn, uio))
+#define VOP_POLL(vn, events, pw)        (__VOP(vn, poll)(vn, events, pw))
 
 #define VOP_CREAT(vn,nm,excl,mode,res)  (__VOP(vn, creat)(vn,nm,excl,mode,res))
 #define VOP_SYMLINK(vn, name, content)  (__VOP(vn, symlink)(vn, name, content))
@@ -312,5 +323,11 @@ int vopfail_lookup_notdir(struct vnode *vn, char *path, struct vnode **result);
 int vopfail_lookparent_notdir(struct vnode *vn, char *path,
 			      struct vnode **result, char *buf, size_t len);
 
+/*
+ * vop_poll for objects that are always ready for I/O, like regular
+ * files and directories (see poll.c).
+ */
+int vopstub_poll_ready(struct vnode *vn, int events, struct pollwait *pw);
+
 
 #endif /* _VNODE_H_ */
@@ -36,6 +36,7 @@
 
 
 struct spinlock; /* in spinlock.h */
+struct thread; /* in thread.h */
 struct wchan; /* Opaque */
 
 /*
@@ -70,11 +71,39 @@ void wchan_sleep(struct wchan *wc, struct spinlock *lk);
  * Wake up one thread, or all threads, sleeping on a wait channel.
  * The associated spinlock should be locked.
  *
- * The current implementation is FIFO but this is not promised by the
+ * wchan_wakeone picks the sleeper with the highest effective
+ * priority, FIFO among equals, but this is not promised by the
  * interface.
  */
 void wchan_wakeone(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeall(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Wake up thread T if it is sleeping on WC; returns false if it
+ * isn't (it has been woken already). The spinlock must be locked,
+ * and T must not be able to sleep on anything but WC meanwhile: this
+ * is for callers that keep their own list of who sleeps on WC.
+ */
+bool wchan_wakethread(struct wchan *wc, struct spinlock *lk,
+		      struct thread *t);
+
+/*
+ * Wake up one thread sleeping on WAKEWC and go to sleep on SLEEPWC,
+ * switching directly to the woken thread if possible. Both channels
+ * must be protected by the same spinlock LK, which is unlocked and
+ * relocked as for wchan_sleep.
+ */
+void wchan_sleep_handoff(struct wchan *sleepwc, struct wchan *wakewc,
+			 struct spinlock *lk);
+
+/*
+ * Wake-affine policy. When set (the default), wchan_sleep_handoff
+ * moves a woken thread from another cpu to the waker's, which is
+ * about to go to sleep, instead of waking it where it last ran. This
+ * keeps two threads that take turns on the same cpu and cache, and
+ * saves an IPI per turn. Pinned and real-time threads don't move.
+ */
+extern bool wchan_wake_affine;
+
 
 #endif /* _WCHAN_H_ */
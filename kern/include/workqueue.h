@@ -0,0 +1,63 @@
+#ifndef _WORKQUEUE_H_
+#define _WORKQUEUE_H_
+
+#include <spinlock.h>
+
+/*
+ * Deferred work.
+ *
+ * Each cpu has a workqueue served by a small fixed set of kernel
+ * threads that stay on that cpu. Code that wants something done
+ * later, and in thread context, fills in a struct work and enqueues
+ * it; one of the current cpu's workers will call the function. This
+ * is safe to do from interrupt handlers, and costs a list insert and
+ * (at most) one wakeup instead of a thread_fork.
+ *
+ * Workers take everything that is pending in one go and run the
+ * whole batch before going back to sleep, so a burst of enqueues
+ * from an interrupt handler costs one wakeup.
+ *
+ * A struct work belongs to the caller and must stay allocated until
+ * its function has been called. It can be queued at most once at a
+ * time; enqueueing it again while it is still pending does nothing.
+ * It is no longer pending when its function is called, so the
+ * function may re-queue it. w_pending is claimed with an atomic
+ * test-and-set, so two cpus enqueueing the same item at once can't
+ * both win.
+ *
+ *    work_init         - Set up a work item to call FUNC(ARG).
+ *    workqueue_enqueue - Queue W on the current cpu's workqueue.
+ *                        Returns false if W was already pending.
+ *    workqueue_enqueue_delayed
+ *                      - Same, but don't run W until at least TICKS
+ *                        hardclocks from now.
+ *    workqueue_cancel  - Take W off its queue if it is delayed and
+ *                        hasn't come due. Returns true if it was, in
+ *                        which case its function won't be called and
+ *                        W is no longer pending; false if it is on its
+ *                        way to running (or wasn't queued).
+ *    workqueue_bootstrap - Start the workers. Called once all cpus
+ *                        are up.
+ *    workqueue_tick    - Release delayed work that has come due.
+ *                        Called from hardclock().
+ */
+
+struct work {
+	struct work *w_next;		/* Queue link */
+	void (*w_func)(void *);		/* Function to call */
+	void *w_arg;			/* Its argument */
+	unsigned w_due;			/* hardclock count to run at */
+	struct workqueue *w_wq;		/* Delayed on this queue, or NULL */
+	volatile spinlock_data_t w_pending; /* Nonzero while queued */
+};
+
+void work_init(struct work *w, void (*func)(void *), void *arg);
+bool workqueue_enqueue(struct work *w);
+bool workqueue_enqueue_delayed(struct work *w, unsigned ticks);
+bool workqueue_cancel(struct work *w);
+
+void workqueue_bootstrap(void);
+void workqueue_tick(void);
+
+
+#endif /* _WORKQUEUE_H_ */
@@ -49,6 +49,7 @@
 #include <syscall.h>
 #include <test.h>
 #include <version.h>
+#include <workqueue.h>
 #include "autoconf.h"  // for pseudoconfig
 
 
@@ -109,8 +110,12 @@ boot(void)
 	ram_bootstrap();
 	proc_bootstrap();
 	thread_bootstrap();
+	kheap_bootstrap();
 	hardclock_bootstrap();
 	vfs_bootstrap();
+#if OPT_SYSCALLS
+	futex_bootstrap();
+#endif
 	kheap_nextgeneration();
 
 	/* Probe and initialize devices. Interrupts should come on. */
@@ -127,6 +132,7 @@ boot(void)
 	vm_bootstrap();
 	kprintf_bootstrap();
 	thread_start_cpus();
+	workqueue_bootstrap();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
 	vfs_setbootfs("emu0");
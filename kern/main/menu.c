@@ -42,8 +42,11 @@
 #include <syscall.h>
 #include <current.h>
 #include <test.h>
+#include <schedstats.h>
+#include <lockstat.h>
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-syscalls.h"
 
 /*
  * In-kernel menu and command dispatcher.
@@ -414,6 +417,47 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+#if OPT_SCHEDSTATS
+/*
+ * Print the scheduler statistics and start counting again from zero.
+ */
+static
+int
+cmd_schedstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	schedstats_dump();
+
+	return 0;
+}
+#endif
+
+#if OPT_LOCKSTAT
+/*
+ * Print the most contended locks and start counting again from zero.
+ */
+static
+int
+cmd_lockstat(int nargs, char **args)
+{
+	unsigned max = 20;
+
+	if (nargs > 2) {
+		kprintf("Usage: ls [count]\n");
+		return EINVAL;
+	}
+	if (nargs == 2) {
+		max = atoi(args[1]);
+	}
+
+	lockstat_dump(max);
+
+	return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -488,6 +532,15 @@ static const char *testmenu[] = {
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
 	"[sy4] CV test #2            (1)     ",
+	"[sy5] Wakeup ping-pong test         ",
+	"[sy6] Priority inheritance test     ",
+	"[rt1] Real-time scheduling test     ",
+	"[ipc1] IPC round trip test          ",
+	"[wq1] Workqueue test                ",
+#if OPT_SYSCALLS
+	"[pipe1] Pipe test                   ",
+	"[poll1] Poll test                   ",
+#endif
 	"[semu1-22] Semaphore unit tests     ",
 	"[fs1] Filesystem test               ",
 	"[fs2] FS read stress                ",
@@ -519,6 +572,12 @@ static const char *mainmenu[] = {
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+#if OPT_SCHEDSTATS
+	"[ss] Scheduler stats (and reset)    ",
+#endif
+#if OPT_LOCKSTAT
+	"[ls] Lock stats (and reset)         ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -568,6 +627,12 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+#if OPT_SCHEDSTATS
+	{ "ss",		cmd_schedstats },
+#endif
+#if OPT_LOCKSTAT
+	{ "ls",		cmd_lockstat },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -590,6 +655,17 @@ static struct {
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
 	{ "sy4",	cvtest2 },
+	{ "sy5",	pingpongtest },
+	{ "sy6",	pitest },
+
+	/* scheduler tests */
+	{ "rt1",	rttest },
+	{ "ipc1",	ipctest },
+	{ "wq1",	wqtest },
+#if OPT_SYSCALLS
+	{ "pipe1",	pipetest },
+	{ "poll1",	polltest },
+#endif
 
 	/* semaphore unit tests */
 	{ "semu1",	semu1 },
@@ -7,7 +7,13 @@
 #include <vnode.h>
 #include <limits.h>
 #include <synch.h>
+#include <ipc.h>
+#include <rcu.h>
+#include <membar.h>
+#include <cpu.h>
+#include <platform/maxcpus.h>
 #include <kern/errno.h>
+#include <kern/fcntl.h>
 
 
 /*
@@ -19,14 +25,32 @@ struct proc *kproc;
 
 #if OPT_SHELL
 
-struct openfile system_file_table[SYSTEM_OPEN_MAX]; // openfile struct table shared between all processes
-int sys_count = 0; //counter for entries in the system file table
-struct lock *system_file_lock = NULL; //lock used to mutex exclusion system_file_table
-
-struct proc *proc_table[PID_MAX]; //Process table where pid is index
-static volatile unsigned int last_pid = 1; 
+/*
+ * Process table. A pid is a slot in proc_table plus the generation
+ * of that slot (see PID_SLOT/PID_GEN); the generation is bumped each
+ * time the slot is freed, so a stale pid never finds the process that
+ * took its slot over.
+ *
+ * Free slots are found in pid_map, one bit per slot (set = taken),
+ * searched a word at a time from a cursor that only moves forward.
+ * Freed pids therefore aren't handed out again until the cursor has
+ * gone all the way round. pid_fullmap has a bit per pid_map word
+ * that is set when the word is full, so even with the table nearly
+ * full a search looks at a few dozen words at most.
+ */
+#define PID_WORDS	DIVROUNDUP(PID_MAX, 32)
+#define PID_FULLWORDS	DIVROUNDUP(PID_WORDS, 32)
+
+struct proc *proc_table[PID_MAX]; //Process table where PID_SLOT(pid) is index
+static uint8_t pid_gen[PID_MAX]; //current generation of each slot
+static uint32_t pid_map[PID_WORDS]; //slots in use
+static uint32_t pid_fullmap[PID_FULLWORDS]; //pid_map words that are full
+static unsigned int pid_cursor = PID_MIN; //where the next search starts
 static volatile unsigned int nproc = 0;
-struct lock *pid_lock;
+struct lock *pid_lock; //serializes changes to proc_table; lookups use RCU instead
+
+static int fd_init(struct proc *proc);
+static void fd_cleanup(struct proc *proc);
 
 #endif
 
@@ -52,8 +76,18 @@ static struct proc* proc_create(const char *name){
     /* VFS fields */
     proc->p_cwd = NULL;
 
-    proc->last_fd = 3; //First 3 are STDIN,STDOUT and STDERR
+    proc->process_file_table = NULL;
+    proc->fd_map = NULL;
+    proc->fd_size = 0;
+    proc->fd_lowfree = 0;
     proc->cnt_open = 0;
+    proc->fd_lock = NULL;
+
+    proc->p_uthreads = NULL;
+    proc->p_nexttid = 1;
+    proc->p_exiting = 0;
+    proc->p_vfork = 0;
+    proc->p_polls = NULL;
 
     proc->cv = cv_create("proc_cv");
     if (proc->cv == NULL){
@@ -67,26 +101,29 @@ static struct proc* proc_create(const char *name){
         return NULL;
     }
 
-    pid_assign(proc);
-
-    if (proc->pid < 0){
+    proc->p_ipc = ipc_endpoint_create();
+    if (proc->p_ipc == NULL){
         kfree(proc);
         return NULL;
     }
+
 #if OPT_SHELL
-    if (system_file_lock == NULL){
-        system_file_lock = lock_create("system_lock");
-    }
-	proc->exited = 0;
-	proc->p_pid = -1;
-    bzero(proc->process_file_table, OPEN_MAX * (sizeof(struct process_table *)));
-    for (int i = 0; i < 3; i++){ 
-        //Here, we set the process_file_table for STDIN,STDOUT and STDERR
-        proc->process_file_table[i] = kmalloc(sizeof(struct process_table));
-        proc->process_file_table[i]->of_ref = NULL; // pointer to the struct openfile *of_ref
-        proc->process_file_table[i]->offset = 0;
+    if (fd_init(proc)){
+        kfree(proc);
+        return NULL;
     }
+
+    //lock-free lookups can see the proc as soon as pid_assign publishes it
+    proc->exited = 0;
+    proc->p_pid = -1;
 #endif
+
+    pid_assign(proc);
+
+    if (proc->pid < 0){
+        kfree(proc);
+        return NULL;
+    }
     return proc;
 }
 
@@ -107,71 +144,207 @@ int proc_wait(struct proc *p){
 	return status;	
 }
 
+//index of the lowest set bit of w, which must not be 0
+static unsigned map_ffs(uint32_t w){
+	unsigned bit = 0;
+
+	if((w & 0xffff) == 0){ bit += 16; w >>= 16; }
+	if((w & 0xff) == 0){ bit += 8; w >>= 8; }
+	if((w & 0xf) == 0){ bit += 4; w >>= 4; }
+	if((w & 0x3) == 0){ bit += 2; w >>= 2; }
+	if((w & 0x1) == 0){ bit += 1; }
+	return bit;
+}
+
+//first clear bit of w at or above bit from, or -1
+static int map_firstzero(uint32_t w, unsigned from){
+	if(from >= 32){
+		return -1;
+	}
+	w |= (((uint32_t)1) << from) - 1; //ignore the bits below from
+	if(w == 0xffffffff){
+		return -1;
+	}
+	return map_ffs(~w);
+}
+
+static void pid_mark(unsigned slot){
+	unsigned w = slot / 32;
+
+	KASSERT((pid_map[w] & (((uint32_t)1) << (slot % 32))) == 0);
+	pid_map[w] |= ((uint32_t)1) << (slot % 32);
+	if(pid_map[w] == 0xffffffff){
+		pid_fullmap[w / 32] |= ((uint32_t)1) << (w % 32);
+	}
+}
+
+static void pid_unmark(unsigned slot){
+	unsigned w = slot / 32;
+
+	KASSERT((pid_map[w] & (((uint32_t)1) << (slot % 32))) != 0);
+	pid_map[w] &= ~(((uint32_t)1) << (slot % 32));
+	pid_fullmap[w / 32] &= ~(((uint32_t)1) << (w % 32));
+}
+
+//first free slot at or after from, wrapping around; -1 if the table is full
+static int pid_findfree(unsigned from){
+	unsigned i, w, fw, start;
+	int bit;
+
+	w = from / 32;
+	bit = map_firstzero(pid_map[w], from % 32);
+	if(bit >= 0){
+		return w * 32 + bit;
+	}
+
+	//find the next word that isn't full; the extra round covers
+	//the part of the first pid_fullmap word before where we started
+	start = w + 1;
+	for(i = 0; i <= PID_FULLWORDS; i++){
+		fw = (start / 32 + i) % PID_FULLWORDS;
+		bit = map_firstzero(pid_fullmap[fw], i == 0 ? start % 32 : 0);
+		if(bit >= 0){
+			w = fw * 32 + bit;
+			bit = map_firstzero(pid_map[w], 0);
+			KASSERT(bit >= 0);
+			return w * 32 + bit;
+		}
+	}
+	return -1;
+}
+
+//slots that can never be handed out: 0, the kernel's, and those past PID_MAX
+static void pid_bootstrap(void){
+	unsigned slot;
+
+	COMPILE_ASSERT(PID_MAX <= (1 << PID_SLOTBITS));
+	COMPILE_ASSERT(PID_NGENS <= (1 << (31 - PID_SLOTBITS)));
+
+	bzero(pid_map, sizeof(pid_map));
+	bzero(pid_fullmap, sizeof(pid_fullmap));
+	for(slot = 0; slot < PID_MIN; slot++){
+		pid_mark(slot);
+	}
+	for(slot = PID_MAX; slot < PID_WORDS * 32; slot++){
+		pid_mark(slot);
+	}
+	for(slot = PID_WORDS; slot < PID_FULLWORDS * 32; slot++){
+		pid_fullmap[slot / 32] |= ((uint32_t)1) << (slot % 32);
+	}
+}
+
 void pid_assign(struct proc *p){
 	
-	int i = 0;
+	int slot;
 	KASSERT(nproc<=PID_MAX);
 
     //checking if the pid is assigned to the kernel or not
 	if(kproc==NULL){
 		pid_lock = lock_create("pid_lock");
+		pid_bootstrap();
     	p->pid=1;
 		proc_table[1] = kproc;
-		last_pid=2;
 		nproc++;
 		return;
 	}
 
 	lock_acquire(pid_lock);
 
-    do {
-	    if(proc_table[last_pid] == NULL){ //proc[last_pid ] is available?
-			p->pid = (pid_t) last_pid;
-			proc_table[last_pid] = p;//assign pid to p and insert p in table 
-			last_pid++; //update last_pid
-			if(last_pid > PID_MAX) //last_pid must not exceed the maximum pid possible 
-				last_pid = 2; //reset value
-
-			nproc++;	//new p in table
-			lock_release(pid_lock);
-			return;
-		} 
-        else { //proc[last_pid ] is not available
-            last_pid++;
-		    i++;
-			if(last_pid >= PID_MAX)
-				last_pid = 2;
-		}
-	} while( i < PID_MAX);
+	slot = pid_findfree(pid_cursor);
+	if(slot < 0){
+		lock_release(pid_lock);
+		p->pid = -1;
+		return;
+	}
+	KASSERT(slot >= PID_MIN && slot < PID_MAX);
+	KASSERT(proc_table[slot] == NULL);
+
+	pid_mark(slot);
+	pid_cursor = slot + 1;
+	if(pid_cursor >= PID_MAX){
+		pid_cursor = PID_MIN;
+	}
 
+	p->pid = PID_MAKE(slot, pid_gen[slot]);
+	membar_store_store(); //readers must see p filled in before they can find it
+	proc_table[slot] = p;
+	nproc++;
 
 	lock_release(pid_lock);
-	p->pid = -1;
-	return;
 }
 
 void pid_remove(struct proc *p){
 
+	unsigned int slot = PID_SLOT(p->pid);
+
 	lock_acquire(pid_lock);
-	unsigned int index = (int)p->pid;
+	KASSERT(proc_table[slot] == p);
 	nproc--;
-	proc_table[index]=NULL; // proc_table [index] become available 
-	last_pid = index;
+	proc_table[slot] = NULL;
+	pid_gen[slot] = (pid_gen[slot] + 1) % PID_NGENS; //retire this pid
+	pid_unmark(slot);
   	lock_release(pid_lock);
 }
 
-struct proc *get_proc(pid_t index){
+/*
+ * Look up a process without locking. Must be called inside
+ * rcu_read_lock(); the proc stays allocated until the matching
+ * rcu_read_unlock() (proc_destroy frees it with call_rcu), but it may
+ * already be on its way out, so only look at fields that are set
+ * before pid_assign publishes it.
+ */
+struct proc *get_proc(pid_t pid){
 	
-	unsigned int i = (int)index;
+	struct proc *p;
+
+	KASSERT(curthread->t_rcu_nesting > 0);
+
+	if(pid <= 0 || PID_SLOT(pid) >= PID_MAX){
+		return NULL;
+	}
 
-	if(index < 0 || index >= PID_MAX){
+	//a pid from an earlier generation of the slot doesn't match
+	p = proc_table[PID_SLOT(pid)];
+	if(p == NULL || p->pid != pid){
 		return NULL;
 	}
+	return p;
+
+}
+
+/*
+ * Find the IPC endpoint of process PID and take a reference to it.
+ * The RCU read section keeps the process from being freed meanwhile;
+ * after that the reference keeps the endpoint around.
+ */
+struct ipc_endpoint *proc_get_endpoint(pid_t pid){
+
+	struct proc *p;
+	struct ipc_endpoint *ep = NULL;
 
-	return proc_table[i];
+	rcu_read_lock();
+	p = get_proc(pid);
+	if(p != NULL && p != kproc){
+		ep = p->p_ipc;
+		ipc_endpoint_ref(ep);
+	}
+	rcu_read_unlock();
 
+	return ep;
 }
 #endif
+
+/*
+ * Second half of proc_destroy, once no lookup can still be using the
+ * proc.
+ */
+static void proc_free(void *data){
+    struct proc *proc = data;
+
+    ipc_endpoint_release(proc->p_ipc);
+    kfree(proc);
+}
+
 /*
  * Destroy a proc structure.
  *
@@ -253,14 +426,31 @@ void proc_destroy(struct proc *proc){
     }
 
     KASSERT(proc->p_numthreads == 0);
+
+    //records of threads nobody joined
+    while (proc->p_uthreads != NULL){
+        struct uthread *ut = proc->p_uthreads;
+        proc->p_uthreads = ut->ut_next;
+        kfree(ut);
+    }
+
     pid_remove(proc);
+#if OPT_SHELL
+    fd_cleanup(proc);
+#endif
+
+    //nobody can look the endpoint up any more, close it
+    ipc_endpoint_close(proc->p_ipc);
+
     spinlock_cleanup(&proc->p_lock);
 
     cv_destroy(proc->cv);
     lock_destroy(proc->lock);
 
     kfree(proc->p_name);
-    kfree(proc);
+
+    //get_proc callers may still be looking at the proc itself
+    call_rcu(&proc->p_rcu, proc_free, proc);
 }
 
 /*
@@ -400,91 +590,453 @@ struct addrspace* proc_setas(struct addrspace *newas){
 
 #if OPT_SHELL
 
-int assign_fd(struct proc *proc, struct vnode *vnode, int oflag, int *err){
+/*
+ * Openfile pool. Freed openfiles are kept, with their p_lock, on a
+ * short free list per cpu and, past OF_CACHE_MAX there, on a shared
+ * one. The per-cpu lists are only touched with interrupts off, which
+ * keeps us on the cpu, so they need no lock; the shared list is only
+ * used when a cpu's list runs dry or overflows. The pool grows as
+ * needed and never shrinks, so it holds as many openfiles as were
+ * ever open at once.
+ */
+#define OF_CACHE_MAX 16 //openfiles kept per cpu
+
+struct of_cache {
+    struct openfile *oc_free;
+    unsigned oc_count;
+};
+
+static struct of_cache of_caches[MAXCPUS];
+static struct openfile *of_pool = NULL; //shared free list
+static struct spinlock of_pool_lock = SPINLOCK_INITIALIZER;
 
- //the variable sys_id is the first free position into the sys table
+static struct openfile *openfile_alloc(void){
+    struct of_cache *oc;
+    struct openfile *of;
+    int spl;
+
+    spl = splhigh();
+    oc = &of_caches[curcpu->c_number];
+    of = oc->oc_free;
+    if (of != NULL){
+        oc->oc_free = of->of_next;
+        oc->oc_count--;
+    }
+    splx(spl);
 
-    int index=-1, sys_id = SYSTEM_OPEN_MAX;
+    if (of == NULL){
+        spinlock_acquire(&of_pool_lock);
+        of = of_pool;
+        if (of != NULL)
+            of_pool = of->of_next;
+        spinlock_release(&of_pool_lock);
+    }
+
+    if (of == NULL){
+        of = kmalloc(sizeof(struct openfile));
+        if (of == NULL)
+            return NULL;
+        of->p_lock = lock_create("sys_lock");
+        if (of->p_lock == NULL){
+            kfree(of);
+            return NULL;
+        }
+    }
+    of->of_next = NULL;
+    return of;
+}
+
+static void openfile_free(struct openfile *of){
+    struct of_cache *oc;
+    int spl;
+
+    of->vn = NULL;
+
+    spl = splhigh();
+    oc = &of_caches[curcpu->c_number];
+    if (oc->oc_count < OF_CACHE_MAX){
+        of->of_next = oc->oc_free;
+        oc->oc_free = of;
+        oc->oc_count++;
+        of = NULL;
+    }
+    splx(spl);
+
+    if (of != NULL){
+        spinlock_acquire(&of_pool_lock);
+        of->of_next = of_pool;
+        of_pool = of;
+        spinlock_release(&of_pool_lock);
+    }
+}
+
+//Second half of the last openfile_release, once fd_get is done with pt.
+static void openfile_free_rcu(void *data){
+    struct process_table *pt = data;
+
+    openfile_free(pt->of_ref);
+    kfree(pt);
+}
+
+//Add a reference to pt's openfile, for a descriptor that will share pt.
+//The console entry has no openfile and needs none.
+void openfile_ref(struct process_table *pt){
+    unsigned old;
+
+    if (pt->of_ref == NULL)
+        return;
+    old = spinlock_data_fetchadd(&pt->of_ref->of_refcount, 1);
+    KASSERT(old > 0);
+    (void)old;
+}
+
+//Drop a reference to pt's openfile; the last one closes the file and frees both.
+void openfile_release(struct process_table *pt){
+    struct openfile *of = pt->of_ref;
+    unsigned old;
+
+    if (of == NULL)
+        return;
+    old = spinlock_data_fetchadd(&of->of_refcount, (unsigned)-1);
+    KASSERT(old > 0);
+    if (old == 1){
+        //make sure nothing we did to the file is seen after the reuse
+        membar_any_any();
+        if (of->vn != NULL)
+            vfs_close(of->vn);
+        call_rcu(&pt->pt_rcu, openfile_free_rcu, pt);
+    }
+}
+
+//Takes over the caller's reference to vnode, unless it fails.
+
+int assign_fd(struct proc *proc, struct vnode *vnode, int oflag, int *err){
+    int index;
     struct process_table *pt;
 
-    if (proc->cnt_open >= OPEN_MAX){
-        *err = EMFILE;
+    pt = kmalloc(sizeof(struct process_table));
+    if (pt == NULL){
+        *err = ENOMEM;
+        return -1;
+    }
+    pt->offset = 0;
+    pt->flag = oflag;
+
+    pt->of_ref = openfile_alloc();
+    if (pt->of_ref == NULL){
+        kfree(pt);
+        *err = ENOMEM;
         return -1;
     }
+    pt->of_ref->vn = vnode;
+    spinlock_data_set(&pt->of_ref->of_refcount, 1);
 
-    if (sys_count >= SYSTEM_OPEN_MAX){
-        *err = ENFILE;
+    index = fd_alloc(proc, pt, err);
+    if (index < 0){
+        pt->of_ref->vn = NULL; //still the caller's
+        openfile_release(pt);
         return -1;
     }
+    return index;
+}
+
+int remove_fd(struct proc *p, int fd){
+    struct process_table *pt;
+
+    pt = fd_clear(p, fd);
+    if (pt == NULL)
+        return EBADF;
+    openfile_release(pt);
+    return 0;
+}
 
-    //Set index to the first free postion int the process_file_table
+/*
+ * Descriptor tables.
+ */
+
+//the old slot array of a table that grew, kept until lookups are done with it
+struct fd_oldfiles {
+    struct rcu_head of_rcu;
+    struct process_table **of_files;
+};
+
+static void fd_oldfiles_free(void *data){
+    struct fd_oldfiles *old = data;
+
+    kfree(old->of_files);
+    kfree(old);
+}
 
-    for (int i = 0; i < OPEN_MAX; i++){
-        if (proc->last_fd >= OPEN_MAX)
-            proc->last_fd = 3;
-        if (proc->process_file_table[proc->last_fd] == NULL){
-            index = proc->last_fd;
-            proc->cnt_open++;
-            proc->last_fd++;
+//The entry of every console descriptor; it is never freed.
+static struct process_table fd_console = {
+    .offset = 0,
+    .flag = O_RDWR,
+    .of_ref = NULL,
+};
+
+//Set up a new process's table, with the console on 0, 1 and 2.
+static int fd_init(struct proc *proc){
+    int i;
+
+    proc->process_file_table = kmalloc(FD_INITIAL * sizeof(struct process_table *));
+    proc->fd_map = kmalloc(FD_INITIAL / 32 * sizeof(uint32_t));
+    proc->fd_lock = lock_create("fd_lock");
+    if (proc->process_file_table == NULL || proc->fd_map == NULL || proc->fd_lock == NULL){
+        fd_cleanup(proc);
+        return ENOMEM;
+    }
+    bzero(proc->process_file_table, FD_INITIAL * sizeof(struct process_table *));
+    bzero(proc->fd_map, FD_INITIAL / 32 * sizeof(uint32_t));
+    proc->fd_size = FD_INITIAL;
+    proc->fd_lowfree = 0;
+    proc->cnt_open = 0;
+
+    for (i = 0; i < 3; i++){ 
+        //Here, we set the process_file_table for STDIN,STDOUT and STDERR
+        proc->process_file_table[i] = &fd_console;
+        proc->fd_map[0] |= ((uint32_t)1) << i;
+        proc->cnt_open++;
+    }
+    proc->fd_lowfree = 3;
+    return 0;
+}
+
+//Close every descriptor of p. For a process that has no threads using
+//the table: one that isn't running yet, or whose last thread is leaving.
+void fd_closeall(struct proc *p){
+    struct process_table *pt;
+    int fd;
+
+    for (fd = 0; fd < p->fd_size; fd++){
+        pt = fd_clear(p, fd);
+        if (pt != NULL)
+            openfile_release(pt);
+    }
+}
+
+//Free the table, dropping the files still in it (a fork that failed
+//after fd_copy leaves its copies here). Nobody else can be using it.
+static void fd_cleanup(struct proc *proc){
+    struct process_table *pt;
+    int fd;
+
+    for (fd = 0; fd < proc->fd_size; fd++){
+        pt = proc->process_file_table[fd];
+        if (pt != NULL){
+            proc->process_file_table[fd] = NULL;
+            openfile_release(pt);
+        }
+    }
+    kfree(proc->process_file_table);
+    kfree(proc->fd_map);
+    if (proc->fd_lock != NULL)
+        lock_destroy(proc->fd_lock);
+    proc->process_file_table = NULL;
+    proc->fd_map = NULL;
+    proc->fd_lock = NULL;
+    proc->fd_size = 0;
+}
+
+//Grow p's table so fd fits. Call with fd_lock held.
+static int fd_grow(struct proc *p, int fd){
+    struct process_table **files;
+    struct fd_oldfiles *old;
+    uint32_t *map;
+    int size;
+
+    KASSERT(lock_do_i_hold(p->fd_lock));
+
+    size = p->fd_size;
+    while (size <= fd)
+        size *= 2;
+    if (size > FD_LIMIT)
+        return EMFILE;
+
+    files = kmalloc(size * sizeof(struct process_table *));
+    map = kmalloc(size / 32 * sizeof(uint32_t));
+    old = kmalloc(sizeof(*old));
+    if (files == NULL || map == NULL || old == NULL){
+        kfree(files);
+        kfree(map);
+        kfree(old);
+        return ENOMEM;
+    }
+    bzero(files, size * sizeof(struct process_table *));
+    bzero(map, size / 32 * sizeof(uint32_t));
+    memcpy(files, p->process_file_table, p->fd_size * sizeof(struct process_table *));
+    memcpy(map, p->fd_map, p->fd_size / 32 * sizeof(uint32_t));
+
+    //fd_get reads fd_size first, so it must not see the bigger size
+    //before the bigger array
+    old->of_files = p->process_file_table;
+    p->process_file_table = files;
+    membar_store_store();
+    p->fd_size = size;
+
+    kfree(p->fd_map); //only used under fd_lock
+    p->fd_map = map;
+    call_rcu(&old->of_rcu, fd_oldfiles_free, old);
+    return 0;
+}
+
+//Mark fd used and publish pt there. Call with fd_lock held.
+static void fd_set(struct proc *p, int fd, struct process_table *pt){
+    KASSERT((p->fd_map[fd / 32] & (((uint32_t)1) << (fd % 32))) == 0);
+    p->fd_map[fd / 32] |= ((uint32_t)1) << (fd % 32);
+    p->cnt_open++;
+    membar_store_store(); //pt is filled in before it can be found
+    p->process_file_table[fd] = pt;
+}
+
+struct process_table *fd_get(struct proc *p, int fd){
+    struct process_table *pt = NULL;
+    int size;
+
+    if (fd < 0)
+        return NULL;
+
+    rcu_read_lock();
+    size = p->fd_size;
+    membar_load_load();
+    if (fd < size)
+        pt = p->process_file_table[fd];
+    //pt can't be freed before rcu_read_unlock, but it may be on its way:
+    //if the last reference is already gone, fd was closed meanwhile
+    if (pt != NULL && pt->of_ref != NULL &&
+        spinlock_data_incnonzero(&pt->of_ref->of_refcount) == 0)
+        pt = NULL;
+    rcu_read_unlock();
+    return pt;
+}
+
+int fd_alloc(struct proc *p, struct process_table *pt, int *err){
+    int w, bit, fd, res;
+
+    lock_acquire(p->fd_lock);
+    fd = -1;
+    for (w = p->fd_lowfree / 32; w < p->fd_size / 32; w++){
+        bit = map_firstzero(p->fd_map[w], 0);
+        if (bit >= 0){
+            fd = w * 32 + bit;
             break;
         }
-        proc->last_fd++;
-    }
-
-    lock_acquire(system_file_lock);
-    for (int i = 0; i < SYSTEM_OPEN_MAX; i++){
-        if (system_file_table[i].vn == vnode){
-            lock_acquire(system_file_table[i].p_lock);
-            system_file_table[i].of_pointercount++;
-            lock_release(system_file_table[i].p_lock);
-            lock_release(system_file_lock);
-            
-            pt = kmalloc(sizeof(struct process_table));
-            pt->of_ref = &system_file_table[i];
-            pt->offset = 0;
-            pt->flag = oflag;
-            proc->process_file_table[index] = pt;
-            return index;
+    }
+    if (fd < 0){
+        //all full: the lowest free one is the first past the end
+        fd = p->fd_size;
+        res = fd_grow(p, fd);
+        if (res){
+            lock_release(p->fd_lock);
+            *err = res;
+            return -1;
         }
-        else if (system_file_table[i].vn == NULL && i < sys_id)
-            sys_id = i;
     }
+    fd_set(p, fd, pt);
+    p->fd_lowfree = fd + 1;
+    lock_release(p->fd_lock);
+    return fd;
+}
 
-    if (sys_id < SYSTEM_OPEN_MAX){ //if the file is new
-        system_file_table[sys_id].vn = vnode;
-        lock_release(system_file_lock);
-        system_file_table[sys_id].of_pointercount = 1;
-        system_file_table[sys_id].p_lock = lock_create("sys_lock");
-        sys_count++;
-        pt = kmalloc(sizeof(struct process_table));
-        pt->of_ref = &system_file_table[sys_id];
-        pt->offset = 0;
-        proc->process_file_table[index] = pt;
-        return index;
+int fd_install(struct proc *p, int fd, struct process_table *pt, int *err){
+    int res;
+
+    if (fd < 0 || fd >= FD_LIMIT){
+        *err = EBADF;
+        return -1;
     }
 
-    lock_release(system_file_lock);
-    return -1;
+    lock_acquire(p->fd_lock);
+    if (fd >= p->fd_size){
+        res = fd_grow(p, fd);
+        if (res){
+            lock_release(p->fd_lock);
+            *err = res;
+            return -1;
+        }
+    }
+    if (p->process_file_table[fd] != NULL){
+        //another thread got there first
+        lock_release(p->fd_lock);
+        *err = EBUSY;
+        return -1;
+    }
+    fd_set(p, fd, pt);
+    lock_release(p->fd_lock);
+    return fd;
 }
 
-int remove_fd(struct proc *p, int fd){
-    lock_acquire(p->process_file_table[fd]->of_ref->p_lock);
-    if (p->process_file_table[fd]->of_ref->of_pointercount == 1){
-	    p->process_file_table[fd]->of_ref->of_pointercount = 0;
-        p->process_file_table[fd]->of_ref->vn = NULL;
-        lock_release(p->process_file_table[fd]->of_ref->p_lock);
-        lock_destroy(p->process_file_table[fd]->of_ref->p_lock);
-        kfree(p->process_file_table[fd]);
-	    sys_count--; 
-    }
-    else {
-        p->process_file_table[fd]->of_ref->of_pointercount--;
-        lock_release(p->process_file_table[fd]->of_ref->p_lock);
+struct process_table *fd_clear(struct proc *p, int fd){
+    struct process_table *pt;
+
+    lock_acquire(p->fd_lock);
+    if (fd < 0 || fd >= p->fd_size || p->process_file_table[fd] == NULL){
+        lock_release(p->fd_lock);
+        return NULL;
     }
-    p->cnt_open--;
-    p->last_fd = fd; 
-    //set the last fd as the last removed to be reassigned
+    pt = p->process_file_table[fd];
     p->process_file_table[fd] = NULL;
+    p->fd_map[fd / 32] &= ~(((uint32_t)1) << (fd % 32));
+    p->cnt_open--;
+    if (fd < p->fd_lowfree)
+        p->fd_lowfree = fd;
+    lock_release(p->fd_lock);
+    return pt;
+}
+
+int fd_copy(struct proc *dst, struct proc *src, int *err){
+    struct process_table *pt, **files;
+    uint32_t *map, bits;
+    int w, bit, fd, size, n, res;
+
+    lock_acquire(src->fd_lock);
+    size = src->fd_size;
+    files = kmalloc(size * sizeof(struct process_table *));
+    map = kmalloc(size / 32 * sizeof(uint32_t));
+    if (files == NULL || map == NULL){
+        lock_release(src->fd_lock);
+        kfree(files);
+        kfree(map);
+        *err = ENOMEM;
+        return -1;
+    }
+    bzero(files, size * sizeof(struct process_table *));
+    bzero(map, size / 32 * sizeof(uint32_t));
+
+    //only visit the descriptors that are open, a word at a time
+    res = 0;
+    n = 0;
+    for (w = 0; w < size / 32; w++){
+        bits = src->fd_map[w];
+        while (bits != 0){
+            bit = map_ffs(bits);
+            bits &= ~(((uint32_t)1) << bit);
+            fd = w * 32 + bit;
+
+            pt = src->process_file_table[fd];
+            files[fd] = pt;
+            openfile_ref(pt);
+            map[w] |= ((uint32_t)1) << bit;
+            n++;
+        }
+    }
+    dst->fd_lowfree = src->fd_lowfree;
+    lock_release(src->fd_lock);
+
+    //dst is new, so nobody else is looking at its table; give up its
+    //console entries and use the copy
+    fd_cleanup(dst);
+    dst->fd_lock = lock_create("fd_lock");
+    dst->process_file_table = files;
+    dst->fd_map = map;
+    dst->fd_size = size;
+    dst->cnt_open = n;
+    if (dst->fd_lock == NULL && res == 0)
+        res = ENOMEM;
+
+    if (res){
+        *err = res;
+        return -1;
+    }
     return 0;
 }
 
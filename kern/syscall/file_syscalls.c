@@ -3,6 +3,7 @@
 #include <kern/unistd.h>
 #include <kern/fcntl.h>
 #include <kern/seek.h>
+#include <kern/ioctl.h>
 #include <clock.h>
 #include <copyinout.h>
 #include <syscall.h>
@@ -15,256 +16,361 @@
 #include <elf.h>
 #include <stat.h>
 #include <synch.h>
+#include <limits.h>
+#include <pipe.h>
 #include <kern/errno.h>
 #include "opt-shell.h"
 
 
 
 
-int sys_write(int fd, userptr_t buf_ptr, size_t size, int* err){
-	int i, res, ret;
-	char *p = (char *)buf_ptr; 
-	char namebuffer[PATH_MAX];
-	int is_ref; 	//has proc_file_table[fd] a reference to the system_wide?
-	struct proc *pr = curproc;
-	struct iovec iov;
-	struct uio u;
-	struct addrspace *as = proc_getas();
-	struct vnode *v;
+/*
+ * The console has no vnode here, so its data goes through the kernel
+ * a chunk at a time with putch/getch. Files are read and written with
+ * VOP_READ/VOP_WRITE straight from and into the user buffer: uiomove
+ * does the only copy, and there's no limit on the size.
+ */
+#define CONIO_CHUNK 128 //console bytes moved per copyin/copyout
 
-	res = copyin((userptr_t) buf_ptr, namebuffer, size);
-	if(res){
-		*err = res;
-		return -1;
-	}
-
-	if(fd < 0 || fd >= OPEN_MAX){
-		*err = EBADF;
-		return -1;
-	}
+static int console_write(userptr_t buf_ptr, size_t size, int *err){
+	char kbuf[CONIO_CHUNK];
+	size_t done, n, i;
+	int res;
 
-	if(pr->process_file_table[fd] == NULL){
-		*err = EBADF;
-		return -1;
+	for(done = 0; done < size; done += n){
+		n = size - done < CONIO_CHUNK ? size - done : CONIO_CHUNK;
+		res = copyin((const_userptr_t)((char *)buf_ptr + done), kbuf, n);
+		if(res){
+			if(done > 0)
+				break; //report what got written
+			*err = res;
+			return -1;
+		}
+		for(i = 0; i < n; i++){
+			putch(kbuf[i]);
+		}
 	}
+	return (int)done;
+}
 
-	if(buf_ptr == NULL){
-		*err = EFAULT;
-		return -1;
-	}
-	
-	if(pr->process_file_table[fd]->of_ref != NULL)
-		is_ref=1;
-	else{
-		is_ref=0;
+static int console_read(userptr_t buf_ptr, size_t size, int *err){
+	char kbuf[CONIO_CHUNK];
+	size_t done, n, i;
+	int ch, res;
+
+	for(done = 0; done < size; done += i){
+		n = size - done < CONIO_CHUNK ? size - done : CONIO_CHUNK;
+		for(i = 0; i < n; i++){
+			ch = getch();
+			if(ch < 0)
+				break;
+			kbuf[i] = ch;
+		}
+		res = copyout(kbuf, (userptr_t)((char *)buf_ptr + done), i);
+		if(res){
+			if(done > 0)
+				break;
+			*err = res;
+			return -1;
+		}
+		if(i < n){
+			done += i;
+			break; //end of input
+		}
 	}
+	return (int)done;
+}
 
+//Whether pt's file was opened for RW.
+static bool rw_allowed(struct process_table *pt, enum uio_rw rw){
+	int mode = pt->flag & O_ACCMODE;
 
+	if(rw == UIO_READ)
+		return mode == O_RDONLY || mode == O_RDWR;
+	return mode == O_WRONLY || mode == O_RDWR;
+}
 
-//we are tring to write onto a STD FILE -> use putch
-  	if (!is_ref){
-  		for (i=0; i<(int)size; i++) {
-  			putch(p[i]);
-  		}
+/*
+ * Do the I/O in u on pt's file. With SHARED it happens at the shared
+ * offset, which is moved past it, under p_lock so threads and processes
+ * sharing the descriptor each get their own part of the file. Otherwise
+ * it's at u's own offset and no lock is taken, so positional I/O on a
+ * shared descriptor doesn't serialize.
+ */
+static int file_uio(struct process_table *pt, struct uio *u, bool shared){
+	struct vnode *v = pt->of_ref->vn;
+	int res;
 
- 		 return (int)size;
-  	 }
-	
-	//not STD FILES -> check the flags
-	res = pr->process_file_table[fd]->flag & O_ACCMODE;
-	kprintf("\n %d",res);
-	if(res != O_WRONLY && res != O_RDWR){
-		*err = EBADF;
-		return -1;
+	if(shared){
+		lock_acquire(pt->of_ref->p_lock);
+		u->uio_offset = pt->offset;
 	}
 
+	if(u->uio_rw == UIO_READ)
+		res = VOP_READ(v, u);
+	else
+		res = VOP_WRITE(v, u);
 
-//manual initialization of iov and uio -> we are in userspace
+	if(shared){
+		if(res == 0)
+			pt->offset = u->uio_offset;
+		lock_release(pt->of_ref->p_lock);
+	}
+	return res;
+}
 
- 	iov.iov_ubase = buf_ptr;
-  	iov.iov_len = size;      
+//Do the console I/O in u a segment at a time, stopping at a short one.
+static int console_uio(struct uio *u, int *err){
+	struct iovec *iov;
+	unsigned i;
+	int n, done = 0;
+
+	for(i = 0; i < u->uio_iovcnt; i++){
+		iov = &u->uio_iov[i];
+		if(u->uio_rw == UIO_READ)
+			n = console_read(iov->iov_ubase, iov->iov_len, err);
+		else
+			n = console_write(iov->iov_ubase, iov->iov_len, err);
+		if(n < 0){
+			if(done > 0)
+				break; //report what got moved
+			return -1;
+		}
+		done += n;
+		if((size_t)n < iov->iov_len)
+			break;
+	}
+	return done;
+}
 
-  	u.uio_iov = &iov;
- 	u.uio_iovcnt = 1;
-  	u.uio_resid = size;   
+/*
+ * The I/O in u on descriptor fd: read/write and readv/writev, and
+ * their positional versions when POS isn't NULL.
+ */
+static int file_rw(int fd, struct uio *u, const off_t *pos, int *err){
+	struct process_table *pt;
+	size_t size;
+	int res;
 
- 	u.uio_offset = pr->process_file_table[fd]->offset;
+	pt = fd_get(curproc, fd);
+	if(pt == NULL){
+		*err = EBADF;
+		return -1;
+	}
 
+	//we are tring to use a STD FILE -> use putch/getch
+	if(pt->of_ref == NULL){
+		if(pos != NULL){
+			*err = ESPIPE;
+			return -1;
+		}
+		return console_uio(u, err);
+	}
 
+	size = u->uio_resid;
 
- 	u.uio_segflg = UIO_USERSPACE;
- 	u.uio_rw = UIO_WRITE;
- 	u.uio_space = as;
+	//not STD FILES -> check the flags
+	if(!rw_allowed(pt, u->uio_rw)){
+		res = EBADF;
+		goto out;
+	}
+
+	if(pos != NULL){
+		if(*pos < 0){
+			res = EINVAL;
+			goto out;
+		}
+		if(!VOP_ISSEEKABLE(pt->of_ref->vn)){
+			res = ESPIPE;
+			goto out;
+		}
+		u->uio_offset = *pos;
+	}
 
-	lock_acquire(pr->process_file_table[fd]->of_ref->p_lock);
+	res = file_uio(pt, u, pos == NULL);
 
-	v = pr->process_file_table[fd]->of_ref->vn;
- 	res = VOP_WRITE(v, &u);
+ out:
+	openfile_release(pt);
 	if(res){
-		lock_release(pr->process_file_table[fd]->of_ref->p_lock);
 		*err = res;
 		return -1;
-	}	
-	pr->process_file_table[fd]->offset = u.uio_offset;	
-	ret = size - u.uio_resid; 
+	}
+	return size - u->uio_resid;
+}
 
-	lock_release(pr->process_file_table[fd]->of_ref->p_lock);
+static int buf_rw(int fd, userptr_t buf_ptr, size_t size, const off_t *pos,
+		enum uio_rw rw, int *err){
+	struct iovec iov;
+	struct uio u;
 
-  	return ret;
+	uio_uinit(&iov, &u, proc_getas(), buf_ptr, size, 0, rw);
+	return file_rw(fd, &u, pos, err);
+}
+
+int sys_write(int fd, userptr_t buf_ptr, size_t size, int* err){
+	return buf_rw(fd, buf_ptr, size, NULL, UIO_WRITE, err);
 }
 
 int sys_read(int fd, userptr_t buf_ptr, size_t size, int* err){
+	return buf_rw(fd, buf_ptr, size, NULL, UIO_READ, err);
+}
 
-  	int i, res, ret;
-  	char *p = (char *)buf_ptr;
-	char namebuffer[PATH_MAX];
-	int is_ref;  	
-  	struct proc *pr = curproc;
-  	struct iovec iov;
-  	struct uio u;
-  	struct addrspace *as;
-  	struct vnode *v;
-	
- 	res = copyin((userptr_t) buf_ptr, namebuffer, size);
-	if(res){
-		*err = res;
-		return -1;
-	}
+/*
+ * Positional I/O: at POS, leaving the descriptor's offset alone.
+ */
+int sys_pwrite(int fd, userptr_t buf_ptr, size_t size, off_t pos, int *err){
+	return buf_rw(fd, buf_ptr, size, &pos, UIO_WRITE, err);
+}
 
-	if(fd < 0 || fd >= OPEN_MAX){
-		*err = EBADF;
-		return -1;
-	}
+int sys_pread(int fd, userptr_t buf_ptr, size_t size, off_t pos, int *err){
+	return buf_rw(fd, buf_ptr, size, &pos, UIO_READ, err);
+}
 
-	if(pr->process_file_table[fd] == NULL){
-		*err = EBADF;
+/*
+ * Scatter/gather I/O. The iovec array is copied in with one copyin
+ * (onto the stack if it's short) and the whole thing goes down to the
+ * file system as a single uio, so it's one VOP_READ/VOP_WRITE however
+ * many segments there are.
+ */
+#define IOV_ONSTACK 8 //iovecs that fit without a kmalloc
+
+static int iov_rw(int fd, userptr_t uiov, int iovcnt, const off_t *pos,
+		enum uio_rw rw, int *err){
+	struct iovec small[IOV_ONSTACK], *iov;
+	struct uio u;
+	size_t total;
+	int i, res;
+
+	if(iovcnt <= 0 || iovcnt > IOV_MAX){
+		*err = EINVAL;
 		return -1;
 	}
 
-	if(buf_ptr == NULL){
-		*err = EFAULT;
-		return -1;
+	if(iovcnt <= IOV_ONSTACK){
+		iov = small;
 	}
-	
-	if(pr->process_file_table[fd]->of_ref != NULL)
-		is_ref=1;
 	else{
-		is_ref=0;
+		iov = kmalloc(iovcnt * sizeof(struct iovec));
+		if(iov == NULL){
+			*err = ENOMEM;
+			return -1;
+		}
 	}
 
-	
-
-	if (!is_ref){
- 	 	for (i=0; i<(int)size; i++) {
-   		 	p[i] = getch();
-    			if (p[i] < 0) 
-     				return i;
-  		}
-	
-		return size;
-   	}
-
-	res = pr->process_file_table[fd]->flag & O_ACCMODE;
-	if(res != O_RDONLY && res != O_RDWR){
-		*err = EBADF;
-		return -1;
+	res = copyin((const_userptr_t)uiov, iov, iovcnt * sizeof(struct iovec));
+	if(res){
+		*err = res;
+		res = -1;
+		goto out;
 	}
 
-  	iov.iov_ubase = buf_ptr;
-  	iov.iov_len = size;      
-  	as = proc_getas();
-
-  	u.uio_iov = &iov;
-  	u.uio_iovcnt = 1;
-  	u.uio_resid = size;   
+	//the count we return has to fit in an int
+	total = 0;
+	for(i = 0; i < iovcnt; i++){
+		if(iov[i].iov_len > 0x7fffffff - total){
+			*err = EINVAL;
+			res = -1;
+			goto out;
+		}
+		total += iov[i].iov_len;
+	}
 
-  	u.uio_offset = pr->process_file_table[fd]->offset;
+	u.uio_iov = iov;
+	u.uio_iovcnt = iovcnt;
+	u.uio_offset = 0;
+	u.uio_resid = total;
+	u.uio_segflg = UIO_USERSPACE;
+	u.uio_rw = rw;
+	u.uio_space = proc_getas();
 
+	res = file_rw(fd, &u, pos, err);
 
-  	u.uio_segflg = UIO_USERSPACE;
-  	u.uio_rw = UIO_READ;
-  	u.uio_space = as;
+ out:
+	if(iov != small)
+		kfree(iov);
+	return res;
+}
 
-	lock_acquire(pr->process_file_table[fd]->of_ref->p_lock);
-	v = pr->process_file_table[fd]->of_ref->vn;
-  	res = VOP_READ(v, &u);
+int sys_writev(int fd, userptr_t iov, int iovcnt, int *err){
+	return iov_rw(fd, iov, iovcnt, NULL, UIO_WRITE, err);
+}
 
-	if(res){
-		lock_release(pr->process_file_table[fd]->of_ref->p_lock);
-		*err = res;
-		return -1;
-	}	
-	pr->process_file_table[fd]->offset = u.uio_offset;	
-	ret = size - u.uio_resid; 
+int sys_readv(int fd, userptr_t iov, int iovcnt, int *err){
+	return iov_rw(fd, iov, iovcnt, NULL, UIO_READ, err);
+}
 
-	lock_release(pr->process_file_table[fd]->of_ref->p_lock);
+int sys_pwritev(int fd, userptr_t iov, int iovcnt, off_t pos, int *err){
+	return iov_rw(fd, iov, iovcnt, &pos, UIO_WRITE, err);
+}
 
-  	return ret;
+int sys_preadv(int fd, userptr_t iov, int iovcnt, off_t pos, int *err){
+	return iov_rw(fd, iov, iovcnt, &pos, UIO_READ, err);
 }
 
 off_t sys_lseek(int fd, off_t offset, int whence, int *err){
     
 	off_t finaloffset;
     struct stat file_stat;
-    struct proc *current_process = curproc;
+    struct process_table *pt;
 
-    if (fd < 0 || fd >= OPEN_MAX){
+    pt = fd_get(curproc, fd);
+    if (pt == NULL){
         *err = EBADF;
         return -1;
     }
-    if (current_process->process_file_table[fd] == NULL){
-        *err = EBADF;
-        return -1;
-    }
-    if (current_process->process_file_table[fd]->of_ref == NULL){
+    if (pt->of_ref == NULL){
         *err = ESPIPE;
         return -1;
     }
-    if (current_process->process_file_table[fd]->of_ref->vn == NULL){
+    //the rest returns through out, which drops the reference fd_get took
+    finaloffset = -1;
+    if (pt->of_ref->vn == NULL){
         *err = ESPIPE;
-        return -1;
+        goto out;
     }
     //VOP_ISSEEKABLE is in vnode.h and return true if the file is seekable. It means that it's not a file, but a pipe
-    if (!VOP_ISSEEKABLE(current_process->process_file_table[fd]->of_ref->vn)){
+    if (!VOP_ISSEEKABLE(pt->of_ref->vn)){
         *err = ESPIPE;
-        return -1;
+        goto out;
     }
+    //the offset is shared: take p_lock as file_uio does, so a read or
+    //write meanwhile can't lose our update or have us lose theirs
+    lock_acquire(pt->of_ref->p_lock);
     //VOP_STAT returns info about the file: we can use it to knoe the size of the file.
-    if (VOP_STAT(current_process->process_file_table[fd]->of_ref->vn, &file_stat))
-        return -1;
+    *err = VOP_STAT(pt->of_ref->vn, &file_stat);
+    if (*err)
+        goto out_unlock;
 
     switch (whence){
 
 		case SEEK_SET:
 			finaloffset = offset;
-			if (finaloffset < 0){
-				*err = EINVAL;
-				return -1;
-			}
 			break;
 
 		case SEEK_CUR:
-			finaloffset = current_process->process_file_table[fd]->offset + offset;
-			if (finaloffset < 0){
-				*err = EINVAL;
-				return -1;
-			}
+			finaloffset = pt->offset + offset;
 			break;
 
 		case SEEK_END:
 			finaloffset = file_stat.st_size + offset;
-			if (finaloffset < 0){
-				*err = EINVAL;
-				return -1;
-			}
 			break;
 
 		default:
 			*err = EINVAL;
-			return -1;
+			finaloffset = -1;
+			goto out_unlock;
+	}
+	if (finaloffset < 0){
+		*err = EINVAL;
+		finaloffset = -1;
+		goto out_unlock;
 	}
 
-    current_process->process_file_table[fd]->offset = finaloffset;
+    pt->offset = finaloffset;
+ out_unlock:
+    lock_release(pt->of_ref->p_lock);
+ out:
+    openfile_release(pt);
     return finaloffset;
 }
 
@@ -317,11 +423,11 @@ int sys_open(char *pathname, int flag, int *err){
     }
 
     fd = assign_fd(current_process, vn, flag, err);
-    if (fd){
-        current_process->process_file_table[fd]->flag = flag;
+    if (fd >= 0){
         return fd;
     }
     
+    vfs_close(vn);
 	return -1;
 }
 int sys__getcwd(char *buf, size_t buflen, int *err){
@@ -362,71 +468,114 @@ int sys__getcwd(char *buf, size_t buflen, int *err){
 
 int sys_dup2(int oldfd,int newfd,int *err){
 
+	struct proc *current_proc = curproc;
+	struct process_table *pt;
 
-	if(oldfd<0 || oldfd>=OPEN_MAX){
+	if(newfd<0 || newfd>=FD_LIMIT){
 		*err=EBADF;
 		return -1;
 	}
 
-	if(newfd<0 || newfd>=OPEN_MAX){
+	//the reference fd_get takes becomes newfd's: the two share pt
+	//(for the console too, whose entry is shared by every descriptor)
+	pt = fd_get(current_proc, oldfd);
+	if(pt==NULL){
 		*err=EBADF;
 		return -1;
 	}
-	
-	struct proc *current_proc = curproc;
-	if(current_proc->process_file_table[oldfd]==NULL){
-		*err=EBADF;
-		return -1;
-	}
-	
-	if(current_proc->cnt_open >= OPEN_MAX){
-    		*err = EMFILE;
-    		return -1; 
- 	}
 
- 	if(newfd==oldfd)
+ 	if(newfd==oldfd){
+		openfile_release(pt);
  		return newfd;
-
-	if(current_proc->process_file_table[newfd]!=NULL){ //newfd is already used->close the old file
-		sys_close(newfd,err);
 	}
 
-	current_proc->process_file_table[newfd]=current_proc->process_file_table[oldfd];
-	if(current_proc->process_file_table[newfd]->of_ref!=NULL){
-	//*openfile != NULL -> vnode(file) is already used -> shared between more processes.
-		lock_acquire(current_proc->process_file_table[newfd]->of_ref->p_lock);
-		VOP_INCREF(current_proc->process_file_table[newfd]->of_ref->vn);
-		current_proc->process_file_table[newfd]->of_ref->of_pointercount++;
-		lock_release(current_proc->process_file_table[newfd]->of_ref->p_lock);	
+	//newfd is already used->close the old file; go round again if
+	//another thread opens something there in between
+	while(fd_install(current_proc, newfd, pt, err) < 0){
+		if(*err != EBUSY){
+			openfile_release(pt);
+			return -1;
+		}
+		sys_close(newfd,err);
 	}
 	
 	return newfd;
 
 }
 
-int sys_close(int fd, int*err){
-    struct vnode *vn;
-    struct proc *current_process = curproc;
+/*
+ * Make a pipe and give back its read and write descriptors, in that
+ * order, in fds_ptr[0] and fds_ptr[1].
+ */
+int sys_pipe(userptr_t fds_ptr, int *err){
+	struct vnode *rvn, *wvn;
+	int fds[2];
+	int res;
+
+	res = pipe_create(&rvn, &wvn);
+	if(res){
+		*err = res;
+		return -1;
+	}
 
-    if(fd<0 || fd>=OPEN_MAX){
+	fds[0] = assign_fd(curproc, rvn, O_RDONLY, err);
+	if(fds[0] < 0){
+		vfs_close(rvn);
+		vfs_close(wvn);
+		return -1;
+	}
+	//the descriptors own the vnodes from here on
+	fds[1] = assign_fd(curproc, wvn, O_WRONLY, err);
+	if(fds[1] < 0){
+		remove_fd(curproc, fds[0]);
+		vfs_close(wvn);
+		return -1;
+	}
+
+	res = copyout(fds, fds_ptr, sizeof(fds));
+	if(res){
+		remove_fd(curproc, fds[0]);
+		remove_fd(curproc, fds[1]);
+		*err = res;
+		return -1;
+	}
+	return 0;
+}
+
+int sys_ioctl(int fd, int code, userptr_t data, int *err){
+    struct process_table *pt;
+
+    pt = fd_get(curproc, fd);
+    if(pt==NULL){
         *err=EBADF;
         return -1;
     }
-    if(current_process->process_file_table[fd]==NULL){
-        *err=EBADF;
+    //the console has no ioctls
+    if(pt->of_ref == NULL){
+        *err=EINVAL;
         return -1;
     }
-//when doing a dup, it can happen that the previous fd is related a STDIN,STDOUT e STDERR (0,1,2).
-    if(current_process->process_file_table[fd]->of_ref == NULL){
-		current_process->process_file_table[fd]=NULL;
-		current_process->cnt_open--;
-		current_process->last_fd = fd;
-		return 0;
+    //the semaphore ioctls are P, so they need what read would
+    if((code == SEMIOC_TRYP || code == SEMIOC_TIMEDP) && !rw_allowed(pt, UIO_READ)){
+        openfile_release(pt);
+        *err=EBADF;
+        return -1;
     }
 
-    vn = current_process->process_file_table[fd]->of_ref->vn;
-    remove_fd(current_process, fd);
-    vfs_close(vn);
+    *err = VOP_IOCTL(pt->of_ref->vn, code, data);
+    openfile_release(pt);
+    if(*err)
+        return -1;
+    return 0;
+}
+
+int sys_close(int fd, int*err){
+    //the file itself is closed with the last reference, which may be
+    //another descriptor's or a system call's still using it
+    if(remove_fd(curproc, fd)){
+        *err=EBADF;
+        return -1;
+    }
     return 0;    
 }
 
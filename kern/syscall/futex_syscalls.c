@@ -0,0 +1,182 @@
+/*
+ * Futexes: user-level locks that only come into the kernel when they
+ * have to wait or wake somebody. futex_wait sleeps if the word at a
+ * user address still holds the value the caller last saw there;
+ * futex_wake wakes up to N threads sleeping on a word. What the word
+ * means is up to user code.
+ *
+ * Words are identified by physical address, so the same word is the
+ * same futex however it is mapped. Sleepers hash into FUTEX_BUCKETS
+ * buckets, each with a spinlock, a wchan and the list of waiters in
+ * it. A waker takes up to N waiters for its word off the list, marks
+ * them and wakes just those threads, so sleepers on other words that
+ * hash to the same bucket are left alone. The word is read through
+ * the kernel's direct
+ * mapping of physical memory while holding the bucket lock, so
+ * checking it and going to sleep is atomic with respect to
+ * futex_wake, and can't fault.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <vm.h>
+#include <addrspace.h>
+#include <proc.h>
+#include <current.h>
+#include <syscall.h>
+
+#define FUTEX_BUCKETS 64
+
+struct futex_waiter{
+    paddr_t fw_paddr;               //word we are waiting on
+    struct proc *fw_proc;           //who is waiting, for futex_exit
+    struct thread *fw_thread;       //the waiting thread, for futex_wake
+    int fw_woken;                   //set by futex_wake
+    struct futex_waiter *fw_next;
+};
+
+struct futex_bucket{
+    struct spinlock fb_lock;        //protects fb_waiters
+    struct wchan *fb_wchan;         //waiters sleep here
+    struct futex_waiter *fb_waiters; //in arrival order
+};
+
+static struct futex_bucket futex_table[FUTEX_BUCKETS];
+
+void futex_bootstrap(void){
+
+    int i;
+
+    for(i = 0; i < FUTEX_BUCKETS; i++){
+        spinlock_init(&futex_table[i].fb_lock);
+        futex_table[i].fb_wchan = wchan_create("futex");
+        if(futex_table[i].fb_wchan == NULL)
+            panic("futex_bootstrap: out of memory\n");
+        futex_table[i].fb_waiters = NULL;
+    }
+}
+
+static struct futex_bucket *futex_hash(paddr_t paddr){
+    return &futex_table[((paddr >> 2) ^ (paddr >> 12)) % FUTEX_BUCKETS];
+}
+
+//find the physical address of a user word
+static int futex_lookup(userptr_t uaddr, paddr_t *paddr){
+
+    struct addrspace *as = proc_getas();
+
+    if(((vaddr_t)uaddr & (sizeof(int) - 1)) != 0)
+        return EINVAL;
+    if(as == NULL)
+        return EFAULT;
+    return as_translate(as, (vaddr_t)uaddr, paddr);
+}
+
+/*
+ * Sleep until woken by futex_wake on UADDR, unless *UADDR != VAL
+ * (EAGAIN). Fails with EINTR if the process exits meanwhile.
+ */
+int sys_futex_wait(userptr_t uaddr, int val, int *err){
+
+    struct proc *p = curproc;
+    struct futex_bucket *fb;
+    struct futex_waiter fw, **fwp;
+
+    *err = futex_lookup(uaddr, &fw.fw_paddr);
+    if(*err)
+        return -1;
+    fw.fw_proc = p;
+    fw.fw_thread = curthread;
+    fw.fw_woken = 0;
+    fw.fw_next = NULL;
+
+    fb = futex_hash(fw.fw_paddr);
+    spinlock_acquire(&fb->fb_lock);
+
+    if(*(volatile int *)PADDR_TO_KVADDR(fw.fw_paddr) != val){
+        spinlock_release(&fb->fb_lock);
+        *err = EAGAIN;
+        return -1;
+    }
+
+    for(fwp = &fb->fb_waiters; *fwp != NULL; fwp = &(*fwp)->fw_next)
+        ;
+    *fwp = &fw;
+
+    while(!fw.fw_woken && !p->p_exiting)
+        wchan_sleep(fb->fb_wchan, &fb->fb_lock);
+
+    if(!fw.fw_woken){
+        //the process is exiting, we'll go on the way out
+        for(fwp = &fb->fb_waiters; *fwp != &fw; fwp = &(*fwp)->fw_next)
+            ;
+        *fwp = fw.fw_next;
+        spinlock_release(&fb->fb_lock);
+        *err = EINTR;
+        return -1;
+    }
+
+    spinlock_release(&fb->fb_lock);
+    return 0;
+}
+
+/*
+ * Wake up to N threads waiting on UADDR, oldest first. Returns how
+ * many were woken.
+ */
+int sys_futex_wake(userptr_t uaddr, int n, int *err){
+
+    struct futex_bucket *fb;
+    struct futex_waiter *fw, **fwp;
+    paddr_t paddr;
+    int woken = 0;
+
+    *err = futex_lookup(uaddr, &paddr);
+    if(*err)
+        return -1;
+
+    fb = futex_hash(paddr);
+    spinlock_acquire(&fb->fb_lock);
+
+    fwp = &fb->fb_waiters;
+    while(*fwp != NULL && woken < n){
+        fw = *fwp;
+        if(fw->fw_paddr == paddr){
+            *fwp = fw->fw_next;
+            fw->fw_woken = 1;
+            //it may be up already, from futex_exit; then it sees fw_woken
+            wchan_wakethread(fb->fb_wchan, &fb->fb_lock, fw->fw_thread);
+            woken++;
+        }
+        else{
+            fwp = &fw->fw_next;
+        }
+    }
+
+    spinlock_release(&fb->fb_lock);
+    return woken;
+}
+
+/*
+ * Process P is exiting: get its threads out of futex_wait. Called
+ * after setting p_exiting.
+ */
+void futex_exit(struct proc *p){
+
+    struct futex_waiter *fw;
+    int i;
+
+    for(i = 0; i < FUTEX_BUCKETS; i++){
+        spinlock_acquire(&futex_table[i].fb_lock);
+        for(fw = futex_table[i].fb_waiters; fw != NULL; fw = fw->fw_next){
+            if(fw->fw_proc == p){
+                wchan_wakeall(futex_table[i].fb_wchan, &futex_table[i].fb_lock);
+                break;
+            }
+        }
+        spinlock_release(&futex_table[i].fb_lock);
+    }
+}
@@ -0,0 +1,103 @@
+/*
+ * IPC system calls. The work is done in thread/ipc.c; these just
+ * move messages in and out of user space and find the endpoints.
+ * Messages go to the endpoint of the destination process and are
+ * received on the endpoint of the current one.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <proc.h>
+#include <current.h>
+#include <ipc.h>
+#include <syscall.h>
+
+
+static int ipc_sendcall(pid_t dest, userptr_t umsg, bool call, int *err){
+
+	struct ipc_endpoint *ep;
+	struct ipc_msg msg;
+
+	*err = copyin((const_userptr_t)umsg, &msg, sizeof(msg));
+	if(*err)
+		return -1;
+
+	ep = proc_get_endpoint(dest);
+	if(ep == NULL){
+		*err = ESRCH;
+		return -1;
+	}
+
+	if(call)
+		*err = ipc_call(ep, &msg, curproc->pid);
+	else
+		*err = ipc_send(ep, &msg, curproc->pid);
+	ipc_endpoint_release(ep);
+	if(*err)
+		return -1;
+
+	if(call){
+		*err = copyout(&msg, umsg, sizeof(msg));
+		if(*err)
+			return -1;
+	}
+	return 0;
+}
+
+int sys_ipc_send(pid_t dest, userptr_t umsg, int *err){
+	return ipc_sendcall(dest, umsg, false, err);
+}
+
+int sys_ipc_call(pid_t dest, userptr_t umsg, int *err){
+	return ipc_sendcall(dest, umsg, true, err);
+}
+
+pid_t sys_ipc_recv(userptr_t umsg, int *err){
+
+	struct ipc_msg msg;
+	pid_t from;
+
+	*err = ipc_recv(curproc->p_ipc, &msg, &from);
+	if(*err)
+		return -1;
+
+	*err = copyout(&msg, umsg, sizeof(msg));
+	if(*err)
+		return -1;
+	return from;
+}
+
+int sys_ipc_reply(userptr_t umsg, int *err){
+
+	struct ipc_msg msg;
+
+	*err = copyin((const_userptr_t)umsg, &msg, sizeof(msg));
+	if(*err)
+		return -1;
+
+	*err = ipc_reply(&msg);
+	if(*err)
+		return -1;
+	return 0;
+}
+
+pid_t sys_ipc_replyrecv(userptr_t umsg, int *err){
+
+	struct ipc_msg msg;
+	pid_t from;
+
+	*err = copyin((const_userptr_t)umsg, &msg, sizeof(msg));
+	if(*err)
+		return -1;
+
+	*err = ipc_replyrecv(curproc->p_ipc, &msg, &from);
+	if(*err)
+		return -1;
+
+	*err = copyout(&msg, umsg, sizeof(msg));
+	if(*err)
+		return -1;
+	return from;
+}
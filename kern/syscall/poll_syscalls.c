@@ -0,0 +1,460 @@
+/*
+ * poll() and select(): wait until any of a set of descriptors is ready
+ * for I/O, so one thread can serve many of them without a process per
+ * descriptor or busy-waiting.
+ *
+ * Both come down to poll_wait, on an array of struct pollfd in kernel
+ * memory. It takes a reference to each descriptor's open file (fd_get
+ * does), so closing one meanwhile can't pull the object out from under
+ * us, and asks each
+ * of them with VOP_POLL. The first round also registers our pollwait
+ * with every object (see poll.h); if nothing is ready we sleep until
+ * one of them calls pollq_wakeup, or the timeout expires, and then ask
+ * them all again. The console descriptors every process starts with
+ * have no vnode (they go straight to getch/putch), so console_poll
+ * stands in for VOP_POLL on those.
+ *
+ * poll_kernel and select_kernel are the same calls on kernel memory,
+ * so polltest can go through them without a user address space.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/poll.h>
+#include <kern/time.h>
+#include <lib.h>
+#include <clock.h>
+#include <copyinout.h>
+#include <spinlock.h>
+#include <vnode.h>
+#include <poll.h>
+#include <proc.h>
+#include <current.h>
+#include <syscall.h>
+
+#define POLL_ONSTACK 8       //descriptors that fit without a kmalloc
+#define SELECT_ONSTACK 2     //fd set words (of 32 fds) that fit without a kmalloc
+
+//what a pollfd refers to, as of the start of the call
+#define POLLSRC_NONE    0    //negative fd: skipped
+#define POLLSRC_BAD     1    //fd isn't open: POLLNVAL
+#define POLLSRC_CONSOLE 2    //getch/putch
+#define POLLSRC_VNODE   3    //ps_pt's vnode
+
+struct pollsrc{
+	int ps_kind;                //POLLSRC_*
+	struct process_table *ps_pt; //for POLLSRC_VNODE, referenced until the end
+};
+
+//per-descriptor state for poll_wait, ps_n of each
+struct pollset{
+	unsigned ps_n;
+	struct pollfd *ps_fds;
+	struct pollsrc *ps_srcs;
+	struct pollent *ps_ents;
+	void *ps_mem; //NULL while the buffers below are enough
+	struct pollfd ps_fdbuf[POLL_ONSTACK];
+	struct pollsrc ps_srcbuf[POLL_ONSTACK];
+	struct pollent ps_entbuf[POLL_ONSTACK];
+};
+
+static int pollset_init(struct pollset *set, unsigned n){
+	char *mem;
+
+	set->ps_n = n;
+	if(n <= POLL_ONSTACK){
+		set->ps_fds = set->ps_fdbuf;
+		set->ps_srcs = set->ps_srcbuf;
+		set->ps_ents = set->ps_entbuf;
+		set->ps_mem = NULL;
+		return 0;
+	}
+
+	//one allocation, most strictly aligned first
+	mem = kmalloc(n * (sizeof(struct pollent) + sizeof(struct pollsrc) +
+			sizeof(struct pollfd)));
+	if(mem == NULL)
+		return ENOMEM;
+	set->ps_mem = mem;
+	set->ps_ents = (struct pollent *)mem;
+	mem += n * sizeof(struct pollent);
+	set->ps_srcs = (struct pollsrc *)mem;
+	mem += n * sizeof(struct pollsrc);
+	set->ps_fds = (struct pollfd *)mem;
+	return 0;
+}
+
+static void pollset_cleanup(struct pollset *set){
+	if(set->ps_mem != NULL)
+		kfree(set->ps_mem);
+}
+
+//find what each fd refers to and hold on to it
+static void pollset_get(struct pollset *set){
+	struct process_table *pt;
+	struct pollsrc *ps;
+	unsigned i;
+
+	for(i = 0; i < set->ps_n; i++){
+		ps = &set->ps_srcs[i];
+		ps->ps_pt = NULL;
+		if(set->ps_fds[i].fd < 0){
+			ps->ps_kind = POLLSRC_NONE;
+			continue;
+		}
+		pt = fd_get(curproc, set->ps_fds[i].fd);
+		if(pt == NULL){
+			ps->ps_kind = POLLSRC_BAD;
+		}
+		else if(pt->of_ref == NULL){
+			ps->ps_kind = POLLSRC_CONSOLE;
+		}
+		else{
+			ps->ps_kind = POLLSRC_VNODE;
+			ps->ps_pt = pt;
+		}
+	}
+}
+
+static void pollset_put(struct pollset *set){
+	unsigned i;
+
+	for(i = 0; i < set->ps_n; i++){
+		if(set->ps_srcs[i].ps_kind == POLLSRC_VNODE)
+			openfile_release(set->ps_srcs[i].ps_pt);
+	}
+}
+
+/*
+ * Ask every object what is ready, registering PW with them unless it
+ * is NULL. Fills in revents and returns how many have any.
+ */
+static int pollset_scan(struct pollset *set, struct pollwait *pw){
+	struct pollfd *pfd;
+	struct pollsrc *ps;
+	unsigned i;
+	int ev, n = 0;
+
+	for(i = 0; i < set->ps_n; i++){
+		pfd = &set->ps_fds[i];
+		ps = &set->ps_srcs[i];
+		switch(ps->ps_kind){
+		case POLLSRC_NONE:
+			ev = 0;
+			break;
+		case POLLSRC_BAD:
+			ev = POLLNVAL;
+			break;
+		case POLLSRC_CONSOLE:
+			ev = console_poll(pfd->events, pw);
+			break;
+		default:
+			ev = VOP_POLL(ps->ps_pt->of_ref->vn, pfd->events, pw);
+			break;
+		}
+		pfd->revents = ev & (pfd->events | POLLERR | POLLHUP | POLLNVAL);
+		if(pfd->revents != 0)
+			n++;
+	}
+	return n;
+}
+
+/*
+ * The common part of poll and select: wait up to TICKS hardclocks
+ * (forever if negative) until something in SET is ready. Returns how
+ * many are, with revents filled in.
+ */
+static int poll_wait(struct pollset *set, int ticks, int *err){
+	struct proc *p = curproc;
+	struct pollwait pw, **pwp;
+	int n, res;
+
+	pollset_get(set);
+
+	if(ticks == 0){
+		//just looking, no need to register anywhere
+		n = pollset_scan(set, NULL);
+		pollset_put(set);
+		return n;
+	}
+
+	res = pollwait_init(&pw, set->ps_ents, set->ps_n);
+	if(res == 0 && ticks > 0){
+		res = pollwait_settimeout(&pw, ticks);
+		if(res)
+			pollwait_cleanup(&pw);
+	}
+	if(res){
+		pollset_put(set);
+		*err = res;
+		return -1;
+	}
+
+	//let poll_exit find us; if it has been and gone, don't wait
+	spinlock_acquire(&p->p_lock);
+	pw.pw_next = p->p_polls;
+	p->p_polls = &pw;
+	spinlock_release(&p->p_lock);
+	if(p->p_exiting)
+		pollwait_interrupt(&pw);
+
+	n = pollset_scan(set, &pw);
+	while(n == 0){
+		res = pollwait_sleep(&pw);
+		if(res == EINTR)
+			break;
+		pollwait_prepare(&pw);
+		n = pollset_scan(set, NULL);
+		if(res == ETIMEDOUT)
+			break;
+	}
+
+	spinlock_acquire(&p->p_lock);
+	for(pwp = &p->p_polls; *pwp != &pw; pwp = &(*pwp)->pw_next)
+		;
+	*pwp = pw.pw_next;
+	spinlock_release(&p->p_lock);
+
+	pollwait_cleanup(&pw);
+	pollset_put(set);
+
+	if(res == EINTR){
+		*err = EINTR;
+		return -1;
+	}
+	return n;
+}
+
+//copies for poll and select, from kernel memory if KERN
+static int poll_copyin(bool kern, const_userptr_t src, void *dst, size_t len){
+	if(kern){
+		memcpy(dst, (const void *)src, len);
+		return 0;
+	}
+	return copyin(src, dst, len);
+}
+
+static int poll_copyout(bool kern, const void *src, userptr_t dst, size_t len){
+	if(kern){
+		memcpy((void *)dst, src, len);
+		return 0;
+	}
+	return copyout(src, dst, len);
+}
+
+static int do_poll(userptr_t fds, unsigned nfds, int timeout_ms, bool kern, int *err){
+	struct pollset set;
+	int ticks, n, res;
+
+	if(nfds > FD_LIMIT){
+		*err = EINVAL;
+		return -1;
+	}
+
+	if(timeout_ms < 0)
+		ticks = -1;
+	else //round up, so we never wait less than asked
+		ticks = ((uint64_t)timeout_ms * HZ + 999) / 1000;
+
+	res = pollset_init(&set, nfds);
+	if(res){
+		*err = res;
+		return -1;
+	}
+
+	res = poll_copyin(kern, (const_userptr_t)fds, set.ps_fds, nfds * sizeof(struct pollfd));
+	if(res){
+		*err = res;
+		n = -1;
+		goto out;
+	}
+
+	n = poll_wait(&set, ticks, err);
+	if(n < 0)
+		goto out;
+
+	res = poll_copyout(kern, set.ps_fds, fds, nfds * sizeof(struct pollfd));
+	if(res){
+		*err = res;
+		n = -1;
+	}
+
+ out:
+	pollset_cleanup(&set);
+	return n;
+}
+
+int sys_poll(userptr_t fds, unsigned nfds, int timeout_ms, int *err){
+	return do_poll(fds, nfds, timeout_ms, false, err);
+}
+
+int poll_kernel(struct pollfd *fds, unsigned nfds, int timeout_ms, int *err){
+	return do_poll((userptr_t)fds, nfds, timeout_ms, true, err);
+}
+
+#define FDSET_ISSET(s, fd) (((s)[(fd) / 32] >> ((fd) % 32)) & 1)
+#define FDSET_SET(s, fd)   ((s)[(fd) / 32] |= (uint32_t)1 << ((fd) % 32))
+
+/*
+ * select, as poll on the fds in the three sets; see <kern/poll.h>.
+ * POLLHUP counts as readable and POLLERR as writable, since that's
+ * when a read or write returns at once (with EOF or EPIPE).
+ */
+static int do_select(int nfds, userptr_t readfds, userptr_t writefds,
+		userptr_t exceptfds, userptr_t timeout, bool kern, int *err){
+	uint32_t small[3 * SELECT_ONSTACK], *sets[3];
+	userptr_t usets[3] = { readfds, writefds, exceptfds };
+	struct pollset set;
+	struct pollfd *pfd;
+	struct timeval tv;
+	unsigned words, i, k, count;
+	int fd, ev, ticks, n, res;
+
+	if(nfds < 0 || nfds > FD_LIMIT){
+		*err = EINVAL;
+		return -1;
+	}
+
+	ticks = -1;
+	if(timeout != NULL){
+		res = poll_copyin(kern, (const_userptr_t)timeout, &tv, sizeof(tv));
+		if(res){
+			*err = res;
+			return -1;
+		}
+		if(tv.tv_sec < 0 || tv.tv_usec < 0 || tv.tv_usec >= 1000000){
+			*err = EINVAL;
+			return -1;
+		}
+		if(tv.tv_sec >= 0x7fffffff / HZ - 1)
+			ticks = -1; //as good as forever
+		else
+			ticks = tv.tv_sec * HZ + ((uint64_t)tv.tv_usec * HZ + 999999) / 1000000;
+	}
+
+	words = (nfds + 31) / 32;
+	if(words <= SELECT_ONSTACK){
+		sets[0] = small;
+	}
+	else{
+		sets[0] = kmalloc(3 * words * sizeof(uint32_t));
+		if(sets[0] == NULL){
+			*err = ENOMEM;
+			return -1;
+		}
+	}
+	sets[1] = sets[0] + words;
+	sets[2] = sets[1] + words;
+
+	count = 0;
+	for(i = 0; i < 3; i++){
+		if(usets[i] == NULL){
+			bzero(sets[i], words * sizeof(uint32_t));
+			continue;
+		}
+		res = poll_copyin(kern, (const_userptr_t)usets[i], sets[i], words * sizeof(uint32_t));
+		if(res){
+			*err = res;
+			n = -1;
+			goto out;
+		}
+	}
+	for(fd = 0; fd < nfds; fd++){
+		if(FDSET_ISSET(sets[0], fd) || FDSET_ISSET(sets[1], fd) || FDSET_ISSET(sets[2], fd))
+			count++;
+	}
+
+	res = pollset_init(&set, count);
+	if(res){
+		*err = res;
+		n = -1;
+		goto out;
+	}
+	k = 0;
+	for(fd = 0; fd < nfds; fd++){
+		ev = 0;
+		if(FDSET_ISSET(sets[0], fd))
+			ev |= POLLIN;
+		if(FDSET_ISSET(sets[1], fd))
+			ev |= POLLOUT;
+		if(FDSET_ISSET(sets[2], fd))
+			ev |= POLLPRI;
+		if(ev != 0){
+			pfd = &set.ps_fds[k++];
+			pfd->fd = fd;
+			pfd->events = ev;
+			pfd->revents = 0;
+		}
+	}
+	KASSERT(k == count);
+
+	n = poll_wait(&set, ticks, err);
+	if(n < 0)
+		goto out_set;
+
+	//turn revents back into fd sets, counting bits as we go
+	bzero(sets[0], 3 * words * sizeof(uint32_t));
+	n = 0;
+	for(k = 0; k < count; k++){
+		pfd = &set.ps_fds[k];
+		if(pfd->revents & POLLNVAL){
+			*err = EBADF;
+			n = -1;
+			goto out_set;
+		}
+		if((pfd->events & POLLIN) && (pfd->revents & (POLLIN | POLLHUP))){
+			FDSET_SET(sets[0], pfd->fd);
+			n++;
+		}
+		if((pfd->events & POLLOUT) && (pfd->revents & (POLLOUT | POLLERR))){
+			FDSET_SET(sets[1], pfd->fd);
+			n++;
+		}
+		if(pfd->revents & POLLPRI){
+			FDSET_SET(sets[2], pfd->fd);
+			n++;
+		}
+	}
+
+	for(i = 0; i < 3; i++){
+		if(usets[i] == NULL)
+			continue;
+		res = poll_copyout(kern, sets[i], usets[i], words * sizeof(uint32_t));
+		if(res){
+			*err = res;
+			n = -1;
+			break;
+		}
+	}
+
+ out_set:
+	pollset_cleanup(&set);
+ out:
+	if(sets[0] != small)
+		kfree(sets[0]);
+	return n;
+}
+
+int sys_select(int nfds, userptr_t readfds, userptr_t writefds,
+		userptr_t exceptfds, userptr_t timeout, int *err){
+	return do_select(nfds, readfds, writefds, exceptfds, timeout, false, err);
+}
+
+int select_kernel(int nfds, uint32_t *readfds, uint32_t *writefds,
+		uint32_t *exceptfds, struct timeval *timeout, int *err){
+	return do_select(nfds, (userptr_t)readfds, (userptr_t)writefds,
+			 (userptr_t)exceptfds, (userptr_t)timeout, true, err);
+}
+
+/*
+ * Process P is exiting: get its threads out of poll and select.
+ * Called after setting p_exiting.
+ */
+void poll_exit(struct proc *p){
+	struct pollwait *pw;
+
+	spinlock_acquire(&p->p_lock);
+	for(pw = p->p_polls; pw != NULL; pw = pw->pw_next)
+		pollwait_interrupt(pw);
+	spinlock_release(&p->p_lock);
+}
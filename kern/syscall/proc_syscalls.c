@@ -14,56 +14,107 @@
 #include <current.h>
 #include <kern/errno.h>
 #include <kern/wait.h>
+#include <ipc.h>
+#include <rcu.h>
 #include <mips/trapframe.h>
 #include "opt-shell.h"
 
 
+/*
+ * Detach the current thread from P and exit. Called with P's lock
+ * held. The last thread out is the one that reports the process as
+ * exited, so the parent can't destroy it under the others.
+ */
+static void proc_thread_leave(struct proc *p){
+
+	ipc_thread_exit();
+
+	if(p->p_vfork){
+		//a vfork child that never got to execv: give the parent back
+		//its as before it wakes up, and so proc_destroy won't free it
+		proc_setas(NULL);
+		as_deactivate();
+		p->p_vfork = 0;
+		cv_broadcast(p->cv, p->lock);
+	}
+
+	if(curthread->t_proc != NULL)
+		proc_remthread(curthread);
+
+	if(p->p_numthreads == 0){
+		//close the files now, not when the parent gets round to
+		//waitpid: the other end of a pipe must see EOF right away
+		fd_closeall(p);
+		p->exited = 1; //exited flag set
+		cv_broadcast(p->cv, p->lock);
+	}
+	lock_release(p->lock);
+
+	thread_exit();
+}
+
 void sys__exit(int status){
   
     struct proc *p = curproc;
-	struct thread *cur = curthread;
-	
-	if(cur->t_proc !=NULL)
-		proc_remthread(cur);
 
     lock_acquire(p->lock);
-	p->exited = 1; //exited flag set
-	p->status = _MKWAIT_EXIT(status); 
-	cv_broadcast(p->cv, p->lock);
-	lock_release(p->lock);	
-
-	thread_exit();
+	if(!p->p_exiting){
+		//first thread out sets the status, the others follow it
+		p->p_exiting = 1;
+		p->status = _MKWAIT_EXIT(status); 
+		cv_broadcast(p->cv, p->lock); //wake up anyone in thread_join
+		ipc_endpoint_close(p->p_ipc); //...or in ipc_recv
+		futex_exit(p); //...or in futex_wait
+		poll_exit(p); //...or in poll/select
+	}
+	proc_thread_leave(p);
 
 	panic("thread_exit returned (should not happen)\n");
 }
 
+/*
+ * Called on the way back to user mode. If another thread of the
+ * process has called _exit, don't go back; exit this thread too.
+ */
+void uthread_exitcheck(void){
+
+	struct proc *p = curproc;
+
+	if(p == NULL || !p->p_exiting)
+		return;
+
+	lock_acquire(p->lock);
+	proc_thread_leave(p);
+}
+
 
 pid_t sys_waitpid(pid_t pid,int *status, int options, int* err){
 	
 	struct proc *p;
 	int ret;
 
-	if(pid < 0 || pid >= PID_MAX){
-		*err = ESRCH;
-		return -1;
-	}
-
 	if(options != 0){
 		*err = EINVAL;
 		return -1;
 	}
 
+	//only the parent destroys a child, so once we know we are its
+	//parent p stays valid after the read section
+	rcu_read_lock();
 	p = get_proc(pid);
    
-	if(p == NULL || p->pid != pid){
+	if(p == NULL){
+		rcu_read_unlock();
 		*err = ESRCH;
 		return -1;
 	}
 
 	if(curproc->pid != p->p_pid){
+		rcu_read_unlock();
 		*err = ECHILD;
 		return -1;
 	}
+	rcu_read_unlock();
 	
 	ret = proc_wait(p);
 	
@@ -90,6 +141,7 @@ pid_t sys_getppid(){
 
 static void call_enter_forked_process(void *tfv, unsigned long dummy) {
 	struct trapframe *tf = (struct trapframe *)tfv;
+	curthread->t_uthread = curproc->p_uthreads; //NULL unless forked by a thread
 	enter_forked_process(tf);
 	(void) dummy;
 	panic("enter_forked_process returned (should not happen)\n");
@@ -97,9 +149,9 @@ static void call_enter_forked_process(void *tfv, unsigned long dummy) {
 
 
 int sys_fork(pid_t *child_pid, struct trapframe *ptf, int* err) {
-	struct process_table *pt;
 	struct trapframe *child_tf;
 	struct proc *newpr;
+	struct uthread *ut, *self = curthread->t_uthread;
 	
 	int res;
 
@@ -116,34 +168,44 @@ int sys_fork(pid_t *child_pid, struct trapframe *ptf, int* err) {
 		return -1;
 	}
 
+	lock_acquire(curproc->lock); //keep the other threads from changing the stacks
 	as_copy(curproc->p_addrspace, &(newpr->p_addrspace));
 	if(newpr->p_addrspace == NULL){
+		lock_release(curproc->lock);
 		proc_destroy(newpr);
 		*err = ENOMEM;
 		return -1;
 	}
 
-	for(int i = 0; i < OPEN_MAX;i++){ //Since it's a fork, we have to copy all the previous file opened by parent
-		if(curproc->process_file_table[i] != NULL){
-			if(newpr->process_file_table[i] != NULL){
-				kfree(newpr->process_file_table[i]);
-				newpr->process_file_table[i] = NULL;
-			}
+	if(self != NULL){
+		//the child only gets the calling thread, drop the others' stacks
+		for(ut = curproc->p_uthreads; ut != NULL; ut = ut->ut_next){
+			if(ut != self && !ut->ut_exited && ut->ut_slot >= 0)
+				as_release_thread_stack(newpr->p_addrspace, ut->ut_slot);
+		}
 
-			pt = curproc->process_file_table[i];
-			newpr->process_file_table[i] = pt;
-			if(newpr->process_file_table[i]->of_ref != NULL){
-				lock_acquire(newpr->process_file_table[i]->of_ref->p_lock);
-				VOP_INCREF(newpr->process_file_table[i]->of_ref->vn);
-				newpr->process_file_table[i]->of_ref->of_pointercount++;
-				lock_release(newpr->process_file_table[i]->of_ref->p_lock);
-			}
+		ut = kmalloc(sizeof(struct uthread));
+		if(ut == NULL){
+			lock_release(curproc->lock);
+			proc_destroy(newpr);
+			*err = ENOMEM;
+			return -1;
 		}
-	}	
+		ut->ut_tid = newpr->p_nexttid++;
+		ut->ut_slot = self->ut_slot;
+		ut->ut_exited = 0;
+		ut->ut_joined = 0;
+		ut->ut_retval = 0;
+		ut->ut_next = NULL;
+		newpr->p_uthreads = ut;
+	}
+	lock_release(curproc->lock);
 
-	newpr->cnt_open = curproc->cnt_open;
-	newpr->last_fd = curproc->last_fd;
-  
+	//Since it's a fork, the child gets all the files opened by the parent
+	if(fd_copy(newpr, curproc, err)){
+		proc_destroy(newpr);
+		return -1;
+	}
 
 	child_tf = kmalloc(sizeof(struct trapframe)); 
 	if(child_tf == NULL){
@@ -169,230 +231,736 @@ int sys_fork(pid_t *child_pid, struct trapframe *ptf, int* err) {
 }
 
 
-static int args_userToKernel(int argc, char **args, int *size, char **kargs){
-	int rem_size = ARG_MAX; //max bytes for all the arguments 
-	size_t sz; //current size
-	int ret,i,j=-1;
-	char next_char;
-	int error = 0;
-	size_t *len;
+/*
+ * Arguments of an execv or spawn, on their way into the new image.
+ *
+ * The strings are packed back to back, NUL-terminated, at the start
+ * of ka_buf. When they're copied out, the argv array goes right after
+ * them in the same buffer, and the whole lot goes onto the new stack
+ * with a single copyout. So the strings and the array together have to
+ * fit in ARG_MAX, which is also the limit execv enforces.
+ *
+ * The buffers are big (ARG_MAX), so a few are kept in a pool instead of
+ * going back to kmalloc after every exec.
+ */
+#define KARGS_POOLMAX 4 //buffers kept in the pool
+
+struct kargs{
+	char ka_path[PATH_MAX+1]; //the program
+	char *ka_buf;             //ARG_MAX bytes: the strings, then argv
+	size_t ka_len;            //bytes of strings in ka_buf
+	int ka_argc;
+	struct kargs *ka_next;    //pool link
+};
+
+static struct kargs *kargs_pool = NULL;
+static unsigned kargs_npool = 0;
+static struct spinlock kargs_lock = SPINLOCK_INITIALIZER;
+
+//Bytes the strings and the argv array take together.
+#define KARGS_SIZE(len, argc) \
+	(ROUNDUP((len), sizeof(userptr_t)) + ((argc) + 1) * sizeof(userptr_t))
+
+static struct kargs *kargs_get(void){
+	struct kargs *ka;
+
+	spinlock_acquire(&kargs_lock);
+	ka = kargs_pool;
+	if(ka != NULL){
+		kargs_pool = ka->ka_next;
+		kargs_npool--;
+	}
+	spinlock_release(&kargs_lock);
+
+	if(ka == NULL){
+		ka = kmalloc(sizeof(struct kargs));
+		if(ka == NULL)
+			return NULL;
+		ka->ka_buf = kmalloc(ARG_MAX);
+		if(ka->ka_buf == NULL){
+			kfree(ka);
+			return NULL;
+		}
+	}
+	ka->ka_len = 0;
+	ka->ka_argc = 0;
+	ka->ka_next = NULL;
+	return ka;
+}
+
+static void kargs_put(struct kargs *ka){
+
+	spinlock_acquire(&kargs_lock);
+	if(kargs_npool < KARGS_POOLMAX){
+		ka->ka_next = kargs_pool;
+		kargs_pool = ka;
+		kargs_npool++;
+		ka = NULL;
+	}
+	spinlock_release(&kargs_lock);
 
-	for (i = 0; i < argc; i++) {	
-	
-		do {
-			j++;
-			ret = copyin((const_userptr_t) &args[i][j], (void *) &next_char,(size_t) sizeof(char));
-			if (ret) {
-				error = 1;
-			}
+	if(ka != NULL){
+		kfree(ka->ka_buf);
+		kfree(ka);
+	}
+}
 
-		} while (next_char != 0 && j < rem_size - 1 && error ==0);
+/*
+ * Copy the program name and the arguments of an execv or a spawn into
+ * the kernel. The argv array is read a page's worth at a time, and each
+ * string with one copyinstr straight into place. On success the caller
+ * gives *ka_ret back with kargs_put.
+ */
+#define ARGV_CHUNK 64 //argv entries read per copyin
+
+static int args_copyin(const char *prog, char **args, struct kargs **ka_ret){
+
+	userptr_t argv[ARGV_CHUNK];
+	struct kargs *ka;
+	vaddr_t uaddr;
+	size_t len;
+	unsigned n, i;
+	int ret;
 
-		if (next_char != 0) {
-			return E2BIG;
-		}
-		sz = j;
-		
-		
-		if (error) {
-		 	for (int j = 0; j < i; j++) {
-				kfree(kargs[j]);
-			}
-			return ret;
+	if (prog == NULL || args == NULL) {
+		return EFAULT;
+	}
+
+	ka = kargs_get();
+	if (ka == NULL) {
+		return ENOMEM;
+	}
+
+	//copy 1st param u 2 k
+	ret = copyinstr((const_userptr_t) prog, ka->ka_path, sizeof(ka->ka_path), &len);
+	if (ret) {
+		goto fail;
+	}
+	if (ka->ka_path[0] == 0) {
+		ret = EINVAL;
+		goto fail;
+	}
+
+	uaddr = (vaddr_t) args;
+	while (1) {
+		//don't read past the end of the page: argv may end there
+		n = (PAGE_SIZE - (uaddr & ~PAGE_FRAME)) / sizeof(userptr_t);
+		if (n == 0 || n > ARGV_CHUNK) {
+			n = ARGV_CHUNK;
 		}
-		rem_size -= (sz + 1);
-		size[i] = (int) sz + 1;
-		
-		kargs[i] = kmalloc((sz+1)*sizeof(char));
-   		len = kmalloc(sizeof(int));
-		ret = copyinstr((const_userptr_t) args[i], kargs[i], sz+1, len);
+		ret = copyin((const_userptr_t) uaddr, argv, n * sizeof(userptr_t));
 		if (ret) {
-			kfree(kargs[i]);
-			kfree(len);
-			return ret;
+			goto fail;
 		}
 
-		kfree(len);
+		for (i = 0; i < n; i++) {
+			if (argv[i] == NULL) {
+				*ka_ret = ka;
+				return 0;
+			}
+
+			ret = copyinstr((const_userptr_t) argv[i], ka->ka_buf + ka->ka_len,
+					ARG_MAX - ka->ka_len, &len);
+			if (ret == ENAMETOOLONG) {
+				ret = E2BIG;
+			}
+			if (ret) {
+				goto fail;
+			}
+			ka->ka_len += len;
+			ka->ka_argc++;
 
+			//leave room for argv, including the NULL at the end
+			if (KARGS_SIZE(ka->ka_len, ka->ka_argc) > ARG_MAX) {
+				ret = E2BIG;
+				goto fail;
+			}
+		}
+		uaddr += n * sizeof(userptr_t);
 	}
 
-	return 0;
+ fail:
+	kargs_put(ka);
+	return ret;
 }
 
 
-static void args_kernelToUser(int argc, char **args, userptr_t *uargs, vaddr_t *stack_p, int *size){
-	
-	size_t *len;
-	
-	userptr_t arg_p = (userptr_t) (*stack_p - argc*sizeof(userptr_t *) - 4); //string arguments
-	userptr_t *arg_addr_p = (userptr_t *) (*stack_p - argc*sizeof(userptr_t *) - 4); //pointer to the first argument
+/*
+ * Put the arguments on the new stack below *STACK_P: the strings, then
+ * argv pointing at them. Lays out argv behind the strings in ka_buf in
+ * one pass over them and copies the lot out at once. Returns argv's
+ * user address in *UARGS and moves *STACK_P down past it all.
+ */
+static int args_copyout(struct kargs *ka, userptr_t *uargs, vaddr_t *stack_p){
 
-	for (int i = 0; i < argc; i++) {
-		//taking space
-		arg_p -= size[i];
+	userptr_t *argv;
+	vaddr_t base;
+	size_t size, pos;
+	int i, ret;
 
-		//saving pointer
-		*arg_addr_p = arg_p;
-		len = kmalloc(sizeof(int));
+	size = KARGS_SIZE(ka->ka_len, ka->ka_argc);
+	KASSERT(size <= ARG_MAX);
 
-		//copy of the arguments
-		copyoutstr(args[i], arg_p, size[i], len);
-		kfree(len);
+	//keep the stack 8-byte aligned
+	base = (*stack_p - size) & ~(vaddr_t)7;
 
-		//next pointer
-		arg_addr_p++;
+	argv = (userptr_t *)(ka->ka_buf + ROUNDUP(ka->ka_len, sizeof(userptr_t)));
+	pos = 0;
+	for (i = 0; i < ka->ka_argc; i++) {
+		argv[i] = (userptr_t)(base + pos);
+		pos += strlen(ka->ka_buf + pos) + 1;
 	}
+	argv[i] = NULL;
+	KASSERT(pos == ka->ka_len);
 
-	*arg_addr_p = NULL;
-	//beginning of user stack arguments 
-	*uargs = (userptr_t) (*stack_p - argc*sizeof(int) - 4);
+	ret = copyout(ka->ka_buf, (userptr_t) base, size);
+	if (ret) {
+		return ret;
+	}
 
-	//align and return SP
-	arg_p -= (int) arg_p % 4;
-	*stack_p = (vaddr_t) arg_p;
+	*uargs = (userptr_t)(base + ROUNDUP(ka->ka_len, sizeof(userptr_t)));
+	*stack_p = base;
+	return 0;
 }
 
 
-static void free_array(int argc, int *size, char **kargs)
-{
-	for (int i = 0; i < argc; i++) {
-		kfree(kargs[i]);
+/*
+ * Load the program KA names into a new address space for the current
+ * process and put the arguments on its stack. On success, returns
+ * where to start it; the old address space has been destroyed or, for
+ * a vfork child, handed back to the parent. On failure the old one is
+ * still in place.
+ */
+static int exec_load(struct kargs *ka, vaddr_t *entrypoint, vaddr_t *stackptr,
+		userptr_t *uargs){
+
+	struct proc *p = curproc;
+	struct vnode *v;
+	struct addrspace *as_old;
+	struct addrspace *as_new;
+	int ret;
+
+	ret = vfs_open(ka->ka_path, O_RDONLY, 0, &v);
+	if (ret) {
+		return ret;
+	}
+
+	as_new = as_create();
+	if (as_new == NULL) {
+		vfs_close(v);
+		return ENOMEM;
 	}
 
-	kfree(size);
-	kfree(kargs);
+	//switch as, keeping the old one until the new image is loaded
+	as_old = proc_getas();
+	proc_setas(NULL);
+	as_deactivate();
+	proc_setas(as_new);
+	as_activate();
+
+	ret = load_elf(v, entrypoint);
+	if (ret == 0) {
+		//take new user SP 
+		ret = as_define_stack(as_new, stackptr);
+	}
+	vfs_close(v);
+	if (ret == 0) {
+		//copy from kernel to the user stack	
+		ret = args_copyout(ka, uargs, stackptr);
+	}
+
+	if (ret) {
+		proc_setas(NULL);
+		as_deactivate();
+		proc_setas(as_old);
+		as_activate();
+		as_destroy(as_new);
+		return ret;
+	}
+
+	//the new image starts on the main stack
+	if (curthread->t_uthread != NULL) {
+		curthread->t_uthread->ut_slot = -1;
+	}
+
+	//a vfork child borrowed the old as: give it back and let the parent go
+	lock_acquire(p->lock);
+	if (p->p_vfork) {
+		p->p_vfork = 0;
+		as_old = NULL;
+		cv_broadcast(p->cv, p->lock);
+	}
+	lock_release(p->lock);
+
+	if (as_old != NULL) {
+		as_destroy(as_old);
+	}
+	return 0;
 }
 
 
 int sys_execv(const char *prog, char **args){
 	
-	char *next_arg;
-	char *progname;
-	char **kargs;
+	struct kargs *ka;
 	int ret;
-	int i = 0;
 	int argc;
-	size_t *len;
-	int *size;
-	struct vnode *v;
 	userptr_t uargs;
 	vaddr_t entrypoint, stackptr;
-	struct addrspace *as_old;
-	struct addrspace *as_new;
-	
 
-	if (prog == NULL || args == NULL) {
-		return EFAULT;
+	//the other threads would be left running in the old image
+	if (curproc->p_numthreads > 1) {
+		return EBUSY;
 	}
 
-	//copy 1st param u 2 k
-	len = kmalloc(sizeof(int));
-	progname = kmalloc((PATH_MAX+1)*sizeof(char));
-   
-	ret = copyinstr((const_userptr_t) prog, progname,PATH_MAX+1, len);
+	ret = args_copyin(prog, args, &ka);
 	if (ret) {
-		kfree(progname);
-		kfree(len);
 		return ret;
 	}
 
-	kfree(len);
+	ret = exec_load(ka, &entrypoint, &stackptr, &uargs);
+	argc = ka->ka_argc;
+	kargs_put(ka);
+
+	if (ret) {
+		return ret;
+	}
 
+	enter_new_process(argc, uargs, NULL, stackptr, entrypoint);
 	
-	if (strcmp(prog, "") == 0) {
+	panic("enter_new_process returned\n");
+	return EINVAL;
+}
+
+
+/*
+ * vfork: like fork, but the child runs in our address space instead of
+ * a copy of it, and we sleep until the child calls execv or exits, so
+ * starting a program costs the same however big we are. Until then
+ * the child must not return from the function that called vfork, and
+ * can't create threads.
+ */
+int sys_vfork(pid_t *child_pid, struct trapframe *ptf, int *err){
+	struct trapframe *child_tf;
+	struct proc *newpr;
+	int res;
+
+	KASSERT(curproc != NULL);
+
+	if(get_numproc() >= PID_MAX){
+		*err = ENPROC;
+		return -1;
+	}
+
+	newpr = proc_create_runprogram(curproc->p_name);//inherit the cwd of the curproc
+	if (newpr == NULL) {
+		*err = ENOMEM;
+		return -1;
+	}
+
+	//the child still gets its own copy of the descriptor table
+	if(fd_copy(newpr, curproc, err)){
+		proc_destroy(newpr);
+		return -1;
+	}
+
+	child_tf = kmalloc(sizeof(struct trapframe)); 
+	if(child_tf == NULL){
+		proc_destroy(newpr);
+		*err = ENOMEM;
+		return -1;
+	}
+	memcpy(child_tf, ptf, sizeof(struct trapframe)); //copying tf from parent
+	newpr->p_pid = curproc->pid;
+
+	//lend the child our as; it runs on our stack, which is fine as we're asleep
+	newpr->p_addrspace = proc_getas();
+	newpr->p_vfork = 1;
+
+	res = thread_fork(curthread->t_name, newpr, call_enter_forked_process, (void *)child_tf, (unsigned long)0);
+
+	if (res){
+		newpr->p_addrspace = NULL;
+		newpr->p_vfork = 0;
+		proc_destroy(newpr);
+		kfree(child_tf);
+		*err = ENOMEM;
+		return -1;
+	}
+
+	//only we destroy the child, so newpr stays valid while we wait
+	lock_acquire(newpr->lock);
+	while(newpr->p_vfork){
+		cv_wait(newpr->cv, newpr->lock);
+	}
+	lock_release(newpr->lock);
+
+	*child_pid = newpr->pid;
+
+	return 0;
+}
+
+
+/*
+ * spawn: start PROG with ARGS in a new process, as fork followed by
+ * execv would, but without copying our address space at all.
+ *
+ * If FDS is NULL the child gets all our descriptors. Otherwise it gets
+ * NFDS of them: its descriptor i is our FDS[i], or closed if FDS[i] is
+ * negative.
+ *
+ * The child loads the program itself, since load_elf works on the
+ * current address space. We wait until it has, so that a program
+ * that can't be loaded fails the spawn instead of the child.
+ */
+
+struct spawn_start{
+	struct kargs *ka;
+	int result;              //0 once the program is loaded, or why it wasn't
+	struct semaphore *done;  //V'd when result is set
+};
+
+static void spawn_child(void *data, unsigned long dummy){
+	struct spawn_start *ss = data;
+	vaddr_t entrypoint, stackptr;
+	userptr_t uargs;
+	int argc = ss->ka->ka_argc;
+	int res;
+
+	(void)dummy;
+
+	res = exec_load(ss->ka, &entrypoint, &stackptr, &uargs);
+
+	//ss belongs to the parent again once we let it go
+	ss->result = res;
+	V(ss->done);
+
+	if(res){
+		sys__exit(res);
+	}
+
+	enter_new_process(argc, uargs, NULL, stackptr, entrypoint);
+	panic("enter_new_process returned\n");
+}
+
+//Give the child P our descriptors FDS[0..NFDS-1], as its 0..NFDS-1.
+static int spawn_fds(struct proc *p, const int *fds, int nfds){
+	struct process_table *pt;
+	int *kfds;
+	int i, res;
+
+	if(nfds < 0 || nfds > FD_LIMIT)
 		return EINVAL;
+
+	//start from nothing, not from the console
+	fd_closeall(p);
+	if(nfds == 0)
+		return 0;
+
+	kfds = kmalloc(nfds * sizeof(int));
+	if(kfds == NULL)
+		return ENOMEM;
+	res = copyin((const_userptr_t)fds, kfds, nfds * sizeof(int));
+	if(res){
+		kfree(kfds);
+		return res;
 	}
 
-	//calculate argc
-	do {
-		i++;
-		ret = copyin((const_userptr_t) &args[i], (void *) &next_arg, (size_t) sizeof(char *));
-		if (ret) {
-			return ret;
+	for(i = 0; i < nfds; i++){
+		if(kfds[i] < 0)
+			continue;
+
+		//the reference fd_get takes becomes the child's
+		pt = fd_get(curproc, kfds[i]);
+		if(pt == NULL){
+			res = EBADF;
+			break;
+		}
+		if(fd_install(p, i, pt, &res) < 0){
+			openfile_release(pt);
+			break;
 		}
+		res = 0;
+	}
+
+	kfree(kfds);
+	return res;
+}
 
-	} while (next_arg != NULL && i < ARG_MAX); 
+pid_t sys_spawn(const char *prog, char **args, const int *fds, int nfds, int *err){
+	struct spawn_start ss;
+	struct proc *newpr;
+	pid_t pid;
+	int res;
 
-	if (next_arg != NULL) {
-		return E2BIG;
+	KASSERT(curproc != NULL);
+
+	if(get_numproc() >= PID_MAX){
+		*err = ENPROC;
+		return -1;
 	}
 
-	argc = i;
-	
-	//copy arguments to kernel 
-	kargs = kmalloc(argc*sizeof(char *));
-	size = kmalloc(argc*sizeof(int));
-	ret = args_userToKernel(argc, args,size, kargs);
-	if (ret) {
-		kfree(kargs);
-		kfree(size);
-		kfree(progname);
-		return ret;
+	res = args_copyin(prog, args, &ss.ka);
+	if(res){
+		*err = res;
+		return -1;
 	}
-	
-	ret = vfs_open(progname, O_RDONLY, 0, &v);
-	if (ret) {
-		kfree(progname);
-		free_array(argc, size, kargs);
-		return ret;
+
+	ss.result = 0;
+	ss.done = sem_create("spawn", 0);
+	if(ss.done == NULL){
+		res = ENOMEM;
+		goto out;
 	}
 
-	as_old = proc_getas();
-	as_new = as_create();
-	if (as_new == NULL) {
-		vfs_close(v);
-		kfree(progname);
-		free_array(argc, size, kargs);
-		return ENOMEM;
+	newpr = proc_create_runprogram(ss.ka->ka_path);//inherit the cwd of the curproc
+	if(newpr == NULL){
+		res = ENOMEM;
+		goto out;
 	}
 
-	//destroy old as and switch as
-	as_destroy(as_old);
-	proc_setas(NULL);
-	as_deactivate();
-	proc_setas(as_new);
-	as_activate();
+	res = 0;
+	if(fds == NULL)
+		fd_copy(newpr, curproc, &res); //sets res on failure
+	else
+		res = spawn_fds(newpr, fds, nfds);
+	if(res){
+		proc_destroy(newpr);
+		goto out;
+	}
+	newpr->p_pid = curproc->pid;
 
-	ret = load_elf(v, &entrypoint);
-	if (ret) {
+	res = thread_fork(curthread->t_name, newpr, spawn_child, &ss, 0);
+	if(res){
+		proc_destroy(newpr);
+		goto out;
+	}
 
-		proc_setas(NULL);
-		as_deactivate();
-		proc_setas(as_old);
-		as_activate();
-		as_destroy(as_new);
-		vfs_close(v);
-		kfree(progname);
-		free_array(argc, size, kargs);
-		return ret;
+	P(ss.done);
+	res = ss.result;
+	pid = newpr->pid;
+	if(res){
+		//the child is on its way out and closes its descriptors itself
+		proc_wait(newpr);
 	}
 
-	//take new user SP 
-	ret = as_define_stack(as_new, &stackptr);
-	if (ret) {
-		proc_setas(NULL);
-		as_deactivate();
-		proc_setas(as_old);
-		as_activate();
-		as_destroy(as_new);
-		vfs_close(v);
-		kfree(progname);
-		free_array(argc, size, kargs);
-		return ret;
+ out:
+	if(ss.done != NULL)
+		sem_destroy(ss.done);
+	kargs_put(ss.ka);
+	if(res){
+		*err = res;
+		return -1;
 	}
+	return pid;
+}
 
-	vfs_close(v);
 
-	//copy from kernel to the user stack	
-	args_kernelToUser(argc, kargs, &uargs , &stackptr ,size);
+/*
+ * User threads. They share the address space and the file table of
+ * the process; each one gets its own user stack from the VM system.
+ */
 
-	kfree(progname);
-	free_array(argc, size, kargs);
+struct uthread_start{
+	vaddr_t entry;      //user function to start at
+	vaddr_t arg;        //its argument
+	vaddr_t stackptr;   //top of the thread's user stack
+	struct uthread *ut; //the thread's record
+};
 
-	enter_new_process(argc, uargs, NULL, stackptr, entrypoint);
-	
+static void uthread_start(void *data, unsigned long dummy){
+	struct uthread_start start = *(struct uthread_start *)data;
+
+	kfree(data);
+	(void)dummy;
+
+	curthread->t_uthread = start.ut;
+
+	//in case the process started exiting before we got going
+	uthread_exitcheck();
+
+	//the argument goes in a0, which is where enter_new_process puts argc
+	enter_new_process((int)start.arg, NULL, NULL, start.stackptr, start.entry);
 	panic("enter_new_process returned\n");
-	return EINVAL;
+}
+
+static struct uthread *uthread_create(int slot){
+	struct uthread *ut;
+
+	ut = kmalloc(sizeof(struct uthread));
+	if(ut == NULL)
+		return NULL;
+
+	ut->ut_tid = 0;
+	ut->ut_slot = slot;
+	ut->ut_exited = 0;
+	ut->ut_joined = 0;
+	ut->ut_retval = 0;
+	ut->ut_next = NULL;
+	return ut;
+}
+
+/*
+ * Start a new thread at ENTRY(ARG). ENTRY must not return; it should
+ * end with thread_exit (the C library wrapper arranges this). Returns
+ * the new thread's id.
+ */
+int sys_thread_create(userptr_t entry, userptr_t arg, int *err){
+
+	struct proc *p = curproc;
+	struct uthread *ut, *self = NULL;
+	struct uthread_start *start;
+	vaddr_t stackptr;
+	int slot, tid, res;
+
+	ut = uthread_create(-1);
+	start = kmalloc(sizeof(struct uthread_start));
+	if(curthread->t_uthread == NULL){
+		//first extra thread, the initial thread gets a record too
+		self = uthread_create(-1);
+	}
+	if(ut == NULL || start == NULL || (curthread->t_uthread == NULL && self == NULL)){
+		*err = ENOMEM;
+		goto fail;
+	}
+
+	lock_acquire(p->lock);
+
+	if(p->p_exiting){
+		lock_release(p->lock);
+		*err = EINTR;
+		goto fail;
+	}
+
+	if(p->p_vfork){
+		//the as isn't ours to hand out stacks from
+		lock_release(p->lock);
+		*err = EINVAL;
+		goto fail;
+	}
+
+	res = as_define_thread_stack(p->p_addrspace, &slot, &stackptr);
+	if(res){
+		lock_release(p->lock);
+		*err = res;
+		goto fail;
+	}
+
+	ut->ut_slot = slot;
+	start->entry = (vaddr_t)entry;
+	start->arg = (vaddr_t)arg;
+	start->stackptr = stackptr;
+	start->ut = ut;
+
+	//the new thread is counted in p_numthreads before we let go of the lock
+	res = thread_fork(curthread->t_name, p, uthread_start, start, 0);
+	if(res){
+		as_release_thread_stack(p->p_addrspace, slot);
+		lock_release(p->lock);
+		*err = res;
+		goto fail;
+	}
+
+	if(self != NULL){
+		self->ut_tid = p->p_nexttid++;
+		self->ut_next = p->p_uthreads;
+		p->p_uthreads = self;
+		curthread->t_uthread = self;
+	}
+	tid = ut->ut_tid = p->p_nexttid++;
+	ut->ut_next = p->p_uthreads;
+	p->p_uthreads = ut;
+
+	lock_release(p->lock);
+	return tid;
+
+ fail:
+	kfree(ut);
+	kfree(start);
+	kfree(self);
+	return -1;
+}
+
+/*
+ * Exit the current thread. If it's the last one, the whole process
+ * exits, with status 0.
+ */
+void sys_thread_exit(int value){
+
+	struct proc *p = curproc;
+	struct uthread *ut = curthread->t_uthread;
+
+	lock_acquire(p->lock);
+	if(!p->p_exiting){
+		if(p->p_numthreads == 1){
+			p->p_exiting = 1;
+			p->status = _MKWAIT_EXIT(0);
+		}
+		else{
+			KASSERT(ut != NULL);
+			ut->ut_exited = 1;
+			ut->ut_retval = value;
+			if(ut->ut_slot >= 0)
+				as_release_thread_stack(p->p_addrspace, ut->ut_slot);
+			cv_broadcast(p->cv, p->lock);
+		}
+	}
+	proc_thread_leave(p);
+
+	panic("thread_exit returned (should not happen)\n");
+}
+
+/*
+ * Wait for thread TID of the current process to exit and collect the
+ * value it passed to thread_exit. Each thread can be joined once.
+ */
+int sys_thread_join(int tid, userptr_t retval, int *err){
+
+	struct proc *p = curproc;
+	struct uthread *ut, **utp;
+	int value;
+
+	lock_acquire(p->lock);
+
+	for(ut = p->p_uthreads; ut != NULL; ut = ut->ut_next){
+		if(ut->ut_tid == tid)
+			break;
+	}
+	if(ut == NULL){
+		lock_release(p->lock);
+		*err = ESRCH;
+		return -1;
+	}
+	if(ut == curthread->t_uthread || ut->ut_joined){
+		lock_release(p->lock);
+		*err = EINVAL;
+		return -1;
+	}
+
+	ut->ut_joined = 1;
+	while(!ut->ut_exited && !p->p_exiting){
+		cv_wait(p->cv, p->lock);
+	}
+	if(!ut->ut_exited){
+		//the process is exiting, we'll go on the way out
+		ut->ut_joined = 0;
+		lock_release(p->lock);
+		*err = EINTR;
+		return -1;
+	}
+
+	for(utp = &p->p_uthreads; *utp != ut; utp = &(*utp)->ut_next)
+		;
+	*utp = ut->ut_next;
+	value = ut->ut_retval;
+	lock_release(p->lock);
+	kfree(ut);
+
+	if(retval != NULL){
+		*err = copyout(&value, retval, sizeof(value));
+		if(*err)
+			return -1;
+	}
+	return 0;
 }
 
 #endif
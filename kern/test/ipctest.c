@@ -0,0 +1,143 @@
+/*
+ * IPC test.
+ *
+ * A client and a server thread on the same cpu play ping-pong with
+ * ipc_call and ipc_replyrecv. Checks every reply and reports the
+ * average round trip time, which should be about the cost of two
+ * context switches.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <synch.h>
+#include <ipc.h>
+#include <test.h>
+
+#define NCALLS		10000
+
+static struct ipc_endpoint *ipct_ep;
+static struct semaphore *ipct_donesem;
+static volatile unsigned ipct_failures;
+
+/*
+ * Server: answer each message with its first register plus one,
+ * until told to stop (mr[0] == 0).
+ */
+static
+void
+ipct_server(void *junk, unsigned long num)
+{
+	struct ipc_msg msg;
+	pid_t from;
+	int result;
+
+	(void)junk;
+	(void)num;
+
+	result = ipc_recv(ipct_ep, &msg, &from);
+	while (result == 0 && msg.mr[0] != 0) {
+		msg.mr[1]++;
+		result = ipc_replyrecv(ipct_ep, &msg, &from);
+	}
+	if (result) {
+		kprintf("ipc server: %s\n", strerror(result));
+		ipct_failures++;
+	}
+	else {
+		ipc_reply(&msg);
+	}
+
+	ipc_thread_exit();
+	V(ipct_donesem);
+}
+
+static
+void
+ipct_client(void *junk, unsigned long num)
+{
+	struct ipc_msg msg;
+	uint64_t start, ns;
+	unsigned i;
+	int result;
+
+	(void)junk;
+	(void)num;
+
+	start = gettime_ns();
+	for (i=0; i<NCALLS; i++) {
+		msg.mr[0] = 1;
+		msg.mr[1] = i;
+		result = ipc_call(ipct_ep, &msg, 0);
+		if (result) {
+			kprintf("ipc client: call %u: %s\n", i, strerror(result));
+			ipct_failures++;
+			break;
+		}
+		if (msg.mr[1] != i + 1) {
+			kprintf("ipc client: call %u: got %u back\n",
+				i, msg.mr[1]);
+			ipct_failures++;
+			break;
+		}
+	}
+	ns = gettime_ns() - start;
+
+	kprintf("%u calls, %llu ns per round trip\n", i,
+		(unsigned long long)(i > 0 ? ns / i : 0));
+
+	/* Stop the server */
+	msg.mr[0] = 0;
+	ipc_call(ipct_ep, &msg, 0);
+
+	ipc_thread_exit();
+	V(ipct_donesem);
+}
+
+int
+ipctest(int nargs, char **args)
+{
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	if (ipct_donesem == NULL) {
+		ipct_donesem = sem_create("ipct_donesem", 0);
+		if (ipct_donesem == NULL) {
+			panic("ipctest: sem_create failed\n");
+		}
+	}
+	ipct_ep = ipc_endpoint_create();
+	if (ipct_ep == NULL) {
+		panic("ipctest: ipc_endpoint_create failed\n");
+	}
+	ipct_failures = 0;
+
+	kprintf("Starting IPC test...\n");
+
+	/* Put both on our cpu so the calls hand off directly. */
+	result = thread_fork_oncpu("ipct_server", NULL, curcpu->c_self,
+				   ipct_server, NULL, 0);
+	if (result) {
+		panic("ipctest: thread_fork failed: %s\n", strerror(result));
+	}
+	result = thread_fork_oncpu("ipct_client", NULL, curcpu->c_self,
+				   ipct_client, NULL, 0);
+	if (result) {
+		panic("ipctest: thread_fork failed: %s\n", strerror(result));
+	}
+
+	P(ipct_donesem);
+	P(ipct_donesem);
+
+	ipc_endpoint_close(ipct_ep);
+	ipc_endpoint_release(ipct_ep);
+	ipct_ep = NULL;
+
+	kprintf("IPC test %s.\n", ipct_failures > 0 ? "FAILED" : "done");
+	return 0;
+}
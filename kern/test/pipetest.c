@@ -0,0 +1,247 @@
+/*
+ * Pipe test.
+ *
+ * A writer thread pushes a pattern through a pipe in chunks of odd
+ * sizes and a reader thread checks it, reading in chunks of other
+ * sizes, so the copies wrap around the ring at every possible point.
+ * Then the writer closes its end and the reader must see EOF, and a
+ * write with the read end closed must fail with EPIPE. Last, a process
+ * holding the write end exits without closing it, and the reader must
+ * see EOF all the same.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <clock.h>
+#include <uio.h>
+#include <thread.h>
+#include <synch.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <pipe.h>
+#include <proc.h>
+#include <syscall.h>
+#include <test.h>
+#include "opt-shell.h"
+
+#define PT_BYTES	(1024 * 1024)
+
+static struct vnode *pt_rvn, *pt_wvn;
+static struct semaphore *pt_donesem;
+static volatile unsigned pt_failures;
+
+static
+unsigned char
+pt_byte(unsigned pos)
+{
+	return (pos * 7 + pos / 251) & 0xff;
+}
+
+static
+void
+pt_writer(void *junk, unsigned long num)
+{
+	unsigned char buf[700];
+	struct iovec iov;
+	struct uio u;
+	unsigned pos, len, i;
+	int result;
+
+	(void)junk;
+	(void)num;
+
+	for (pos = 0; pos < PT_BYTES; pos += len) {
+		len = 1 + (pos / 3) % sizeof(buf);
+		if (len > PT_BYTES - pos) {
+			len = PT_BYTES - pos;
+		}
+		for (i=0; i<len; i++) {
+			buf[i] = pt_byte(pos + i);
+		}
+		uio_kinit(&iov, &u, buf, len, 0, UIO_WRITE);
+		result = VOP_WRITE(pt_wvn, &u);
+		if (result || u.uio_resid != 0) {
+			kprintf("pipetest: write at %u: %s\n", pos,
+				result ? strerror(result) : "short write");
+			pt_failures++;
+			break;
+		}
+	}
+
+	vfs_close(pt_wvn);
+	V(pt_donesem);
+}
+
+static
+void
+pt_reader(void *junk, unsigned long num)
+{
+	unsigned char buf[1000];
+	struct iovec iov;
+	struct uio u;
+	unsigned pos, want, got, i;
+	int result;
+
+	(void)junk;
+	(void)num;
+
+	pos = 0;
+	while (1) {
+		want = 1 + (pos / 5) % sizeof(buf);
+		uio_kinit(&iov, &u, buf, want, 0, UIO_READ);
+		result = VOP_READ(pt_rvn, &u);
+		if (result) {
+			kprintf("pipetest: read at %u: %s\n", pos,
+				strerror(result));
+			pt_failures++;
+			break;
+		}
+		got = want - u.uio_resid;
+		if (got == 0) {
+			/* EOF */
+			break;
+		}
+		for (i=0; i<got; i++) {
+			if (buf[i] != pt_byte(pos + i)) {
+				kprintf("pipetest: byte %u: got %u, "
+					"expected %u\n", pos + i, buf[i],
+					pt_byte(pos + i));
+				pt_failures++;
+				break;
+			}
+		}
+		pos += got;
+	}
+	if (pos != PT_BYTES) {
+		kprintf("pipetest: got %u bytes, expected %u\n",
+			pos, PT_BYTES);
+		pt_failures++;
+	}
+
+	V(pt_donesem);
+}
+
+#if OPT_SHELL
+static
+void
+pt_exiter(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	/* Give the reader time to go to sleep */
+	clocksleep(1);
+	sys__exit(0);
+}
+
+/*
+ * Give the write end to a new process whose only thread exits without
+ * closing it. Exiting must close it, or the read below never returns.
+ */
+static
+void
+pt_exittest(void)
+{
+	struct proc *p;
+	struct iovec iov;
+	struct uio u;
+	char c;
+	int result, fd;
+
+	result = pipe_create(&pt_rvn, &pt_wvn);
+	if (result) {
+		panic("pipetest: pipe_create: %s\n", strerror(result));
+	}
+	p = proc_create_runprogram("pt_exiter");
+	if (p == NULL) {
+		panic("pipetest: proc_create_runprogram failed\n");
+	}
+	fd = assign_fd(p, pt_wvn, O_WRONLY, &result);
+	if (fd < 0) {
+		panic("pipetest: assign_fd: %s\n", strerror(result));
+	}
+	result = thread_fork("pt_exiter", p, pt_exiter, NULL, 0);
+	if (result) {
+		panic("pipetest: thread_fork failed: %s\n", strerror(result));
+	}
+
+	uio_kinit(&iov, &u, &c, 1, 0, UIO_READ);
+	result = VOP_READ(pt_rvn, &u);
+	if (result || u.uio_resid != 1) {
+		kprintf("pipetest: read after writer exit: %s\n",
+			result ? strerror(result) : "got data, expected EOF");
+		pt_failures++;
+	}
+	proc_wait(p);
+	vfs_close(pt_rvn);
+}
+#endif
+
+int
+pipetest(int nargs, char **args)
+{
+	struct iovec iov;
+	struct uio u;
+	char c = 0;
+	uint64_t start, ns;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	if (pt_donesem == NULL) {
+		pt_donesem = sem_create("pt_donesem", 0);
+		if (pt_donesem == NULL) {
+			panic("pipetest: sem_create failed\n");
+		}
+	}
+	pt_failures = 0;
+
+	kprintf("Starting pipe test...\n");
+
+	result = pipe_create(&pt_rvn, &pt_wvn);
+	if (result) {
+		panic("pipetest: pipe_create: %s\n", strerror(result));
+	}
+
+	start = gettime_ns();
+	result = thread_fork("pt_writer", NULL, pt_writer, NULL, 0);
+	if (result) {
+		panic("pipetest: thread_fork failed: %s\n", strerror(result));
+	}
+	result = thread_fork("pt_reader", NULL, pt_reader, NULL, 0);
+	if (result) {
+		panic("pipetest: thread_fork failed: %s\n", strerror(result));
+	}
+	P(pt_donesem);
+	P(pt_donesem);
+	ns = gettime_ns() - start;
+	kprintf("%u bytes in %llu ms\n", PT_BYTES,
+		(unsigned long long)(ns / 1000000));
+	vfs_close(pt_rvn);
+
+	/* Writing with nobody to read */
+	result = pipe_create(&pt_rvn, &pt_wvn);
+	if (result) {
+		panic("pipetest: pipe_create: %s\n", strerror(result));
+	}
+	vfs_close(pt_rvn);
+	uio_kinit(&iov, &u, &c, 1, 0, UIO_WRITE);
+	result = VOP_WRITE(pt_wvn, &u);
+	if (result != EPIPE) {
+		kprintf("pipetest: write to closed pipe: got %s, "
+			"expected EPIPE\n", strerror(result));
+		pt_failures++;
+	}
+	vfs_close(pt_wvn);
+
+#if OPT_SHELL
+	/* The writer exits without closing */
+	pt_exittest();
+#endif
+
+	kprintf("Pipe test %s.\n", pt_failures > 0 ? "FAILED" : "done");
+	return 0;
+}
@@ -0,0 +1,225 @@
+/*
+ * Poll test.
+ *
+ * Checks pipe readiness through VOP_POLL and the pollwait sleep: an
+ * empty pipe isn't readable, a wait on it times out, a write from
+ * another thread wakes the poller up, and closing the write end shows
+ * up as POLLHUP. Then the same again through poll and select proper,
+ * on descriptors, along with the console's.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/poll.h>
+#include <kern/time.h>
+#include <lib.h>
+#include <clock.h>
+#include <uio.h>
+#include <thread.h>
+#include <synch.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <poll.h>
+#include <pipe.h>
+#include <proc.h>
+#include <current.h>
+#include <syscall.h>
+#include <test.h>
+#include "opt-shell.h"
+
+static struct vnode *plt_rvn, *plt_wvn;
+static struct semaphore *plt_donesem;
+static unsigned plt_failures;
+
+static
+void
+plt_check(const char *what, int got, int expected)
+{
+	if (got != expected) {
+		kprintf("polltest: %s: got 0x%x, expected 0x%x\n",
+			what, got, expected);
+		plt_failures++;
+	}
+}
+
+static
+void
+plt_writer(void *junk, unsigned long num)
+{
+	struct iovec iov;
+	struct uio u;
+	char c = 'x';
+	int result;
+
+	(void)junk;
+	(void)num;
+
+	/* Give the poller time to go to sleep */
+	clocksleep(1);
+
+	uio_kinit(&iov, &u, &c, 1, 0, UIO_WRITE);
+	result = VOP_WRITE(plt_wvn, &u);
+	if (result) {
+		kprintf("polltest: write: %s\n", strerror(result));
+		plt_failures++;
+	}
+	V(plt_donesem);
+}
+
+#if OPT_SHELL
+/*
+ * poll and select on a pipe's descriptors and the console's. The
+ * waits with data on the way have a long timeout, which the wakeup
+ * has to cancel.
+ */
+static
+void
+plt_syscalls(void)
+{
+	struct pollfd fds[2];
+	uint32_t rset, wset;
+	struct timeval tv;
+	struct iovec iov;
+	struct uio u;
+	char c;
+	int rfd, wfd, n, err;
+
+	err = pipe_create(&plt_rvn, &plt_wvn);
+	if (err) {
+		panic("polltest: pipe_create: %s\n", strerror(err));
+	}
+	rfd = assign_fd(curproc, plt_rvn, O_RDONLY, &err);
+	if (rfd < 0) {
+		panic("polltest: assign_fd: %s\n", strerror(err));
+	}
+	wfd = assign_fd(curproc, plt_wvn, O_WRONLY, &err);
+	if (wfd < 0) {
+		panic("polltest: assign_fd: %s\n", strerror(err));
+	}
+	KASSERT(rfd < 32 && wfd < 32);
+
+	/* Empty pipe, and the console, which can always be written */
+	fds[0].fd = rfd;
+	fds[0].events = POLLIN;
+	fds[1].fd = 1;
+	fds[1].events = POLLOUT;
+	n = poll_kernel(fds, 2, 0, &err);
+	plt_check("poll, empty", n, 1);
+	plt_check("poll, empty read end", fds[0].revents, 0);
+	plt_check("poll, console", fds[1].revents, POLLOUT);
+	plt_check("console_poll", console_poll(POLLOUT, NULL), POLLOUT);
+
+	/* A write from another thread ends a long wait */
+	n = thread_fork("plt_writer", NULL, plt_writer, NULL, 0);
+	if (n) {
+		panic("polltest: thread_fork failed: %s\n", strerror(n));
+	}
+	fds[0].revents = 0;
+	n = poll_kernel(fds, 1, 60000, &err);
+	plt_check("poll, wait for data", n, 1);
+	plt_check("poll, read end with data", fds[0].revents, POLLIN);
+	P(plt_donesem);
+
+	rset = (uint32_t)1 << rfd;
+	wset = (uint32_t)1 << wfd;
+	tv.tv_sec = 60;
+	tv.tv_usec = 0;
+	n = select_kernel(32, &rset, &wset, NULL, &tv, &err);
+	plt_check("select, with data", n, 2);
+	plt_check("select, read set", rset, (uint32_t)1 << rfd);
+	plt_check("select, write set", wset, (uint32_t)1 << wfd);
+
+	/* Drained, it times out */
+	uio_kinit(&iov, &u, &c, 1, 0, UIO_READ);
+	err = VOP_READ(plt_rvn, &u);
+	plt_check("read", err, 0);
+	rset = (uint32_t)1 << rfd;
+	tv.tv_sec = 0;
+	tv.tv_usec = 20000;
+	n = select_kernel(32, &rset, NULL, NULL, &tv, &err);
+	plt_check("select, drained", n, 0);
+	plt_check("select, drained read set", rset, 0);
+
+	/* No writer left: readable, for EOF */
+	sys_close(wfd, &err);
+	rset = (uint32_t)1 << rfd;
+	n = select_kernel(32, &rset, NULL, NULL, NULL, &err);
+	plt_check("select, after close", n, 1);
+	plt_check("select, read set after close", rset, (uint32_t)1 << rfd);
+	sys_close(rfd, &err);
+}
+#endif
+
+int
+polltest(int nargs, char **args)
+{
+	struct pollent ents[1];
+	struct pollwait pw;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	if (plt_donesem == NULL) {
+		plt_donesem = sem_create("plt_donesem", 0);
+		if (plt_donesem == NULL) {
+			panic("polltest: sem_create failed\n");
+		}
+	}
+	plt_failures = 0;
+
+	kprintf("Starting poll test...\n");
+
+	result = pipe_create(&plt_rvn, &plt_wvn);
+	if (result) {
+		panic("polltest: pipe_create: %s\n", strerror(result));
+	}
+
+	plt_check("empty read end", VOP_POLL(plt_rvn, POLLIN, NULL), 0);
+	plt_check("empty write end", VOP_POLL(plt_wvn, POLLOUT, NULL),
+		  POLLOUT);
+
+	/* Nothing happens: the wait times out */
+	result = pollwait_init(&pw, ents, 1);
+	if (result) {
+		panic("polltest: pollwait_init: %s\n", strerror(result));
+	}
+	result = pollwait_settimeout(&pw, 2);
+	if (result) {
+		panic("polltest: pollwait_settimeout: %s\n", strerror(result));
+	}
+	plt_check("registering", VOP_POLL(plt_rvn, POLLIN, &pw), 0);
+	plt_check("idle wait", pollwait_sleep(&pw), ETIMEDOUT);
+	pollwait_cleanup(&pw);
+
+	/* A write from another thread wakes us */
+	result = pollwait_init(&pw, ents, 1);
+	if (result) {
+		panic("polltest: pollwait_init: %s\n", strerror(result));
+	}
+	plt_check("registering", VOP_POLL(plt_rvn, POLLIN, &pw), 0);
+	result = thread_fork("plt_writer", NULL, plt_writer, NULL, 0);
+	if (result) {
+		panic("polltest: thread_fork failed: %s\n", strerror(result));
+	}
+	plt_check("wait for data", pollwait_sleep(&pw), 0);
+	pollwait_prepare(&pw);
+	plt_check("read end with data", VOP_POLL(plt_rvn, POLLIN, NULL),
+		  POLLIN);
+	P(plt_donesem);
+	pollwait_cleanup(&pw);
+
+	/* No writer left */
+	vfs_close(plt_wvn);
+	plt_check("read end after close", VOP_POLL(plt_rvn, POLLIN, NULL),
+		  POLLIN | POLLHUP);
+	vfs_close(plt_rvn);
+
+#if OPT_SHELL
+	plt_syscalls();
+#endif
+
+	kprintf("Poll test %s.\n", plt_failures > 0 ? "FAILED" : "done");
+	return 0;
+}
@@ -0,0 +1,156 @@
+/*
+ * Real-time scheduling test.
+ *
+ * Starts a handful of periodic real-time threads, each of which does
+ * some busy work every period, alongside a pile of ordinary threads
+ * that do nothing but spin. The real-time threads should meet every
+ * deadline regardless of the background load.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <synch.h>
+#include <test.h>
+
+#define NRTTHREADS	3
+#define NBGTHREADS	8
+#define NJOBS		20
+
+/*
+ * Parameters for the real-time threads, in hardclocks. The densities
+ * add up to 0.75 so they're admissible on one cpu.
+ */
+static const struct {
+	unsigned period;
+	unsigned budget;
+	unsigned deadline;
+} rtparams[NRTTHREADS] = {
+	{ 8,  2,  8 },
+	{ 16, 4, 16 },
+	{ 32, 8, 32 },
+};
+
+static volatile bool rt_bgstop;
+static volatile unsigned rt_failures;
+static struct semaphore *rt_donesem;
+
+/*
+ * Background load: just spin until told to stop.
+ */
+static
+void
+rt_bgthread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	while (!rt_bgstop) {
+		/* spin */
+	}
+	V(rt_donesem);
+}
+
+/*
+ * Periodic real-time thread. Each job burns half its budget, then
+ * waits for the next period.
+ */
+static
+void
+rt_periodicthread(void *junk, unsigned long num)
+{
+	struct thread *cur = curthread;
+	unsigned i, work;
+	int result;
+
+	(void)junk;
+
+	result = thread_set_realtime(rtparams[num].period,
+				     rtparams[num].budget,
+				     rtparams[num].deadline);
+	if (result) {
+		kprintf("rt thread %lu: thread_set_realtime: %s\n",
+			num, strerror(result));
+		rt_failures++;
+		V(rt_donesem);
+		return;
+	}
+
+	work = rtparams[num].budget / 2;
+	for (i=0; i<NJOBS; i++) {
+		while (cur->t_rt_used < work) {
+			/* spin */
+		}
+		thread_rt_waitperiod();
+	}
+
+	kprintf("rt thread %lu: period %u budget %u deadline %u: "
+		"%u misses, %u overruns\n", num, rtparams[num].period,
+		rtparams[num].budget, rtparams[num].deadline,
+		cur->t_rt_misses, cur->t_rt_overruns);
+	if (cur->t_rt_misses > 0 || cur->t_rt_overruns > 0) {
+		rt_failures++;
+	}
+
+	thread_clear_realtime();
+	V(rt_donesem);
+}
+
+int
+rttest(int nargs, char **args)
+{
+	unsigned long i;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	if (rt_donesem == NULL) {
+		rt_donesem = sem_create("rt_donesem", 0);
+		if (rt_donesem == NULL) {
+			panic("rttest: sem_create failed\n");
+		}
+	}
+	rt_bgstop = false;
+	rt_failures = 0;
+
+	kprintf("Starting real-time scheduling test...\n");
+
+	for (i=0; i<NBGTHREADS; i++) {
+		result = thread_fork("rt_bg", NULL, rt_bgthread, NULL, i);
+		if (result) {
+			panic("rttest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NRTTHREADS; i++) {
+		/* Put them all on our cpu so they compete for it. */
+		result = thread_fork_oncpu("rt_periodic", NULL,
+					   curcpu->c_self,
+					   rt_periodicthread, NULL, i);
+		if (result) {
+			panic("rttest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	for (i=0; i<NRTTHREADS; i++) {
+		P(rt_donesem);
+	}
+	rt_bgstop = true;
+	for (i=0; i<NBGTHREADS; i++) {
+		P(rt_donesem);
+	}
+
+	if (rt_failures > 0) {
+		kprintf("Real-time test FAILED: %u threads missed deadlines\n",
+			rt_failures);
+	}
+	else {
+		kprintf("Real-time test done: all deadlines met.\n");
+	}
+	return 0;
+}
@@ -34,7 +34,11 @@
 #include <types.h>
 #include <lib.h>
 #include <clock.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <wchan.h>
 #include <thread.h>
+#include <current.h>
 #include <synch.h>
 #include <test.h>
 
@@ -399,3 +403,277 @@ cvtest2(int nargs, char **args)
 	kprintf("cvtest2 done\n");
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+// wakeup ping-pong
+
+/*
+ * Two threads take turns through wchan_sleep_handoff, once with
+ * wake-affine off and once with it on, and we report the time per
+ * round trip. The pong thread is pinned to another cpu; the ping
+ * thread isn't, so with wake-affine on it should be pulled over on
+ * the first turn and the rest are same-cpu handoffs, while with it
+ * off every turn is a cross-cpu wakeup.
+ */
+
+#define NPINGPONGS	10000
+
+static struct spinlock pp_lock = SPINLOCK_INITIALIZER;
+static struct wchan *pp_pingwc;
+static struct wchan *pp_pongwc;
+static volatile bool pp_pongturn;
+static volatile unsigned pp_pingcpu;
+
+static
+void
+pingthread(void *junk, unsigned long num)
+{
+	unsigned i;
+
+	(void)junk;
+	(void)num;
+
+	spinlock_acquire(&pp_lock);
+	for (i=0; i<NPINGPONGS; i++) {
+		pp_pongturn = true;
+		wchan_sleep_handoff(pp_pingwc, pp_pongwc, &pp_lock);
+		while (pp_pongturn) {
+			wchan_sleep(pp_pingwc, &pp_lock);
+		}
+	}
+	pp_pingcpu = curcpu->c_number;
+	spinlock_release(&pp_lock);
+	V(donesem);
+}
+
+static
+void
+pongthread(void *junk, unsigned long num)
+{
+	unsigned i;
+
+	(void)junk;
+	(void)num;
+
+	spinlock_acquire(&pp_lock);
+	for (i=0; i<NPINGPONGS; i++) {
+		while (!pp_pongturn) {
+			wchan_sleep(pp_pongwc, &pp_lock);
+		}
+		pp_pongturn = false;
+		if (i == NPINGPONGS - 1) {
+			wchan_wakeone(pp_pingwc, &pp_lock);
+		}
+		else {
+			wchan_sleep_handoff(pp_pongwc, pp_pingwc, &pp_lock);
+		}
+	}
+	spinlock_release(&pp_lock);
+	V(donesem);
+}
+
+static
+void
+pingpong(bool affine)
+{
+	struct cpu *pongcpu;
+	uint64_t start, ns;
+	int result;
+
+	wchan_wake_affine = affine;
+	pp_pongturn = false;
+	pongcpu = cpu_get((curcpu->c_number + 1) % cpu_count());
+
+	start = gettime_ns();
+	result = thread_fork_oncpu("pong", NULL, pongcpu, pongthread, NULL, 0);
+	if (result) {
+		panic("pingpong: thread_fork failed: %s\n", strerror(result));
+	}
+	result = thread_fork("ping", NULL, pingthread, NULL, 0);
+	if (result) {
+		panic("pingpong: thread_fork failed: %s\n", strerror(result));
+	}
+	P(donesem);
+	P(donesem);
+	ns = gettime_ns() - start;
+
+	kprintf("wake-affine %s: %llu ns per round trip, ping ended on "
+		"cpu %u, pong on cpu %u\n", affine ? "on " : "off",
+		(unsigned long long)(ns / NPINGPONGS), pp_pingcpu,
+		pongcpu->c_number);
+}
+
+int
+pingpongtest(int nargs, char **args)
+{
+	bool saved;
+
+	(void)nargs;
+	(void)args;
+
+	if (cpu_count() < 2) {
+		kprintf("pingpongtest: needs at least 2 cpus\n");
+		return 0;
+	}
+
+	inititems();
+	pp_pingwc = wchan_create("pp_ping");
+	pp_pongwc = wchan_create("pp_pong");
+	if (pp_pingwc == NULL || pp_pongwc == NULL) {
+		panic("pingpongtest: wchan_create failed\n");
+	}
+
+	kprintf("Starting wakeup ping-pong test...\n");
+	saved = wchan_wake_affine;
+	pingpong(false);
+	pingpong(true);
+	wchan_wake_affine = saved;
+
+	wchan_destroy(pp_pingwc);
+	wchan_destroy(pp_pongwc);
+	pp_pingwc = pp_pongwc = NULL;
+	kprintf("Wakeup ping-pong test done.\n");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// priority inheritance
+
+/*
+ * The classic inversion, on one cpu: a low priority thread holds a
+ * lock, a high priority thread waits for it, and a middle priority
+ * thread spins. Without inheritance the low thread can't run until
+ * the spinner gives up (after PI_TIMEOUT), so the high thread waits
+ * that long. With it, the low thread runs at the high priority as
+ * soon as the high thread goes to sleep, and gives the lock up at
+ * once.
+ */
+
+#define PI_LOW		(THREAD_PRI_MIN + 1)
+#define PI_MID		THREAD_PRI_DEFAULT
+#define PI_HIGH		(THREAD_PRI_MAX - 1)
+#define PI_TIMEOUT	2000000000ULL	/* ns */
+
+static struct lock *pi_lock;
+static volatile bool pi_hwaiting;
+static volatile bool pi_hdone;
+static volatile int pi_lowboosted;
+static volatile int pi_lowafter;
+static volatile uint64_t pi_hwait;
+
+static
+void
+pi_lowthread(void *junk, unsigned long num)
+{
+	uint64_t start;
+
+	(void)junk;
+	(void)num;
+
+	thread_set_priority(PI_LOW);
+	lock_acquire(pi_lock);
+	V(donesem);
+
+	start = gettime_ns();
+	while (!pi_hwaiting && gettime_ns() - start < PI_TIMEOUT) {
+		/* spin */
+	}
+	pi_lowboosted = curthread->t_effpri;
+	lock_release(pi_lock);
+	pi_lowafter = curthread->t_effpri;
+	V(donesem);
+}
+
+static
+void
+pi_midthread(void *junk, unsigned long num)
+{
+	uint64_t start;
+
+	(void)junk;
+	(void)num;
+
+	thread_set_priority(PI_MID);
+	start = gettime_ns();
+	while (!pi_hdone && gettime_ns() - start < PI_TIMEOUT) {
+		/* spin */
+	}
+	V(donesem);
+}
+
+static
+void
+pi_highthread(void *junk, unsigned long num)
+{
+	uint64_t start;
+
+	(void)junk;
+	(void)num;
+
+	thread_set_priority(PI_HIGH);
+	pi_hwaiting = true;
+	start = gettime_ns();
+	lock_acquire(pi_lock);
+	pi_hwait = gettime_ns() - start;
+	lock_release(pi_lock);
+	pi_hdone = true;
+	V(donesem);
+}
+
+int
+pitest(int nargs, char **args)
+{
+	struct cpu *c;
+	int savedpri, result;
+	bool ok;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	pi_lock = lock_create("pi_lock");
+	if (pi_lock == NULL) {
+		panic("pitest: lock_create failed\n");
+	}
+	pi_hwaiting = pi_hdone = false;
+	pi_lowboosted = pi_lowafter = -1;
+	pi_hwait = 0;
+
+	kprintf("Starting priority inheritance test...\n");
+
+	/* Stay ahead of the test threads until they're all set up */
+	savedpri = thread_get_priority();
+	thread_set_priority(THREAD_PRI_MAX);
+	c = curcpu->c_self;
+
+	result = thread_fork_oncpu("pi_low", NULL, c, pi_lowthread, NULL, 0);
+	if (result) {
+		panic("pitest: thread_fork failed: %s\n", strerror(result));
+	}
+	/* Wait for it to take the lock */
+	P(donesem);
+
+	result = thread_fork_oncpu("pi_mid", NULL, c, pi_midthread, NULL, 0);
+	if (result) {
+		panic("pitest: thread_fork failed: %s\n", strerror(result));
+	}
+	result = thread_fork_oncpu("pi_high", NULL, c, pi_highthread, NULL, 0);
+	if (result) {
+		panic("pitest: thread_fork failed: %s\n", strerror(result));
+	}
+	P(donesem);
+	P(donesem);
+	P(donesem);
+
+	thread_set_priority(savedpri);
+	lock_destroy(pi_lock);
+	pi_lock = NULL;
+
+	ok = pi_lowboosted == PI_HIGH && pi_lowafter == PI_LOW &&
+		pi_hwait < PI_TIMEOUT / 2;
+	kprintf("Holder ran at priority %d (base %d, waiter %d), then %d\n",
+		pi_lowboosted, PI_LOW, PI_HIGH, pi_lowafter);
+	kprintf("Waiter waited %llu ns\n", (unsigned long long)pi_hwait);
+	kprintf("Priority inheritance test %s.\n", ok ? "done" : "FAILED");
+	return 0;
+}
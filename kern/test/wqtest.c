@@ -0,0 +1,174 @@
+/*
+ * Workqueue test.
+ *
+ * Checks that immediate work runs and can't be queued twice while
+ * pending, that delayed work runs in order of its due time, that
+ * workqueue_cancel catches pending delayed work (and only that), and
+ * that a work function can requeue its own item.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <workqueue.h>
+#include <test.h>
+
+#define WQT_NDELAYED	3
+#define WQT_NREQUEUE	5
+
+static struct work wqt_work[WQT_NDELAYED];
+static struct work wqt_requeuework;
+static struct semaphore *wqt_donesem;
+static struct spinlock wqt_loglock = SPINLOCK_INITIALIZER;
+static unsigned wqt_log[WQT_NDELAYED];
+static volatile unsigned wqt_nlog;
+static volatile unsigned wqt_nrequeue;
+static unsigned wqt_failures;
+
+static
+void
+wqt_check(const char *what, int got, int expected)
+{
+	if (got != expected) {
+		kprintf("wqtest: %s: got %d, expected %d\n",
+			what, got, expected);
+		wqt_failures++;
+	}
+}
+
+/*
+ * Work function: note which item ran, in the order they run.
+ */
+static
+void
+wqt_record(void *arg)
+{
+	unsigned num = (uintptr_t)arg;
+
+	spinlock_acquire(&wqt_loglock);
+	if (wqt_nlog < WQT_NDELAYED) {
+		wqt_log[wqt_nlog] = num;
+	}
+	wqt_nlog++;
+	spinlock_release(&wqt_loglock);
+	V(wqt_donesem);
+}
+
+/*
+ * Work function that queues itself again until it has run
+ * WQT_NREQUEUE times.
+ */
+static
+void
+wqt_requeue(void *arg)
+{
+	(void)arg;
+
+	wqt_nrequeue++;
+	if (wqt_nrequeue < WQT_NREQUEUE) {
+		if (!workqueue_enqueue(&wqt_requeuework)) {
+			kprintf("wqtest: requeue %u refused\n", wqt_nrequeue);
+			wqt_failures++;
+			V(wqt_donesem);
+		}
+		return;
+	}
+	V(wqt_donesem);
+}
+
+static
+void
+wqt_reset(void)
+{
+	unsigned i;
+
+	for (i=0; i<WQT_NDELAYED; i++) {
+		work_init(&wqt_work[i], wqt_record, (void *)(uintptr_t)i);
+		wqt_log[i] = 0;
+	}
+	wqt_nlog = 0;
+}
+
+int
+wqtest(int nargs, char **args)
+{
+	/* Delays in hardclocks, deliberately not in due order */
+	static const unsigned delays[WQT_NDELAYED] = { 30, 10, 20 };
+	static const unsigned order[WQT_NDELAYED] = { 1, 2, 0 };
+	unsigned i;
+	int spl;
+	bool first, second;
+
+	(void)nargs;
+	(void)args;
+
+	if (wqt_donesem == NULL) {
+		wqt_donesem = sem_create("wqt_donesem", 0);
+		if (wqt_donesem == NULL) {
+			panic("wqtest: sem_create failed\n");
+		}
+	}
+	wqt_failures = 0;
+
+	kprintf("Starting workqueue test...\n");
+
+	/*
+	 * Immediate work. Keep interrupts off across both enqueues so
+	 * our cpu's workers can't run the item in between.
+	 */
+	wqt_reset();
+	spl = splhigh();
+	first = workqueue_enqueue(&wqt_work[0]);
+	second = workqueue_enqueue(&wqt_work[0]);
+	splx(spl);
+	wqt_check("enqueue", first, true);
+	wqt_check("enqueue while pending", second, false);
+	P(wqt_donesem);
+	wqt_check("immediate work runs", wqt_nlog, 1);
+
+	/* Delayed work comes out in due order, not enqueue order */
+	wqt_reset();
+	for (i=0; i<WQT_NDELAYED; i++) {
+		wqt_check("enqueue_delayed",
+			  workqueue_enqueue_delayed(&wqt_work[i], delays[i]),
+			  true);
+	}
+	for (i=0; i<WQT_NDELAYED; i++) {
+		P(wqt_donesem);
+	}
+	wqt_check("delayed work runs", wqt_nlog, WQT_NDELAYED);
+	for (i=0; i<WQT_NDELAYED; i++) {
+		wqt_check("delayed work order", wqt_log[i], order[i]);
+	}
+
+	/*
+	 * Cancelling pending delayed work: it must not run, and it
+	 * must be free to queue again afterwards.
+	 */
+	wqt_reset();
+	wqt_check("enqueue_delayed",
+		  workqueue_enqueue_delayed(&wqt_work[0], 20), true);
+	wqt_check("cancel pending", workqueue_cancel(&wqt_work[0]), true);
+	clocksleep(1);
+	wqt_check("cancelled work runs", wqt_nlog, 0);
+	wqt_check("enqueue after cancel",
+		  workqueue_enqueue_delayed(&wqt_work[0], 1), true);
+	P(wqt_donesem);
+	wqt_check("requeued work runs", wqt_nlog, 1);
+
+	/* ...but once it has run there is nothing left to cancel */
+	wqt_check("cancel after run", workqueue_cancel(&wqt_work[0]), false);
+
+	/* A work function can queue its own item again */
+	wqt_nrequeue = 0;
+	work_init(&wqt_requeuework, wqt_requeue, NULL);
+	wqt_check("enqueue", workqueue_enqueue(&wqt_requeuework), true);
+	P(wqt_donesem);
+	wqt_check("self-requeue count", wqt_nrequeue, WQT_NREQUEUE);
+
+	kprintf("Workqueue test %s.\n", wqt_failures > 0 ? "FAILED" : "done");
+	return 0;
+}
@@ -34,6 +34,9 @@
 #include <clock.h>
 #include <thread.h>
 #include <current.h>
+#include <percpu.h>
+#include <workqueue.h>
+#include <rcu.h>
 
 /*
  * Time handling.
@@ -59,6 +62,8 @@
 static struct wchan *lbolt;
 static struct spinlock lbolt_lock;
 
+struct percpu_counter hardclocks;
+
 /*
  * Setup.
  */
@@ -70,6 +75,9 @@ hardclock_bootstrap(void)
 	if (lbolt == NULL) {
 		panic("Couldn't create lbolt\n");
 	}
+	if (percpu_counter_init(&hardclocks)) {
+		panic("Couldn't create hardclock counter\n");
+	}
 }
 
 /*
@@ -92,18 +100,27 @@ timerclock(void)
 void
 hardclock(void)
 {
+	unsigned now;
+
 	/*
 	 * Collect statistics here as desired.
 	 */
 
-	curcpu->c_hardclocks++;
-	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
+	percpu_counter_inc(&hardclocks);
+	now = percpu_counter_read_cpu(&hardclocks, curcpu->c_self);
+	workqueue_tick();
+	rcu_tick();
+	thread_rt_tick();
+	if ((now % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
 	}
-	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
+	if ((now % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
-	thread_yield();
+	/* RCU read sections aren't preemptible */
+	if (curthread->t_rcu_nesting == 0) {
+		thread_yield();
+	}
 }
 
 /*
@@ -0,0 +1,490 @@
+/*
+ * Synchronous message-passing IPC. See ipc.h for the interface.
+ *
+ * All the state for one exchange is protected by the lock of the
+ * endpoint it goes through. Each thread sleeps on a wait channel of
+ * its own, so a wakeup always goes to exactly the thread intended.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <current.h>
+#include <ipc.h>
+
+/* What a thread is waiting for */
+#define IPC_IDLE	0
+#define IPC_SENDING	1	/* On ep_sendq with a message */
+#define IPC_CALLING	2	/* Same, and wants a reply */
+#define IPC_RECEIVING	3	/* On ep_recvq */
+#define IPC_REPLYWAIT	4	/* Call delivered, waiting for the reply */
+
+/* Per-thread IPC state, made on first use. */
+struct ipc_thread {
+	struct wchan *it_wchan;		/* Only this thread sleeps here */
+	struct ipc_endpoint *it_ep;	/* Endpoint we're waiting on */
+	int it_state;			/* IPC_* */
+	bool it_done;			/* Our operation has finished */
+	int it_result;			/* ...with this error code */
+	struct ipc_msg it_msg;		/* Message being sent or received */
+	pid_t it_badge;			/* Who sent it */
+	struct ipc_thread *it_replyto;	/* Caller we owe a reply */
+	struct ipc_thread *it_next;	/* Link on ep_sendq or ep_recvq */
+};
+
+struct ipc_endpoint {
+	struct spinlock ep_lock;	/* Protects everything here */
+	unsigned ep_refs;		/* Reference count */
+	bool ep_closed;			/* No more messages */
+	struct ipc_thread *ep_sendq;	/* Waiting senders, FIFO */
+	struct ipc_thread **ep_sendtail;
+	struct ipc_thread *ep_recvq;	/* Waiting receivers, LIFO */
+};
+
+////////////////////////////////////////////////////////////
+// endpoints
+
+struct ipc_endpoint *
+ipc_endpoint_create(void)
+{
+	struct ipc_endpoint *ep;
+
+	ep = kmalloc(sizeof(*ep));
+	if (ep == NULL) {
+		return NULL;
+	}
+	spinlock_init(&ep->ep_lock);
+	ep->ep_refs = 1;
+	ep->ep_closed = false;
+	ep->ep_sendq = NULL;
+	ep->ep_sendtail = &ep->ep_sendq;
+	ep->ep_recvq = NULL;
+	return ep;
+}
+
+void
+ipc_endpoint_ref(struct ipc_endpoint *ep)
+{
+	spinlock_acquire(&ep->ep_lock);
+	ep->ep_refs++;
+	spinlock_release(&ep->ep_lock);
+}
+
+void
+ipc_endpoint_release(struct ipc_endpoint *ep)
+{
+	bool last;
+
+	spinlock_acquire(&ep->ep_lock);
+	KASSERT(ep->ep_refs > 0);
+	ep->ep_refs--;
+	last = (ep->ep_refs == 0);
+	spinlock_release(&ep->ep_lock);
+
+	if (last) {
+		/* Waiting threads hold references */
+		KASSERT(ep->ep_sendq == NULL);
+		KASSERT(ep->ep_recvq == NULL);
+		spinlock_cleanup(&ep->ep_lock);
+		kfree(ep);
+	}
+}
+
+static
+void
+ipc_sendq_add(struct ipc_endpoint *ep, struct ipc_thread *it)
+{
+	it->it_next = NULL;
+	*ep->ep_sendtail = it;
+	ep->ep_sendtail = &it->it_next;
+}
+
+static
+struct ipc_thread *
+ipc_sendq_rem(struct ipc_endpoint *ep)
+{
+	struct ipc_thread *it;
+
+	it = ep->ep_sendq;
+	if (it != NULL) {
+		ep->ep_sendq = it->it_next;
+		if (ep->ep_sendq == NULL) {
+			ep->ep_sendtail = &ep->ep_sendq;
+		}
+	}
+	return it;
+}
+
+/*
+ * Finish IT's operation with error RESULT and wake it up. The
+ * endpoint it's waiting on must be locked.
+ */
+static
+void
+ipc_finish(struct ipc_thread *it, int result)
+{
+	KASSERT(spinlock_do_i_hold(&it->it_ep->ep_lock));
+
+	it->it_state = IPC_IDLE;
+	it->it_result = result;
+	it->it_done = true;
+	wchan_wakeone(it->it_wchan, &it->it_ep->ep_lock);
+}
+
+void
+ipc_endpoint_close(struct ipc_endpoint *ep)
+{
+	struct ipc_thread *it;
+
+	spinlock_acquire(&ep->ep_lock);
+	ep->ep_closed = true;
+	while ((it = ep->ep_recvq) != NULL) {
+		ep->ep_recvq = it->it_next;
+		ipc_finish(it, EINTR);
+	}
+	while ((it = ipc_sendq_rem(ep)) != NULL) {
+		ipc_finish(it, ESRCH);
+	}
+	spinlock_release(&ep->ep_lock);
+}
+
+////////////////////////////////////////////////////////////
+// threads
+
+static
+struct ipc_thread *
+ipc_self(void)
+{
+	struct ipc_thread *it;
+
+	it = curthread->t_ipc;
+	if (it != NULL) {
+		return it;
+	}
+
+	it = kmalloc(sizeof(*it));
+	if (it == NULL) {
+		return NULL;
+	}
+	it->it_wchan = wchan_create("ipc");
+	if (it->it_wchan == NULL) {
+		kfree(it);
+		return NULL;
+	}
+	it->it_ep = NULL;
+	it->it_state = IPC_IDLE;
+	it->it_done = false;
+	it->it_result = 0;
+	it->it_badge = 0;
+	it->it_replyto = NULL;
+	it->it_next = NULL;
+
+	curthread->t_ipc = it;
+	return it;
+}
+
+/*
+ * Fail the call SELF owes a reply to, if any.
+ */
+static
+void
+ipc_abandon(struct ipc_thread *self)
+{
+	struct ipc_thread *caller;
+	struct ipc_endpoint *ep;
+
+	caller = self->it_replyto;
+	if (caller == NULL) {
+		return;
+	}
+	self->it_replyto = NULL;
+
+	ep = caller->it_ep;
+	spinlock_acquire(&ep->ep_lock);
+	KASSERT(caller->it_state == IPC_REPLYWAIT);
+	ipc_finish(caller, EPIPE);
+	spinlock_release(&ep->ep_lock);
+}
+
+void
+ipc_thread_exit(void)
+{
+	struct ipc_thread *it;
+
+	it = curthread->t_ipc;
+	if (it == NULL) {
+		return;
+	}
+	KASSERT(it->it_state == IPC_IDLE);
+
+	ipc_abandon(it);
+	wchan_destroy(it->it_wchan);
+	kfree(it);
+	curthread->t_ipc = NULL;
+}
+
+////////////////////////////////////////////////////////////
+// message transfer
+
+/*
+ * Copy the message from sender S to receiver R and update the
+ * sender's state: a plain send is now finished, a call waits for its
+ * reply. The caller deals with R, and with waking S.
+ */
+static
+void
+ipc_deliver(struct ipc_thread *s, struct ipc_thread *r)
+{
+	r->it_msg = s->it_msg;
+	r->it_badge = s->it_badge;
+	if (s->it_state == IPC_CALLING) {
+		KASSERT(r->it_replyto == NULL);
+		r->it_replyto = s;
+		s->it_state = IPC_REPLYWAIT;
+	}
+	else {
+		KASSERT(s->it_state == IPC_SENDING);
+		s->it_state = IPC_IDLE;
+		s->it_result = 0;
+		s->it_done = true;
+	}
+}
+
+/*
+ * Sleep until SELF's operation is finished, with the endpoint EP
+ * locked. If TARGET is not NULL it's a thread we've just made
+ * runnable; the first sleep hands the cpu to it.
+ */
+static
+int
+ipc_wait(struct ipc_endpoint *ep, struct ipc_thread *self,
+	 struct ipc_thread *target)
+{
+	if (target != NULL) {
+		wchan_sleep_handoff(self->it_wchan, target->it_wchan,
+				    &ep->ep_lock);
+	}
+	while (!self->it_done) {
+		wchan_sleep(self->it_wchan, &ep->ep_lock);
+	}
+	return self->it_result;
+}
+
+/*
+ * Send SELF's message on EP, waiting for a receiver and, for a call,
+ * the reply.
+ */
+static
+int
+ipc_transmit(struct ipc_endpoint *ep, struct ipc_thread *self)
+{
+	struct ipc_thread *r;
+
+	KASSERT(spinlock_do_i_hold(&ep->ep_lock));
+
+	if (ep->ep_closed) {
+		self->it_state = IPC_IDLE;
+		return ESRCH;
+	}
+
+	r = ep->ep_recvq;
+	if (r == NULL) {
+		ipc_sendq_add(ep, self);
+		return ipc_wait(ep, self, NULL);
+	}
+
+	ep->ep_recvq = r->it_next;
+	ipc_deliver(self, r);
+	r->it_state = IPC_IDLE;
+	r->it_result = 0;
+	r->it_done = true;
+
+	if (self->it_done) {
+		/* Plain send; the receiver just gets woken */
+		wchan_wakeone(r->it_wchan, &ep->ep_lock);
+		return 0;
+	}
+	/* Call; let the receiver run in our place while we wait */
+	return ipc_wait(ep, self, r);
+}
+
+static
+int
+ipc_dosend(struct ipc_endpoint *ep, struct ipc_msg *msg, pid_t badge,
+	   bool call)
+{
+	struct ipc_thread *self;
+	int result;
+
+	self = ipc_self();
+	if (self == NULL) {
+		return ENOMEM;
+	}
+	KASSERT(self->it_state == IPC_IDLE);
+
+	self->it_ep = ep;
+	self->it_state = call ? IPC_CALLING : IPC_SENDING;
+	self->it_done = false;
+	self->it_result = 0;
+	self->it_msg = *msg;
+	self->it_badge = badge;
+
+	spinlock_acquire(&ep->ep_lock);
+	result = ipc_transmit(ep, self);
+	if (result == 0 && call) {
+		*msg = self->it_msg;
+	}
+	spinlock_release(&ep->ep_lock);
+	return result;
+}
+
+int
+ipc_send(struct ipc_endpoint *ep, const struct ipc_msg *msg, pid_t badge)
+{
+	struct ipc_msg copy;
+
+	copy = *msg;
+	return ipc_dosend(ep, &copy, badge, false);
+}
+
+int
+ipc_call(struct ipc_endpoint *ep, struct ipc_msg *msg, pid_t badge)
+{
+	return ipc_dosend(ep, msg, badge, true);
+}
+
+/*
+ * Receive on EP, which is locked. CALLER, if not NULL, is a caller
+ * we have just answered but not yet woken; if we have to wait, the
+ * cpu goes to it.
+ */
+static
+int
+ipc_receive(struct ipc_endpoint *ep, struct ipc_thread *self,
+	    struct ipc_thread *caller)
+{
+	struct ipc_thread *s;
+
+	KASSERT(spinlock_do_i_hold(&ep->ep_lock));
+
+	if (ep->ep_closed) {
+		if (caller != NULL) {
+			wchan_wakeone(caller->it_wchan, &ep->ep_lock);
+		}
+		return EINTR;
+	}
+
+	s = ipc_sendq_rem(ep);
+	if (s != NULL) {
+		/* Someone was already waiting; no need to sleep */
+		ipc_deliver(s, self);
+		if (s->it_done) {
+			wchan_wakeone(s->it_wchan, &ep->ep_lock);
+		}
+		if (caller != NULL) {
+			wchan_wakeone(caller->it_wchan, &ep->ep_lock);
+		}
+		return 0;
+	}
+
+	self->it_ep = ep;
+	self->it_state = IPC_RECEIVING;
+	self->it_done = false;
+	self->it_next = ep->ep_recvq;
+	ep->ep_recvq = self;
+	return ipc_wait(ep, self, caller);
+}
+
+int
+ipc_recv(struct ipc_endpoint *ep, struct ipc_msg *msg, pid_t *badge)
+{
+	struct ipc_thread *self;
+	int result;
+
+	self = ipc_self();
+	if (self == NULL) {
+		return ENOMEM;
+	}
+	KASSERT(self->it_state == IPC_IDLE);
+
+	/* Receiving again without replying drops the old caller */
+	ipc_abandon(self);
+
+	spinlock_acquire(&ep->ep_lock);
+	result = ipc_receive(ep, self, NULL);
+	if (result == 0) {
+		*msg = self->it_msg;
+		*badge = self->it_badge;
+	}
+	spinlock_release(&ep->ep_lock);
+	return result;
+}
+
+int
+ipc_reply(const struct ipc_msg *msg)
+{
+	struct ipc_thread *self, *caller;
+	struct ipc_endpoint *ep;
+
+	self = curthread->t_ipc;
+	if (self == NULL || self->it_replyto == NULL) {
+		return EINVAL;
+	}
+	caller = self->it_replyto;
+	self->it_replyto = NULL;
+
+	ep = caller->it_ep;
+	spinlock_acquire(&ep->ep_lock);
+	KASSERT(caller->it_state == IPC_REPLYWAIT);
+	caller->it_msg = *msg;
+	ipc_finish(caller, 0);
+	spinlock_release(&ep->ep_lock);
+	return 0;
+}
+
+/*
+ * The reply goes out and the next message comes in under the same
+ * lock, so if there's nothing waiting to be received the cpu passes
+ * straight back to the caller.
+ */
+int
+ipc_replyrecv(struct ipc_endpoint *ep, struct ipc_msg *msg, pid_t *badge)
+{
+	struct ipc_thread *self, *caller;
+	int result;
+
+	self = ipc_self();
+	if (self == NULL) {
+		return ENOMEM;
+	}
+	KASSERT(self->it_state == IPC_IDLE);
+
+	caller = self->it_replyto;
+	self->it_replyto = NULL;
+	if (caller != NULL && caller->it_ep != ep) {
+		/* Not a call to this endpoint; answer it separately */
+		self->it_replyto = caller;
+		result = ipc_reply(msg);
+		KASSERT(result == 0);
+		caller = NULL;
+	}
+
+	spinlock_acquire(&ep->ep_lock);
+	if (caller != NULL) {
+		KASSERT(caller->it_state == IPC_REPLYWAIT);
+		caller->it_msg = *msg;
+		caller->it_state = IPC_IDLE;
+		caller->it_result = 0;
+		caller->it_done = true;
+	}
+	result = ipc_receive(ep, self, caller);
+	if (result == 0) {
+		*msg = self->it_msg;
+		*badge = self->it_badge;
+	}
+	spinlock_release(&ep->ep_lock);
+	return result;
+}
@@ -0,0 +1,309 @@
+/*
+ * Lock contention statistics. See lockstat.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <lockstat.h>
+
+struct lockstat_table *
+lockstat_table_create(void)
+{
+	struct lockstat_table *lt;
+
+	lt = kmalloc(sizeof(*lt));
+	if (lt == NULL) {
+		return NULL;
+	}
+	bzero(lt, sizeof(*lt));
+	return lt;
+}
+
+/*
+ * Compare a stored (truncated) name with a lock's name.
+ */
+static
+bool
+lockstat_samename(const char *stored, const char *name)
+{
+	unsigned i;
+
+	for (i=0; i<LOCKSTAT_NAMELEN - 1; i++) {
+		if (stored[i] != name[i]) {
+			return false;
+		}
+		if (stored[i] == 0) {
+			break;
+		}
+	}
+	return true;
+}
+
+/*
+ * Check if entry LE is the one for a lock.
+ */
+static
+bool
+lockstat_match(const struct lockstat_entry *le, unsigned kind,
+	       const char *name, const void *addr)
+{
+	if (le->le_kind != kind) {
+		return false;
+	}
+	if (kind == LOCKSTAT_SPINLOCK) {
+		return le->le_addr == addr;
+	}
+	return lockstat_samename(le->le_name, name);
+}
+
+/*
+ * Find (or make) the entry for a lock in table LT. Open hashing with
+ * linear probing; returns NULL if the table is full. Spinlocks go in
+ * their own part of the table, and into lt_spinother once that is
+ * full.
+ */
+static
+struct lockstat_entry *
+lockstat_lookup(struct lockstat_table *lt, unsigned kind,
+		const char *name, const void *addr)
+{
+	struct lockstat_entry *le, *entries;
+	unsigned hash, i, n, size;
+
+	if (kind == LOCKSTAT_SPINLOCK) {
+		hash = (uintptr_t)addr >> 2;
+		entries = lt->lt_spin;
+		size = LOCKSTAT_NSPIN;
+	}
+	else {
+		/* FNV-1a over (at most) the part of the name we keep */
+		hash = 2166136261U ^ kind;
+		for (i=0; i<LOCKSTAT_NAMELEN - 1 && name[i] != 0; i++) {
+			hash = (hash ^ (unsigned char)name[i]) * 16777619U;
+		}
+		entries = lt->lt_entries;
+		size = LOCKSTAT_NENTRIES;
+	}
+
+	for (n=0; n<size; n++) {
+		le = &entries[(hash + n) % size];
+		if (!le->le_used) {
+			le->le_used = true;
+			le->le_kind = kind;
+			le->le_addr = (kind == LOCKSTAT_SPINLOCK) ? addr : NULL;
+			snprintf(le->le_name, sizeof(le->le_name), "%s",
+				 kind == LOCKSTAT_SPINLOCK ? "" : name);
+			return le;
+		}
+		if (lockstat_match(le, kind, name, addr)) {
+			return le;
+		}
+	}
+	if (kind == LOCKSTAT_SPINLOCK) {
+		/* The catch-all has address NULL, which no spinlock has */
+		le = &lt->lt_spinother;
+		le->le_used = true;
+		le->le_kind = kind;
+		return le;
+	}
+	lt->lt_dropped++;
+	return NULL;
+}
+
+void
+lockstat_acquired(unsigned kind, const char *name, const void *addr,
+		  uint64_t wait_ns, bool contended)
+{
+	struct lockstat_table *lt;
+	struct lockstat_entry *le;
+	int spl;
+
+	if (!CURCPU_EXISTS()) {
+		return;
+	}
+
+	/* Interrupts off keeps us on this cpu and out of its table */
+	spl = splhigh();
+	lt = curcpu->c_lockstat;
+	if (lt != NULL) {
+		le = lockstat_lookup(lt, kind, name, addr);
+		if (le != NULL) {
+			le->le_acquires++;
+			if (contended) {
+				le->le_contended++;
+			}
+			le->le_wait_ns += wait_ns;
+			if (wait_ns > le->le_wait_max_ns) {
+				le->le_wait_max_ns = wait_ns;
+			}
+		}
+	}
+	splx(spl);
+}
+
+void
+lockstat_released(unsigned kind, const char *name, const void *addr,
+		  uint64_t hold_ns)
+{
+	struct lockstat_table *lt;
+	struct lockstat_entry *le;
+	int spl;
+
+	if (!CURCPU_EXISTS()) {
+		return;
+	}
+
+	spl = splhigh();
+	lt = curcpu->c_lockstat;
+	if (lt != NULL) {
+		le = lockstat_lookup(lt, kind, name, addr);
+		if (le != NULL) {
+			le->le_hold_ns += hold_ns;
+			if (hold_ns > le->le_hold_max_ns) {
+				le->le_hold_max_ns = hold_ns;
+			}
+		}
+	}
+	splx(spl);
+}
+
+/*
+ * Add entry SRC into the merged table MERGED of NUM entries, which
+ * has room for one more.
+ */
+static
+void
+lockstat_merge(struct lockstat_entry *merged, unsigned *num,
+	       const struct lockstat_entry *src)
+{
+	struct lockstat_entry *le;
+	unsigned i;
+
+	for (i=0; i<*num; i++) {
+		le = &merged[i];
+		if (lockstat_match(le, src->le_kind, src->le_name,
+				   src->le_addr)) {
+			le->le_acquires += src->le_acquires;
+			le->le_contended += src->le_contended;
+			le->le_wait_ns += src->le_wait_ns;
+			le->le_hold_ns += src->le_hold_ns;
+			if (src->le_wait_max_ns > le->le_wait_max_ns) {
+				le->le_wait_max_ns = src->le_wait_max_ns;
+			}
+			if (src->le_hold_max_ns > le->le_hold_max_ns) {
+				le->le_hold_max_ns = src->le_hold_max_ns;
+			}
+			return;
+		}
+	}
+	merged[(*num)++] = *src;
+}
+
+/*
+ * Merge the N used entries of ENTRIES into MERGED.
+ */
+static
+void
+lockstat_merge_all(struct lockstat_entry *merged, unsigned *num,
+		   const struct lockstat_entry *entries, unsigned n)
+{
+	unsigned i;
+
+	for (i=0; i<n; i++) {
+		if (entries[i].le_used) {
+			lockstat_merge(merged, num, &entries[i]);
+		}
+	}
+}
+
+static const char *const lockstat_kindnames[] = {
+	"spin", "lock", "sem", "cv",
+};
+
+/*
+ * Print and reset the statistics.
+ *
+ * As with schedstats, the other cpus keep running while we copy and
+ * clear their tables, so this is only roughly a consistent snapshot.
+ */
+void
+lockstat_dump(unsigned max)
+{
+	struct lockstat_table *copy;
+	struct lockstat_entry *merged, tmp;
+	struct cpu *c;
+	unsigned i, j, best, num, ncpus, dropped;
+	char name[LOCKSTAT_NAMELEN + 16];
+
+	ncpus = cpu_count();
+	copy = kmalloc(sizeof(*copy));
+	merged = kmalloc(ncpus * (LOCKSTAT_NENTRIES + LOCKSTAT_NSPIN + 1) *
+			 sizeof(*merged));
+	if (copy == NULL || merged == NULL) {
+		kprintf("lockstat: Out of memory\n");
+		kfree(copy);
+		kfree(merged);
+		return;
+	}
+
+	num = 0;
+	dropped = 0;
+	for (i=0; i<ncpus; i++) {
+		c = cpu_get(i);
+		if (c->c_lockstat == NULL) {
+			continue;
+		}
+		*copy = *c->c_lockstat;
+		bzero(c->c_lockstat, sizeof(*c->c_lockstat));
+		dropped += copy->lt_dropped;
+		lockstat_merge_all(merged, &num, copy->lt_entries,
+				   LOCKSTAT_NENTRIES);
+		lockstat_merge_all(merged, &num, copy->lt_spin,
+				   LOCKSTAT_NSPIN);
+		lockstat_merge_all(merged, &num, &copy->lt_spinother, 1);
+	}
+
+	kprintf("%-4s %-24s %9s %9s %12s %10s %12s %10s\n",
+		"kind", "name", "acquires", "contended",
+		"wait ns", "max wait", "hold ns", "max hold");
+
+	/* Selection sort the top MAX by total wait */
+	for (i=0; i<num && i<max; i++) {
+		best = i;
+		for (j=i+1; j<num; j++) {
+			if (merged[j].le_wait_ns > merged[best].le_wait_ns) {
+				best = j;
+			}
+		}
+		tmp = merged[i];
+		merged[i] = merged[best];
+		merged[best] = tmp;
+
+		if (merged[i].le_kind == LOCKSTAT_SPINLOCK &&
+		    merged[i].le_addr == NULL) {
+			snprintf(name, sizeof(name), "(others)");
+		}
+		else if (merged[i].le_kind == LOCKSTAT_SPINLOCK) {
+			snprintf(name, sizeof(name), "%p", merged[i].le_addr);
+		}
+		else {
+			snprintf(name, sizeof(name), "%s", merged[i].le_name);
+		}
+		kprintf("%-4s %-24s %9u %9u %12llu %10llu %12llu %10llu\n",
+			lockstat_kindnames[merged[i].le_kind], name,
+			merged[i].le_acquires, merged[i].le_contended,
+			(unsigned long long)merged[i].le_wait_ns,
+			(unsigned long long)merged[i].le_wait_max_ns,
+			(unsigned long long)merged[i].le_hold_ns,
+			(unsigned long long)merged[i].le_hold_max_ns);
+	}
+	if (dropped > 0) {
+		kprintf("(%u events not recorded: table full)\n", dropped);
+	}
+
+	kfree(copy);
+	kfree(merged);
+}
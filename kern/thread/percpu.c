@@ -0,0 +1,92 @@
+/*
+ * Per-cpu counters. See percpu.h.
+ */
+
+/* Make sure to build out-of-line versions of inline functions */
+#define PERCPU_INLINE	/* empty */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <percpu.h>
+
+/* Which slots are taken. Slot 0 is the discard slot; see percpu.h. */
+static bool percpu_slotused[PERCPU_COUNTER_SLOTS] = { true };
+static struct spinlock percpu_slotlock = SPINLOCK_INITIALIZER;
+
+/*
+ * Make a cpu's array of slots. kmalloc hands back blocks aligned to
+ * their size, so with a power-of-2 size the array starts on a cache
+ * line and no two cpus' arrays share one.
+ */
+unsigned *
+percpu_counters_create(void)
+{
+	unsigned *slots;
+
+	slots = kmalloc(PERCPU_COUNTER_SLOTS * sizeof(unsigned));
+	if (slots == NULL) {
+		return NULL;
+	}
+	bzero(slots, PERCPU_COUNTER_SLOTS * sizeof(unsigned));
+	return slots;
+}
+
+int
+percpu_counter_init(struct percpu_counter *pc)
+{
+	unsigned i, j;
+
+	spinlock_acquire(&percpu_slotlock);
+	for (i=1; i<PERCPU_COUNTER_SLOTS; i++) {
+		if (!percpu_slotused[i]) {
+			percpu_slotused[i] = true;
+			spinlock_release(&percpu_slotlock);
+
+			/* A previous owner may have left counts behind */
+			for (j=0; j<cpu_count(); j++) {
+				cpu_get(j)->c_counters[i] = 0;
+			}
+			pc->pc_slot = i;
+			return 0;
+		}
+	}
+	spinlock_release(&percpu_slotlock);
+	return ENOSPC;
+}
+
+void
+percpu_counter_destroy(struct percpu_counter *pc)
+{
+	KASSERT(pc->pc_slot > 0 && pc->pc_slot < PERCPU_COUNTER_SLOTS);
+
+	spinlock_acquire(&percpu_slotlock);
+	KASSERT(percpu_slotused[pc->pc_slot]);
+	percpu_slotused[pc->pc_slot] = false;
+	spinlock_release(&percpu_slotlock);
+	pc->pc_slot = 0;
+}
+
+unsigned
+percpu_counter_read_cpu(const struct percpu_counter *pc, const struct cpu *c)
+{
+	return c->c_counters[pc->pc_slot];
+}
+
+/*
+ * Add up all the cpus. The other cpus keep counting while we do, so
+ * this is a snapshot only in the loose sense.
+ */
+unsigned
+percpu_counter_read(const struct percpu_counter *pc)
+{
+	unsigned i, total;
+
+	total = 0;
+	for (i=0; i<cpu_count(); i++) {
+		total += cpu_get(i)->c_counters[pc->pc_slot];
+	}
+	return total;
+}
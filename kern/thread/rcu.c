@@ -0,0 +1,289 @@
+/*
+ * Read-copy-update. See rcu.h for the interface.
+ *
+ * Grace periods are global and numbered. rcu_gpstarted is the latest
+ * one to start and rcu_gpdone the latest to end; they differ by one
+ * while a grace period is running. rcu_need has a bit for each cpu
+ * that hasn't been through a quiescent state since the running grace
+ * period started. Cpus that are idle at the start are left out: they
+ * aren't in a read section, and any section they enter later began
+ * after the grace period did, so it can't see what was unlinked
+ * before.
+ *
+ * Callbacks are batched per cpu. New ones collect on rc_next. When
+ * rc_wait is empty, hardclock moves rc_next there and asks for a grace
+ * period that starts after now; once that one is done it passes the
+ * batch to the cpu's workqueue. All of this is touched only by the
+ * owning cpu with interrupts off, so it needs no lock.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <current.h>
+#include <workqueue.h>
+#include <rcu.h>
+
+/* rcu_need is a 32-bit mask */
+#define RCU_MAXCPUS	32
+
+struct rcu_cpu {
+	struct rcu_head *rc_next;	/* Waiting for a grace period */
+	struct rcu_head **rc_nexttail;
+	struct rcu_head *rc_wait;	/* Waiting for grace period rc_gp */
+	unsigned rc_gp;
+	struct rcu_head *rc_done;	/* Ready to call */
+	struct work rc_work;		/* Calls them */
+};
+
+static struct spinlock rcu_gplock = SPINLOCK_INITIALIZER;
+static unsigned rcu_gpstarted;		/* Latest grace period started */
+static unsigned rcu_gpdone;		/* Latest grace period finished */
+static unsigned rcu_gpwanted;		/* Latest one anybody is waiting for */
+static volatile uint32_t rcu_need;	/* Cpus yet to pass a quiescent state */
+
+static void rcu_gp_start(void);
+
+////////////////////////////////////////////////////////////
+// Read side
+
+void
+rcu_read_lock(void)
+{
+	curthread->t_rcu_nesting++;
+}
+
+void
+rcu_read_unlock(void)
+{
+	KASSERT(curthread->t_rcu_nesting > 0);
+	curthread->t_rcu_nesting--;
+}
+
+////////////////////////////////////////////////////////////
+// Grace periods
+
+/*
+ * End the running grace period, and start the next if someone wants
+ * it.
+ */
+static
+void
+rcu_gp_end(void)
+{
+	KASSERT(spinlock_do_i_hold(&rcu_gplock));
+
+	rcu_gpdone = rcu_gpstarted;
+	if ((int)(rcu_gpwanted - rcu_gpdone) > 0) {
+		rcu_gp_start();
+	}
+}
+
+/*
+ * Start a grace period. If every cpu is idle it is over at once.
+ */
+static
+void
+rcu_gp_start(void)
+{
+	struct cpu *c;
+	unsigned i, n;
+	uint32_t need;
+
+	KASSERT(spinlock_do_i_hold(&rcu_gplock));
+	KASSERT(rcu_gpstarted == rcu_gpdone);
+
+	n = cpu_count();
+	KASSERT(n <= RCU_MAXCPUS);
+
+	rcu_gpstarted++;
+	need = 0;
+	for (i=0; i<n; i++) {
+		c = cpu_get(i);
+		if (!c->c_isidle) {
+			need |= (uint32_t)1 << c->c_number;
+		}
+	}
+	rcu_need = need;
+	if (need == 0) {
+		rcu_gp_end();
+	}
+}
+
+/*
+ * Ask for a grace period that starts after now, and return its
+ * number.
+ */
+static
+unsigned
+rcu_request(void)
+{
+	unsigned gp;
+
+	KASSERT(spinlock_do_i_hold(&rcu_gplock));
+
+	/*
+	 * Either nothing is running and this is the next one, which
+	 * we start now, or one is running and it's the one after.
+	 */
+	gp = rcu_gpstarted + 1;
+	if ((int)(gp - rcu_gpwanted) > 0) {
+		rcu_gpwanted = gp;
+	}
+	if (rcu_gpstarted == rcu_gpdone) {
+		rcu_gp_start();
+	}
+	return gp;
+}
+
+/*
+ * The current cpu is in a quiescent state. Called from thread_switch
+ * and (while idle) rcu_tick, with interrupts off.
+ */
+void
+rcu_quiescent(void)
+{
+	uint32_t bit;
+
+	KASSERT(curthread->t_rcu_nesting == 0);
+
+	bit = (uint32_t)1 << curcpu->c_number;
+	if ((rcu_need & bit) == 0) {
+		/* Nothing running, or we already checked in */
+		return;
+	}
+
+	spinlock_acquire(&rcu_gplock);
+	if (rcu_need & bit) {
+		rcu_need &= ~bit;
+		if (rcu_need == 0) {
+			rcu_gp_end();
+		}
+	}
+	spinlock_release(&rcu_gplock);
+}
+
+////////////////////////////////////////////////////////////
+// Callbacks
+
+/*
+ * Workqueue function: call everything on rc_done.
+ */
+static
+void
+rcu_work(void *data)
+{
+	struct rcu_cpu *rc = data;
+	struct rcu_head *rh, *next;
+	int spl;
+
+	spl = splhigh();
+	rh = rc->rc_done;
+	rc->rc_done = NULL;
+	splx(spl);
+
+	while (rh != NULL) {
+		next = rh->rh_next;
+		rh->rh_func(rh->rh_arg);
+		rh = next;
+	}
+}
+
+struct rcu_cpu *
+rcu_cpu_create(void)
+{
+	struct rcu_cpu *rc;
+
+	rc = kmalloc(sizeof(*rc));
+	if (rc == NULL) {
+		return NULL;
+	}
+	rc->rc_next = NULL;
+	rc->rc_nexttail = &rc->rc_next;
+	rc->rc_wait = NULL;
+	rc->rc_gp = 0;
+	rc->rc_done = NULL;
+	work_init(&rc->rc_work, rcu_work, rc);
+	return rc;
+}
+
+void
+call_rcu(struct rcu_head *rh, void (*func)(void *), void *arg)
+{
+	struct rcu_cpu *rc;
+	int spl;
+
+	rh->rh_next = NULL;
+	rh->rh_func = func;
+	rh->rh_arg = arg;
+
+	spl = splhigh();
+	rc = curcpu->c_rcu;
+	*rc->rc_nexttail = rh;
+	rc->rc_nexttail = &rh->rh_next;
+	splx(spl);
+}
+
+/*
+ * Move callbacks along. Called from hardclock.
+ */
+void
+rcu_tick(void)
+{
+	struct rcu_cpu *rc;
+	struct rcu_head *rh;
+	bool done;
+	int spl;
+
+	/*
+	 * An idle cpu is quiescent. thread_switch checks in as it goes
+	 * idle; this covers a grace period that started as it did so
+	 * and still counted us as busy.
+	 */
+	if (curcpu->c_isidle) {
+		spl = splhigh();
+		rcu_quiescent();
+		splx(spl);
+	}
+
+	if (curcpu->c_workqueue == NULL) {
+		/* Too early in boot to run callbacks; keep them */
+		return;
+	}
+
+	spl = splhigh();
+	rc = curcpu->c_rcu;
+
+	if (rc->rc_wait != NULL) {
+		spinlock_acquire(&rcu_gplock);
+		done = (int)(rcu_gpdone - rc->rc_gp) >= 0;
+		spinlock_release(&rcu_gplock);
+
+		if (done) {
+			/* Put the batch in front of anything still undone */
+			for (rh = rc->rc_wait; rh->rh_next != NULL;
+			     rh = rh->rh_next) {
+				/* nothing */
+			}
+			rh->rh_next = rc->rc_done;
+			rc->rc_done = rc->rc_wait;
+			rc->rc_wait = NULL;
+			workqueue_enqueue(&rc->rc_work);
+		}
+	}
+
+	if (rc->rc_wait == NULL && rc->rc_next != NULL) {
+		rc->rc_wait = rc->rc_next;
+		rc->rc_next = NULL;
+		rc->rc_nexttail = &rc->rc_next;
+
+		spinlock_acquire(&rcu_gplock);
+		rc->rc_gp = rcu_request();
+		spinlock_release(&rcu_gplock);
+	}
+
+	splx(spl);
+}
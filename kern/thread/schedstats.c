@@ -0,0 +1,102 @@
+/*
+ * Scheduler statistics.
+ *
+ * The counters themselves are bumped directly by the thread code
+ * (see thread.c); this file has the histogram bookkeeping and the
+ * code that reports them.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <schedstats.h>
+
+/*
+ * Record a run queue latency of NS nanoseconds.
+ */
+void
+schedstats_latency(struct schedstats *stats, uint64_t ns)
+{
+	uint64_t us;
+	unsigned bucket;
+
+	stats->ss_latency_ns += ns;
+	if (ns > stats->ss_latency_max_ns) {
+		stats->ss_latency_max_ns = ns;
+	}
+
+	us = ns / 1000;
+	bucket = 0;
+	while (us > 1 && bucket < SCHEDSTATS_NBUCKETS - 1) {
+		us >>= 1;
+		bucket++;
+	}
+	stats->ss_latency_hist[bucket]++;
+}
+
+/*
+ * Print one cpu's counters.
+ */
+static
+void
+schedstats_print(unsigned num, const struct schedstats *ss)
+{
+	unsigned i, waits;
+	uint64_t avg;
+
+	waits = 0;
+	for (i=0; i<SCHEDSTATS_NBUCKETS; i++) {
+		waits += ss->ss_latency_hist[i];
+	}
+	avg = waits > 0 ? ss->ss_latency_ns / waits : 0;
+
+	kprintf("cpu%u: %u switches (%u voluntary, %u involuntary)\n",
+		num, ss->ss_switches, ss->ss_voluntary, ss->ss_involuntary);
+	kprintf("      %u migrations out, %u in; "
+		"%u IPIs sent, %u received\n",
+		ss->ss_migrations_out, ss->ss_migrations_in,
+		ss->ss_ipis_sent, ss->ss_ipis_received);
+	kprintf("      idle %llu.%09llu seconds\n",
+		(unsigned long long)(ss->ss_idle_ns / 1000000000),
+		(unsigned long long)(ss->ss_idle_ns % 1000000000));
+	kprintf("      run queue latency: %u waits, avg %llu ns, "
+		"max %llu ns\n", waits, (unsigned long long)avg,
+		(unsigned long long)ss->ss_latency_max_ns);
+
+	for (i=0; i<SCHEDSTATS_NBUCKETS; i++) {
+		if (ss->ss_latency_hist[i] == 0) {
+			continue;
+		}
+		if (i == SCHEDSTATS_NBUCKETS - 1) {
+			kprintf("      %10u us and up: %u\n",
+				1U << i, ss->ss_latency_hist[i]);
+		}
+		else {
+			kprintf("      %10u-%u us: %u\n",
+				i == 0 ? 0 : 1U << i, (1U << (i+1)) - 1,
+				ss->ss_latency_hist[i]);
+		}
+	}
+}
+
+/*
+ * Print and reset the statistics for every cpu.
+ *
+ * The other cpus keep running while we do this, so the numbers for
+ * each cpu are only approximately a consistent snapshot. Good enough
+ * for statistics.
+ */
+void
+schedstats_dump(void)
+{
+	struct schedstats copy;
+	struct cpu *c;
+	unsigned i;
+
+	for (i=0; i<cpu_count(); i++) {
+		c = cpu_get(i);
+		copy = c->c_stats;
+		bzero(&c->c_stats, sizeof(c->c_stats));
+		schedstats_print(c->c_number, &copy);
+	}
+}
@@ -38,6 +38,8 @@
 #include <spinlock.h>
 #include <membar.h>
 #include <current.h>	/* for curcpu */
+#include <clock.h>
+#include <lockstat.h>
 
 /*
  * Spinlocks.
@@ -50,7 +52,8 @@
 void
 spinlock_init(struct spinlock *splk)
 {
-	spinlock_data_set(&splk->splk_lock, 0);
+	spinlock_data_set(&splk->splk_next, 0);
+	spinlock_data_set(&splk->splk_serving, 0);
 	splk->splk_holder = NULL;
 }
 
@@ -61,20 +64,26 @@ void
 spinlock_cleanup(struct spinlock *splk)
 {
 	KASSERT(splk->splk_holder == NULL);
-	KASSERT(spinlock_data_get(&splk->splk_lock) == 0);
+	KASSERT(spinlock_data_get(&splk->splk_next) ==
+		spinlock_data_get(&splk->splk_serving));
 }
 
 /*
  * Get the lock.
  *
  * First disable interrupts (otherwise, if we get a timer interrupt we
- * might come back to this lock and deadlock), then use a machine-level
- * atomic operation to wait for the lock to be free.
+ * might come back to this lock and deadlock), then take a ticket with
+ * a machine-level atomic operation and wait for our turn.
  */
 void
 spinlock_acquire(struct spinlock *splk)
 {
 	struct cpu *mycpu;
+	spinlock_data_t ticket;
+#if OPT_LOCKSTAT
+	uint64_t start;
+	bool contended;
+#endif
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -90,28 +99,29 @@ spinlock_acquire(struct spinlock *splk)
 		mycpu = NULL;
 	}
 
-	while (1) {
-		/*
-		 * Do test-test-and-set, that is, read first before
-		 * doing test-and-set, to reduce bus contention.
-		 *
-		 * Test-and-set is a machine-level atomic operation
-		 * that writes 1 into the lock word and returns the
-		 * previous value. If that value was 0, the lock was
-		 * previously unheld and we now own it. If it was 1,
-		 * we don't.
-		 */
-		if (spinlock_data_get(&splk->splk_lock) != 0) {
-			continue;
-		}
-		if (spinlock_data_testandset(&splk->splk_lock) != 0) {
-			continue;
-		}
-		break;
+	/*
+	 * Fetch-and-add is the only atomic write; after that we just
+	 * read splk_serving, which only changes once per release, so
+	 * the waiters don't fight over the cache line.
+	 */
+#if OPT_LOCKSTAT
+	start = gettime_ns();
+#endif
+	ticket = spinlock_data_fetchadd(&splk->splk_next, 1);
+#if OPT_LOCKSTAT
+	contended = spinlock_data_get(&splk->splk_serving) != ticket;
+#endif
+	while (spinlock_data_get(&splk->splk_serving) != ticket) {
+		/* spin */
 	}
 
 	membar_store_any();
 	splk->splk_holder = mycpu;
+#if OPT_LOCKSTAT
+	splk->splk_acqtime = contended ? gettime_ns() : start;
+	lockstat_acquired(LOCKSTAT_SPINLOCK, NULL, splk,
+			  splk->splk_acqtime - start, contended);
+#endif
 }
 
 /*
@@ -127,9 +137,15 @@ spinlock_release(struct spinlock *splk)
 		curcpu->c_spinlocks--;
 	}
 
+#if OPT_LOCKSTAT
+	lockstat_released(LOCKSTAT_SPINLOCK, NULL, splk,
+			  gettime_ns() - splk->splk_acqtime);
+#endif
 	splk->splk_holder = NULL;
 	membar_any_store();
-	spinlock_data_set(&splk->splk_lock, 0);
+	/* Only the holder writes splk_serving, so this needn't be atomic */
+	spinlock_data_set(&splk->splk_serving,
+			  spinlock_data_get(&splk->splk_serving) + 1);
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
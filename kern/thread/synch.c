@@ -38,6 +38,10 @@
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
+#include <cpu.h>
+#include <membar.h>
+#include <clock.h>
+#include <lockstat.h>
 #include <synch.h>
 
 ////////////////////////////////////////////////////////////
@@ -88,6 +92,10 @@ sem_destroy(struct semaphore *sem)
 void
 P(struct semaphore *sem)
 {
+#if OPT_LOCKSTAT
+	uint64_t start = gettime_ns();
+	bool contended;
+#endif
         KASSERT(sem != NULL);
 
         /*
@@ -100,6 +108,9 @@ P(struct semaphore *sem)
 
 	/* Use the semaphore spinlock to protect the wchan as well. */
 	spinlock_acquire(&sem->sem_lock);
+#if OPT_LOCKSTAT
+	contended = (sem->sem_count == 0);
+#endif
         while (sem->sem_count == 0) {
 		/*
 		 *
@@ -118,6 +129,10 @@ P(struct semaphore *sem)
         KASSERT(sem->sem_count > 0);
         sem->sem_count--;
 	spinlock_release(&sem->sem_lock);
+#if OPT_LOCKSTAT
+	lockstat_acquired(LOCKSTAT_SEM, sem->sem_name, NULL,
+			  contended ? gettime_ns() - start : 0, contended);
+#endif
 }
 
 void
@@ -162,8 +177,6 @@ lock_create(const char *name)
 #endif
 
 #if OPT_LOCKS_WITH_SPIN
-	lock->current = kmalloc(sizeof(*lock->current));
-	lock->current = NULL;
 	lock->sem_wchan = wchan_create(lock->lk_name);
 	if (lock->sem_wchan == NULL) {
 		kfree(lock->lk_name);
@@ -172,9 +185,13 @@ lock_create(const char *name)
 	}
 
 	spinlock_init(&lock->sem_lock);
-	lock->sem_count = 1;
-	
-	
+	spinlock_data_set(&lock->lk_held, 0);
+	lock->current = NULL;
+	lock->lk_cpu = NULL;
+	lock->lk_waiters = 0;
+	bzero(lock->lk_sleepers, sizeof(lock->lk_sleepers));
+	lock->lk_piowner = NULL;
+	lock->lk_pinext = NULL;
 #endif
         // add stuff here as needed
 
@@ -198,19 +215,326 @@ lock_destroy(struct lock *lock)
 
 #if OPT_LOCKS_WITH_SPIN
 	KASSERT(lock->current==NULL);
+	KASSERT(lock->lk_waiters == 0);
+	KASSERT(lock->lk_piowner == NULL);
 	spinlock_cleanup(&lock->sem_lock);
 	wchan_destroy(lock->sem_wchan);
-      	
-	kfree(lock->current);
-        
 #endif
        kfree(lock->lk_name);
        	kfree(lock);
 }
 
+#if OPT_LOCKS_WITH_SPIN
+/*
+ * Priority inheritance.
+ *
+ * A thread about to sleep on a lock counts itself in lk_sleepers at
+ * its effective priority and puts the lock on the holder's t_pilocks
+ * list. A thread's effective priority is the highest of its base
+ * priority and the top sleeper of each lock on its list. When that
+ * changes for a thread that is itself asleep on a lock, it is moved
+ * to its new priority in that lock's count and the change goes on to
+ * that lock's holder, and so on down the chain.
+ *
+ * A releaser takes the lock off its list, dropping back to whatever
+ * it still inherits from other locks. Sleepers stay counted until
+ * they wake up, and whoever sleeps on or takes the lock next puts it
+ * on the new holder's list.
+ *
+ * Links are only made under the lock's sem_lock, to the thread seen
+ * in ->current, and lock_release goes the slow way (through
+ * sem_lock) if it sees sleepers or a link to itself; so a lock never
+ * stays on the list of a thread that no longer holds it.
+ *
+ * All of this is under one global spinlock, which comes after the
+ * locks' sem_locks and before the run queue locks. None of it is
+ * touched unless a lock actually has sleepers.
+ */
+static struct spinlock lock_pilock = SPINLOCK_INITIALIZER;
+
+/* Stop following a chain this long; it would be a deadlock anyway. */
+#define LOCK_PI_MAXDEPTH	16
+
+/*
+ * Highest priority asleep on LOCK, or -1 if none.
+ */
+static
+int
+lock_pi_top(struct lock *lock)
+{
+	int pri;
+
+	for (pri = THREAD_PRI_MAX; pri >= THREAD_PRI_MIN; pri--) {
+		if (lock->lk_sleepers[pri] > 0) {
+			return pri;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Recompute T's effective priority and pass any change on down the
+ * chain of locks it's waiting for.
+ */
+static
+void
+lock_pi_update(struct thread *t)
+{
+	struct lock *l;
+	unsigned depth;
+	int pri, top;
+
+	KASSERT(spinlock_do_i_hold(&lock_pilock));
+
+	for (depth = 0; t != NULL && depth < LOCK_PI_MAXDEPTH; depth++) {
+		pri = t->t_pri;
+		for (l = t->t_pilocks; l != NULL; l = l->lk_pinext) {
+			top = lock_pi_top(l);
+			if (top > pri) {
+				pri = top;
+			}
+		}
+		if (pri == t->t_effpri) {
+			return;
+		}
+		t->t_effpri = pri;
+
+		l = t->t_waitlock;
+		if (l == NULL) {
+			return;
+		}
+		l->lk_sleepers[t->t_waitpri]--;
+		l->lk_sleepers[pri]++;
+		t->t_waitpri = pri;
+		t = l->lk_piowner;
+	}
+}
+
+/*
+ * Take LOCK off its holder's list, and recompute the holder.
+ */
+static
+void
+lock_pi_unlink(struct lock *lock)
+{
+	struct thread *owner;
+	struct lock **lp;
+
+	KASSERT(spinlock_do_i_hold(&lock_pilock));
+
+	owner = lock->lk_piowner;
+	KASSERT(owner != NULL);
+	for (lp = &owner->t_pilocks; *lp != lock; lp = &(*lp)->lk_pinext) {
+		KASSERT(*lp != NULL);
+	}
+	*lp = lock->lk_pinext;
+	lock->lk_pinext = NULL;
+	lock->lk_piowner = NULL;
+	lock_pi_update(owner);
+}
+
+/*
+ * Put LOCK on HOLDER's list (if HOLDER isn't NULL), taking it off
+ * anyone else's first, and recompute HOLDER.
+ */
+static
+void
+lock_pi_link(struct lock *lock, struct thread *holder)
+{
+	KASSERT(spinlock_do_i_hold(&lock->sem_lock));
+	KASSERT(spinlock_do_i_hold(&lock_pilock));
+
+	if (lock->lk_piowner != holder) {
+		if (lock->lk_piowner != NULL) {
+			lock_pi_unlink(lock);
+		}
+		if (holder != NULL) {
+			lock->lk_piowner = holder;
+			lock->lk_pinext = holder->t_pilocks;
+			holder->t_pilocks = lock;
+		}
+	}
+	if (holder != NULL) {
+		lock_pi_update(holder);
+	}
+}
+
+/*
+ * We're about to sleep on LOCK: lend the holder our priority.
+ */
+static
+void
+lock_pi_sleep(struct lock *lock)
+{
+	struct thread *cur = curthread;
+
+	spinlock_acquire(&lock_pilock);
+	KASSERT(cur->t_waitlock == NULL);
+	cur->t_waitlock = lock;
+	cur->t_waitpri = cur->t_effpri;
+	lock->lk_sleepers[cur->t_waitpri]++;
+	lock_pi_link(lock, lock->current);
+	spinlock_release(&lock_pilock);
+}
+
+/*
+ * We woke up from sleeping on LOCK: stop being counted there.
+ */
+static
+void
+lock_pi_wakeup(struct lock *lock)
+{
+	struct thread *cur = curthread;
+
+	spinlock_acquire(&lock_pilock);
+	KASSERT(cur->t_waitlock == lock);
+	lock->lk_sleepers[cur->t_waitpri]--;
+	cur->t_waitlock = NULL;
+	if (lock->lk_piowner != NULL) {
+		lock_pi_update(lock->lk_piowner);
+	}
+	spinlock_release(&lock_pilock);
+}
+
+/*
+ * We just took LOCK the slow way: if there are still sleepers, they
+ * now inherit through us.
+ */
+static
+void
+lock_pi_claim(struct lock *lock)
+{
+	spinlock_acquire(&lock_pilock);
+	if (lock_pi_top(lock) >= 0) {
+		lock_pi_link(lock, curthread);
+	}
+	else if (lock->lk_piowner != NULL) {
+		lock_pi_unlink(lock);
+	}
+	spinlock_release(&lock_pilock);
+}
+
+/*
+ * We're letting go of LOCK: stop inheriting through it.
+ */
+static
+void
+lock_pi_release(struct lock *lock)
+{
+	KASSERT(spinlock_do_i_hold(&lock->sem_lock));
+
+	spinlock_acquire(&lock_pilock);
+	if (lock->lk_piowner == curthread) {
+		lock_pi_unlink(lock);
+	}
+	spinlock_release(&lock_pilock);
+}
+
+/*
+ * Try once to take LOCK. Reads first, so spinning waiters don't
+ * keep hammering the cache line with LL/SC.
+ */
+static
+bool
+lock_tryget(struct lock *lock)
+{
+	if (spinlock_data_get(&lock->lk_held) != 0) {
+		return false;
+	}
+	if (spinlock_data_testandset(&lock->lk_held) != 0) {
+		return false;
+	}
+	membar_store_any();
+	lock->lk_cpu = curcpu->c_self;
+	lock->current = curthread;
+	return true;
+}
+
+/*
+ * Check if it's worth spinning for LOCK: that is, if it's held by a
+ * thread that is running right now on some other cpu.
+ *
+ * We only look at the holder's cpu, never at the holder itself, which
+ * might release the lock and exit under us. If the holder has been
+ * moved since it took the lock we'll (wrongly but safely) sleep.
+ */
+static
+bool
+lock_holder_running(struct lock *lock)
+{
+	struct thread *holder;
+	struct cpu *c;
+
+	holder = lock->current;
+	c = lock->lk_cpu;
+	if (holder == NULL || c == NULL) {
+		/* Being taken or released right now; worth a spin */
+		return spinlock_data_get(&lock->lk_held) != 0;
+	}
+	return c != curcpu->c_self && c->c_curthread == holder;
+}
+
+/*
+ * Contended case of lock_acquire.
+ */
+static
+void
+lock_acquire_slow(struct lock *lock)
+{
+	while (1) {
+		/* Spin while that looks like it will pay off */
+		while (lock_holder_running(lock)) {
+			if (lock_tryget(lock)) {
+				if (lock->lk_waiters > 0) {
+					spinlock_acquire(&lock->sem_lock);
+					lock_pi_claim(lock);
+					spinlock_release(&lock->sem_lock);
+				}
+				return;
+			}
+		}
+
+		/*
+		 * The holder is off-cpu; go to sleep. Count ourselves
+		 * as a waiter before the last try, so that a release
+		 * in between will see us and wake us up.
+		 */
+		spinlock_acquire(&lock->sem_lock);
+		lock->lk_waiters++;
+		membar_any_any();
+		if (lock_tryget(lock)) {
+			lock->lk_waiters--;
+			lock_pi_claim(lock);
+			spinlock_release(&lock->sem_lock);
+			return;
+		}
+		if (lock->current == NULL) {
+			/*
+			 * Held, but the holder hasn't stored current yet
+			 * (lock_tryget or the fast path is between the
+			 * test-and-set and the store). Sleeping now would
+			 * lend our priority to nobody, and the fast path
+			 * never looks back; try again instead.
+			 */
+			lock->lk_waiters--;
+			spinlock_release(&lock->sem_lock);
+			continue;
+		}
+		lock_pi_sleep(lock);
+		wchan_sleep(lock->sem_wchan, &lock->sem_lock);
+		lock_pi_wakeup(lock);
+		lock->lk_waiters--;
+		spinlock_release(&lock->sem_lock);
+	}
+}
+#endif
+
 void
 lock_acquire(struct lock *lock)
 {
+#if OPT_LOCKS_WITH_SPIN && OPT_LOCKSTAT
+	uint64_t start;
+#endif
         // Write this
 #if OPT_LOCKS
 	while(lock->current!=NULL);
@@ -224,20 +548,29 @@ lock_acquire(struct lock *lock)
 
 #if OPT_LOCKS_WITH_SPIN
 
-//	while(lock->current!=NULL);
-	spinlock_acquire(&lock->sem_lock);
-//	lock->current = curthread;
-	
 	KASSERT(curthread->t_in_interrupt == false);
-	
-//	 while (lock->sem_count == 0) {
-	while(lock->current!=NULL){
-		wchan_sleep(lock->sem_wchan, &lock->sem_lock);
-        }
-        KASSERT(lock->sem_count > 0);
-	lock->current = curthread;
-        lock->sem_count--;
-	spinlock_release(&lock->sem_lock);
+	KASSERT(lock->current != curthread);
+
+#if OPT_LOCKSTAT
+	start = gettime_ns();
+#endif
+	/* Fast path: not held, one test-and-set and we're done */
+	if (spinlock_data_testandset(&lock->lk_held) == 0) {
+		membar_store_any();
+		lock->lk_cpu = curcpu->c_self;
+		lock->current = curthread;
+#if OPT_LOCKSTAT
+		lock->lk_acqtime = start;
+		lockstat_acquired(LOCKSTAT_LOCK, lock->lk_name, NULL, 0, false);
+#endif
+		return;
+	}
+	lock_acquire_slow(lock);
+#if OPT_LOCKSTAT
+	lock->lk_acqtime = gettime_ns();
+	lockstat_acquired(LOCKSTAT_LOCK, lock->lk_name, NULL,
+			  lock->lk_acqtime - start, true);
+#endif
 #endif	
           // suppress warning until code gets written
 }
@@ -245,6 +578,9 @@ lock_acquire(struct lock *lock)
 void
 lock_release(struct lock *lock)
 {
+#if OPT_LOCKS_WITH_SPIN
+	unsigned waiters;
+#endif
         // Write this
 #if OPT_LOCKS
 	
@@ -259,15 +595,33 @@ lock_release(struct lock *lock)
 #if OPT_LOCKS_WITH_SPIN
 	
 	KASSERT(lock_do_i_hold(lock));
-	spinlock_acquire(&lock->sem_lock);
-	
-	lock->current = NULL;
-	
- 	lock->sem_count++;
-        KASSERT(lock->sem_count > 0);
-	wchan_wakeone(lock->sem_wchan, &lock->sem_lock);
 
-	spinlock_release(&lock->sem_lock);
+#if OPT_LOCKSTAT
+	lockstat_released(LOCKSTAT_LOCK, lock->lk_name, NULL,
+			  gettime_ns() - lock->lk_acqtime);
+#endif
+	lock->current = NULL;
+	lock->lk_cpu = NULL;
+	membar_any_store();
+	spinlock_data_set(&lock->lk_held, 0);
+
+	/*
+	 * Only bother with the spinlock if someone is asleep, or we
+	 * inherited through this lock. The barrier pairs with the one
+	 * in lock_acquire_slow: either we see its waiter count or it
+	 * sees the lock free. A sleeper links the lock to us before it
+	 * can be woken and uncount itself, so if we see it gone we
+	 * also see the link.
+	 */
+	membar_any_any();
+	waiters = lock->lk_waiters;
+	membar_load_load();
+	if (waiters > 0 || lock->lk_piowner == curthread) {
+		spinlock_acquire(&lock->sem_lock);
+		lock_pi_release(lock);
+		wchan_wakeone(lock->sem_wchan, &lock->sem_lock);
+		spinlock_release(&lock->sem_lock);
+	}
 #endif
    	// suppress warning until code gets written
 }
@@ -293,15 +647,8 @@ lock_do_i_hold(struct lock *lock)
 
 #if OPT_LOCKS_WITH_SPIN
 	
-	spinlock_acquire(&lock->sem_lock);
-	
-	if(lock->current != curthread){
-		flag = false;
-	}
-	else {
-		flag = true;
-	}
-	spinlock_release(&lock->sem_lock);
+	/* Only we can set current to ourselves, so no locking needed */
+	flag = (lock->current == curthread);
 #endif
 	
      // suppress warning until code gets written
@@ -309,6 +656,41 @@ lock_do_i_hold(struct lock *lock)
      return flag;   // dummy until code gets written
 }
 
+#if OPT_LOCKSTAT
+/*
+ * Whether anybody holds LOCK right now. Only a hint, for statistics.
+ */
+static
+bool
+lock_isheld(struct lock *lock)
+{
+#if OPT_LOCKS_WITH_SPIN
+	return spinlock_data_get(&lock->lk_held) != 0;
+#elif OPT_LOCKS
+	return lock->current != NULL;
+#else
+	(void)lock;
+	return false;
+#endif
+}
+#endif
+
+void
+lock_pi_setbase(struct thread *t, int pri)
+{
+	KASSERT(pri >= THREAD_PRI_MIN && pri <= THREAD_PRI_MAX);
+
+#if OPT_LOCKS_WITH_SPIN
+	spinlock_acquire(&lock_pilock);
+	t->t_pri = pri;
+	lock_pi_update(t);
+	spinlock_release(&lock_pilock);
+#else
+	t->t_pri = pri;
+	t->t_effpri = pri;
+#endif
+}
+
 ////////////////////////////////////////////////////////////
 //
 // CV
@@ -370,13 +752,25 @@ cv_wait(struct cv *cv, struct lock *lock)
 {
         // Write this
 #if OPT_CV_IMPL 
-	
-	
+#if OPT_LOCKSTAT
+	uint64_t start = gettime_ns();
+	bool contended;
+#endif
 
 	spinlock_acquire(&cv->sem_lock);
 	lock_release(lock);
 	wchan_sleep(cv->sem_wchan,&cv->sem_lock);
 	spinlock_release(&cv->sem_lock);
+#if OPT_LOCKSTAT
+	/*
+	 * Sleeping until signalled is what a CV is for. The wait only
+	 * counts as contended if, once woken, we find the lock taken
+	 * and have to block again to get it back (as after a broadcast).
+	 */
+	contended = lock_isheld(lock);
+	lockstat_acquired(LOCKSTAT_CV, cv->cv_name, NULL,
+			  gettime_ns() - start, contended);
+#endif
 
 	lock_acquire(lock);
 	
@@ -416,3 +810,190 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 	
 }
 
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+	struct rwlock *rw;
+
+	rw = kmalloc(sizeof(*rw));
+	if (rw == NULL) {
+		return NULL;
+	}
+
+	rw->rw_name = kstrdup(name);
+	if (rw->rw_name == NULL) {
+		goto fail_rw;
+	}
+	rw->rw_readwc = wchan_create(rw->rw_name);
+	if (rw->rw_readwc == NULL) {
+		goto fail_name;
+	}
+	rw->rw_writewc = wchan_create(rw->rw_name);
+	if (rw->rw_writewc == NULL) {
+		goto fail_readwc;
+	}
+	rw->rw_upgradewc = wchan_create(rw->rw_name);
+	if (rw->rw_upgradewc == NULL) {
+		goto fail_writewc;
+	}
+
+	spinlock_init(&rw->rw_lock);
+	rw->rw_readers = 0;
+	rw->rw_writerswaiting = 0;
+	rw->rw_writer = NULL;
+	rw->rw_upgrader = NULL;
+	return rw;
+
+ fail_writewc:
+	wchan_destroy(rw->rw_writewc);
+ fail_readwc:
+	wchan_destroy(rw->rw_readwc);
+ fail_name:
+	kfree(rw->rw_name);
+ fail_rw:
+	kfree(rw);
+	return NULL;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(rw->rw_readers == 0);
+	KASSERT(rw->rw_writer == NULL);
+
+	/* wchan_destroy will assert if anyone's waiting */
+	spinlock_cleanup(&rw->rw_lock);
+	wchan_destroy(rw->rw_upgradewc);
+	wchan_destroy(rw->rw_writewc);
+	wchan_destroy(rw->rw_readwc);
+	kfree(rw->rw_name);
+	kfree(rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer != curthread);
+	while (rw->rw_writer != NULL || rw->rw_writerswaiting > 0 ||
+	       rw->rw_upgrader != NULL) {
+		wchan_sleep(rw->rw_readwc, &rw->rw_lock);
+	}
+	rw->rw_readers++;
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_readers > 0);
+	KASSERT(rw->rw_writer == NULL);
+	rw->rw_readers--;
+	if (rw->rw_readers == 1 && rw->rw_upgrader != NULL) {
+		/* The one left is the upgrader */
+		wchan_wakeall(rw->rw_upgradewc, &rw->rw_lock);
+	}
+	else if (rw->rw_readers == 0 && rw->rw_writerswaiting > 0) {
+		wchan_wakeone(rw->rw_writewc, &rw->rw_lock);
+	}
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer != curthread);
+	while (rw->rw_writer != NULL || rw->rw_readers > 0 ||
+	       rw->rw_upgrader != NULL) {
+		rw->rw_writerswaiting++;
+		wchan_sleep(rw->rw_writewc, &rw->rw_lock);
+		rw->rw_writerswaiting--;
+	}
+	rw->rw_writer = curthread;
+	spinlock_release(&rw->rw_lock);
+}
+
+/*
+ * Hand the lock on: to the next writer if there is one, otherwise to
+ * all the readers that piled up behind it.
+ */
+void
+rwlock_release_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer == curthread);
+	rw->rw_writer = NULL;
+	if (rw->rw_writerswaiting > 0) {
+		wchan_wakeone(rw->rw_writewc, &rw->rw_lock);
+	}
+	else {
+		wchan_wakeall(rw->rw_readwc, &rw->rw_lock);
+	}
+	spinlock_release(&rw->rw_lock);
+}
+
+bool
+rwlock_tryupgrade(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_readers > 0);
+	KASSERT(rw->rw_writer == NULL);
+	if (rw->rw_upgrader != NULL) {
+		/* Two upgraders would wait for each other forever */
+		spinlock_release(&rw->rw_lock);
+		return false;
+	}
+
+	/* Keeps new readers and writers out while we wait */
+	rw->rw_upgrader = curthread;
+	while (rw->rw_readers > 1) {
+		wchan_sleep(rw->rw_upgradewc, &rw->rw_lock);
+	}
+	rw->rw_upgrader = NULL;
+	rw->rw_readers = 0;
+	rw->rw_writer = curthread;
+	spinlock_release(&rw->rw_lock);
+	return true;
+}
+
+void
+rwlock_downgrade(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer == curthread);
+	rw->rw_writer = NULL;
+	rw->rw_readers = 1;
+	if (rw->rw_writerswaiting == 0) {
+		wchan_wakeall(rw->rw_readwc, &rw->rw_lock);
+	}
+	spinlock_release(&rw->rw_lock);
+}
+
+bool
+rwlock_do_i_hold_write(struct rwlock *rw)
+{
+	return rw->rw_writer == curthread;
+}
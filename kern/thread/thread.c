@@ -40,6 +40,7 @@
 #include <cpu.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <membar.h>
 #include <wchan.h>
 #include <thread.h>
 #include <threadlist.h>
@@ -50,6 +51,11 @@
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <clock.h>
+#include <schedstats.h>
+#include <lockstat.h>
+#include <percpu.h>
+#include <rcu.h>
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
@@ -140,12 +146,39 @@ thread_create(const char *name)
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
+	thread->t_pinned = false;
+	thread->t_uthread = NULL;
+	thread->t_ipc = NULL;
+	thread->t_rcu_nesting = 0;
+	thread->t_pri = THREAD_PRI_DEFAULT;
+	thread->t_effpri = THREAD_PRI_DEFAULT;
+	thread->t_pilocks = NULL;
+	thread->t_waitlock = NULL;
+	thread->t_waitpri = 0;
 
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
 	thread->t_curspl = IPL_HIGH;
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
 
+#if OPT_SCHEDSTATS
+	thread->t_readytime = 0;
+#endif
+
+	/* Real-time fields */
+	thread->t_rt = false;
+	thread->t_rt_throttled = false;
+	thread->t_rt_exhausted = false;
+	thread->t_rt_waspinned = false;
+	thread->t_rt_period = 0;
+	thread->t_rt_budget = 0;
+	thread->t_rt_deadline = 0;
+	thread->t_rt_release = 0;
+	thread->t_rt_absdeadline = 0;
+	thread->t_rt_used = 0;
+	thread->t_rt_misses = 0;
+	thread->t_rt_overruns = 0;
+
 	/* If you add to struct thread, be sure to initialize here */
 
 	return thread;
@@ -176,12 +209,30 @@ cpu_create(unsigned hardware_number)
 
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
-	c->c_hardclocks = 0;
+	c->c_counters = percpu_counters_create();
+	if (c->c_counters == NULL) {
+		panic("cpu_create: Out of memory\n");
+	}
 	c->c_spinlocks = 0;
+#if OPT_SCHEDSTATS
+	bzero(&c->c_stats, sizeof(c->c_stats));
+#endif
+#if OPT_LOCKSTAT
+	/* If this fails we just don't collect stats on this cpu */
+	c->c_lockstat = lockstat_table_create();
+#endif
+	c->c_rcu = rcu_cpu_create();
+	if (c->c_rcu == NULL) {
+		panic("cpu_create: Out of memory\n");
+	}
 
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
+	threadlist_init(&c->c_rtqueue);
+	threadlist_init(&c->c_rtwait);
+	c->c_rtutil = 0;
 	spinlock_init(&c->c_runqueue_lock);
+	c->c_workqueue = NULL;
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
@@ -271,6 +322,8 @@ thread_destroy(struct thread *thread)
 
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
+	/* ipc_thread_exit should have cleaned this up */
+	KASSERT(thread->t_ipc == NULL);
 	if (thread->t_stack != NULL) {
 		kfree(thread->t_stack);
 	}
@@ -328,6 +381,9 @@ thread_panic(void)
 	curcpu->c_runqueue.tl_count = 0;
 	curcpu->c_runqueue.tl_head.tln_next = &curcpu->c_runqueue.tl_tail;
 	curcpu->c_runqueue.tl_tail.tln_prev = &curcpu->c_runqueue.tl_head;
+	curcpu->c_rtqueue.tl_count = 0;
+	curcpu->c_rtqueue.tl_head.tln_next = &curcpu->c_rtqueue.tl_tail;
+	curcpu->c_rtqueue.tl_tail.tln_prev = &curcpu->c_rtqueue.tl_head;
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -439,6 +495,83 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Accessors for the cpu array, for use outside the thread system.
+ */
+unsigned
+cpu_count(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
+struct cpu *
+cpu_get(unsigned n)
+{
+	KASSERT(n < cpuarray_num(&allcpus));
+	return cpuarray_get(&allcpus, n);
+}
+
+/*
+ * Put real-time thread T on C's real-time run queue, in deadline
+ * order. Threads with equal deadlines stay FIFO.
+ */
+static
+void
+thread_rt_enqueue(struct cpu *c, struct thread *t)
+{
+	struct thread *other;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	THREADLIST_FORALL(other, c->c_rtqueue) {
+		if ((int)(t->t_rt_absdeadline - other->t_rt_absdeadline) < 0) {
+			threadlist_insertbefore(&c->c_rtqueue, t, other);
+			return;
+		}
+	}
+	threadlist_addtail(&c->c_rtqueue, t);
+}
+
+/*
+ * Put a thread on its cpu's run queue, which must be locked. Returns
+ * true if that cpu is idle and isn't us, so it needs an IPI_UNIDLE.
+ *
+ * A real-time thread that is throttled goes on the cpu's release
+ * list instead; thread_rt_tick moves it to the run queue when its
+ * next period starts.
+ */
+static
+bool
+thread_enqueue(struct thread *target)
+{
+	struct cpu *targetcpu = target->t_cpu;
+
+	KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
+
+	/* Target thread is now ready to run; put it on the run queue. */
+	target->t_state = S_READY;
+	if (target->t_rt && target->t_rt_throttled) {
+		if (target->t_rt_exhausted) {
+			/* Out of budget and still wanting to run */
+			target->t_rt_exhausted = false;
+			target->t_rt_overruns++;
+		}
+		threadlist_addtail(&targetcpu->c_rtwait, target);
+		return false;
+	}
+	if (target->t_rt) {
+		thread_rt_enqueue(targetcpu, target);
+	}
+	else {
+		threadlist_addtail(&targetcpu->c_runqueue, target);
+	}
+#if OPT_SCHEDSTATS
+	target->t_readytime = gettime_ns();
+#endif
+
+	return targetcpu->c_isidle && targetcpu != curcpu->c_self;
+}
+
 /*
  * Make a thread runnable.
  *
@@ -461,11 +594,7 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		spinlock_acquire(&targetcpu->c_runqueue_lock);
 	}
 
-	/* Target thread is now ready to run; put it on the run queue. */
-	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
-
-	if (targetcpu->c_isidle && targetcpu != curcpu->c_self) {
+	if (thread_enqueue(target)) {
 		/*
 		 * Other processor is idle; send interrupt to make
 		 * sure it unidles.
@@ -478,6 +607,48 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 }
 
+/*
+ * Wake-affine wakeups; see wchan.h.
+ */
+bool wchan_wake_affine = true;
+
+/*
+ * Move TARGET, which has just been taken off a wait channel, to the
+ * current cpu. Returns false, and leaves it alone, if its old cpu
+ * might still be running on its stack: that cpu keeps it as
+ * c_curthread until it switches to something else, which it might
+ * not have done yet, or might not do at all if it went idle. It
+ * changes c_curthread and finishes the switch under its run queue
+ * lock, so checking under that lock is enough.
+ */
+static
+bool
+thread_pull(struct thread *target)
+{
+	struct cpu *oldcpu = target->t_cpu;
+	bool ok;
+
+	KASSERT(oldcpu != curcpu->c_self);
+
+	spinlock_acquire(&oldcpu->c_runqueue_lock);
+	ok = (oldcpu->c_curthread != target);
+#if OPT_SCHEDSTATS
+	if (ok) {
+		oldcpu->c_stats.ss_migrations_out++;
+	}
+#endif
+	spinlock_release(&oldcpu->c_runqueue_lock);
+	if (!ok) {
+		return false;
+	}
+
+	target->t_cpu = curcpu->c_self;
+#if OPT_SCHEDSTATS
+	curcpu->c_stats.ss_migrations_in++;
+#endif
+	return true;
+}
+
 /*
  * Create a new thread based on an existing one.
  *
@@ -485,14 +656,17 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
  * ENTRYPOINT. DATA1 and DATA2 are passed to ENTRYPOINT.
  *
  * The new thread is created in the process P. If P is null, the
- * process is inherited from the caller. It will start on the same CPU
- * as the caller, unless the scheduler intervenes first.
+ * process is inherited from the caller. It will start on CPU, or if
+ * CPU is null on the same CPU as the caller, unless the scheduler
+ * intervenes first. If PINNED is set the scheduler never moves it.
  */
+static
 int
-thread_fork(const char *name,
-	    struct proc *proc,
-	    void (*entrypoint)(void *data1, unsigned long data2),
-	    void *data1, unsigned long data2)
+thread_fork_common(const char *name,
+		   struct proc *proc,
+		   struct cpu *cpu, bool pinned,
+		   void (*entrypoint)(void *data1, unsigned long data2),
+		   void *data1, unsigned long data2)
 {
 	struct thread *newthread;
 	int result;
@@ -515,7 +689,10 @@ thread_fork(const char *name,
 	 */
 
 	/* Thread subsystem fields */
-	newthread->t_cpu = curthread->t_cpu;
+	newthread->t_cpu = cpu != NULL ? cpu : curthread->t_cpu;
+	newthread->t_pinned = pinned;
+	newthread->t_pri = curthread->t_pri;
+	newthread->t_effpri = curthread->t_pri;
 
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
@@ -538,12 +715,92 @@ thread_fork(const char *name,
 	/* Set up the switchframe so entrypoint() gets called */
 	switchframe_init(newthread, entrypoint, data1, data2);
 
-	/* Lock the current cpu's run queue and make the new thread runnable */
+	/* Lock the target cpu's run queue and make the new thread runnable */
 	thread_make_runnable(newthread, false);
 
 	return 0;
 }
 
+int
+thread_fork(const char *name,
+	    struct proc *proc,
+	    void (*entrypoint)(void *data1, unsigned long data2),
+	    void *data1, unsigned long data2)
+{
+	return thread_fork_common(name, proc, NULL, false,
+				  entrypoint, data1, data2);
+}
+
+int
+thread_fork_oncpu(const char *name,
+		  struct proc *proc, struct cpu *cpu,
+		  void (*entrypoint)(void *data1, unsigned long data2),
+		  void *data1, unsigned long data2)
+{
+	KASSERT(cpu != NULL);
+	return thread_fork_common(name, proc, cpu, true,
+				  entrypoint, data1, data2);
+}
+
+/*
+ * Find the thread on TL with the highest effective priority, the
+ * first one among equals. Returns NULL if TL is empty.
+ *
+ * Priority inheritance can change t_effpri without the run queue
+ * lock; the worst that does is make one choice slightly stale.
+ */
+static
+struct thread *
+thread_highest(struct threadlist *tl)
+{
+	struct thread *t, *best;
+
+	best = NULL;
+	THREADLIST_FORALL(t, *tl) {
+		if (best == NULL || t->t_effpri > best->t_effpri) {
+			best = t;
+			if (best->t_effpri == THREAD_PRI_MAX) {
+				break;
+			}
+		}
+	}
+	return best;
+}
+
+/*
+ * Check if yielding the cpu would let something else run: that is,
+ * if CUR, which is about to go back on the run queue, should give way
+ * to another thread. Real-time threads only give way to real-time
+ * threads with an earlier deadline (or if they've been throttled);
+ * ordinary threads give way to real-time threads and to ordinary ones
+ * of at least the same priority.
+ */
+static
+bool
+thread_yield_needed(struct thread *cur)
+{
+	struct thread *rthead, *best;
+
+	KASSERT(spinlock_do_i_hold(&curcpu->c_runqueue_lock));
+
+	/* NULL if empty; the list bookends have tln_self NULL */
+	rthead = curcpu->c_rtqueue.tl_head.tln_next->tln_self;
+
+	if (cur->t_rt) {
+		if (cur->t_rt_throttled) {
+			return true;
+		}
+		return rthead != NULL &&
+			(int)(rthead->t_rt_absdeadline -
+			      cur->t_rt_absdeadline) < 0;
+	}
+	if (rthead != NULL) {
+		return true;
+	}
+	best = thread_highest(&curcpu->c_runqueue);
+	return best != NULL && best->t_effpri >= cur->t_effpri;
+}
+
 /*
  * High level, machine-independent context switch code.
  *
@@ -553,13 +810,25 @@ thread_fork(const char *name,
  * If NEWSTATE is S_SLEEP, the thread is queued on the wait channel
  * WC, protected by the spinlock LK. Otherwise WC and Lk should be
  * NULL.
+ *
+ * HANDOFF, if not NULL, is a thread on this cpu that has just been
+ * taken off a wait channel. It runs next, without going through the
+ * run queue, unless there is real-time work or a more important
+ * thread waiting.
+ *
+ * Ordinary threads are taken from the run queue by priority; see
+ * thread_highest.
  */
 static
 void
-thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
+thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk,
+	      struct thread *handoff)
 {
-	struct thread *cur, *next;
+	struct thread *cur, *next, *best;
 	int spl;
+#if OPT_SCHEDSTATS
+	uint64_t now;
+#endif
 
 	DEBUGASSERT(curcpu->c_curthread == curthread);
 	DEBUGASSERT(curthread->t_cpu == curcpu->c_self);
@@ -581,11 +850,14 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* Check the stack guard band. */
 	thread_checkstack(cur);
 
+	/* Nobody can be in an RCU read section here. */
+	rcu_quiescent();
+
 	/* Lock the run queue. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
 	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	if (newstate == S_READY && !thread_yield_needed(cur)) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
@@ -635,18 +907,75 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	 * lock to look at it, this should not be visible or matter.
 	 */
 
+	next = NULL;
+	if (handoff != NULL) {
+		KASSERT(handoff->t_cpu == curcpu->c_self);
+		best = thread_highest(&curcpu->c_runqueue);
+		if (threadlist_isempty(&curcpu->c_rtqueue) &&
+		    (best == NULL || best->t_effpri <= handoff->t_effpri)) {
+			next = handoff;
+#if OPT_SCHEDSTATS
+			/* It never waited on a run queue */
+			next->t_readytime = 0;
+#endif
+		}
+		else {
+			thread_make_runnable(handoff, true /*have lock*/);
+		}
+	}
+
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
-	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+	/*
+	 * A grace period that started since the rcu_quiescent above
+	 * saw us busy and waits for us; check in again, or it would
+	 * wait for as long as we idle.
+	 */
+	membar_any_any();
+	rcu_quiescent();
+	while (next == NULL) {
+		next = threadlist_remhead(&curcpu->c_rtqueue);
+		if (next == NULL) {
+			next = thread_highest(&curcpu->c_runqueue);
+			if (next != NULL) {
+				threadlist_remove(&curcpu->c_runqueue, next);
+			}
+		}
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
+#if OPT_SCHEDSTATS
+			now = gettime_ns();
+			cpu_idle();
+			curcpu->c_stats.ss_idle_ns += gettime_ns() - now;
+#else
 			cpu_idle();
+#endif
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
-	} while (next == NULL);
+	}
 	curcpu->c_isidle = false;
 
+#if OPT_SCHEDSTATS
+	now = gettime_ns();
+	if (next->t_readytime != 0 && now > next->t_readytime) {
+		schedstats_latency(&curcpu->c_stats, now - next->t_readytime);
+	}
+	if (next != cur) {
+		curcpu->c_stats.ss_switches++;
+		/*
+		 * A thread that goes back on the run queue from an
+		 * interrupt (that is, from hardclock) was preempted;
+		 * anything else gave up the cpu on its own.
+		 */
+		if (newstate == S_READY && cur->t_in_interrupt) {
+			curcpu->c_stats.ss_involuntary++;
+		}
+		else {
+			curcpu->c_stats.ss_voluntary++;
+		}
+	}
+#endif
+
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
 	 * curthread and it may not be, depending on how curthread and
@@ -779,6 +1108,14 @@ thread_exit(void)
 
 	cur = curthread;
 
+	/* Give back any real-time reservation. */
+	if (cur->t_rt) {
+		thread_clear_realtime();
+	}
+
+	/* Nothing can still be inheriting through us. */
+	KASSERT(cur->t_pilocks == NULL);
+
 	/*
 	 * Detach from our process. You might need to move this action
 	 * around, depending on how your wait/exit works.
@@ -794,7 +1131,7 @@ thread_exit(void)
 
 	/* Interrupts off on this processor */
         splhigh();
-	thread_switch(S_ZOMBIE, NULL, NULL);
+	thread_switch(S_ZOMBIE, NULL, NULL, NULL);
 	panic("braaaaaaaiiiiiiiiiiinssssss\n");
 }
 
@@ -804,7 +1141,7 @@ thread_exit(void)
 void
 thread_yield(void)
 {
-	thread_switch(S_READY, NULL, NULL);
+	thread_switch(S_READY, NULL, NULL, NULL);
 }
 
 ////////////////////////////////////////////////////////////
@@ -906,8 +1243,11 @@ thread_consider_migration(void)
 			 * the list and decrement to_send in order to
 			 * skip it. Then it goes back on our own run
 			 * queue below.
+			 *
+			 * Threads pinned to this cpu get the same
+			 * treatment.
 			 */
-			if (t == curthread) {
+			if (t == curthread || t->t_pinned) {
 				threadlist_addtail(&victims, t);
 				to_send--;
 				continue;
@@ -915,6 +1255,10 @@ thread_consider_migration(void)
 
 			t->t_cpu = c;
 			threadlist_addtail(&c->c_runqueue, t);
+#if OPT_SCHEDSTATS
+			curcpu->c_stats.ss_migrations_out++;
+			c->c_stats.ss_migrations_in++;
+#endif
 			DEBUG(DB_THREADS,
 			      "Migrated thread %s: cpu %u -> %u",
 			      t->t_name, curcpu->c_number, c->c_number);
@@ -949,6 +1293,222 @@ thread_consider_migration(void)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Priorities.
+ *
+ * The base priority is only ever changed by the thread itself, so it
+ * can be read without locking; the effective priority belongs to the
+ * priority inheritance code in synch.c, which recomputes it.
+ */
+
+int
+thread_set_priority(int pri)
+{
+	if (pri < THREAD_PRI_MIN || pri > THREAD_PRI_MAX) {
+		return EINVAL;
+	}
+	lock_pi_setbase(curthread, pri);
+	return 0;
+}
+
+int
+thread_get_priority(void)
+{
+	return curthread->t_pri;
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Real-time scheduling.
+ *
+ * This is plain EDF with a per-thread constant bandwidth: each
+ * real-time thread gets BUDGET hardclocks of cpu every PERIOD, and
+ * its current job must be done by release + DEADLINE. The
+ * admission test is the usual density bound, sum(budget/deadline)
+ * <= 1 per cpu, which guarantees every deadline is met as long as
+ * threads stay within their budgets. Since a thread that overruns
+ * is throttled, a misbehaving thread can only hurt itself.
+ *
+ * Times are kept in hardclocks of the thread's cpu, so the scheduler
+ * has a resolution of 1/HZ. The comparisons are done with signed
+ * differences so they survive wraparound of the hardclock count.
+ */
+
+/*
+ * Density of a (budget, deadline) pair, in thousandths.
+ */
+static
+unsigned
+thread_rt_density(unsigned budget, unsigned deadline)
+{
+	return DIVROUNDUP(budget * 1000, deadline);
+}
+
+/*
+ * Start T's next period, skipping any periods that have entirely
+ * passed.
+ */
+static
+void
+thread_rt_release(struct thread *t, unsigned now)
+{
+	while ((int)(now - (t->t_rt_release + t->t_rt_period)) >= 0) {
+		t->t_rt_release += t->t_rt_period;
+	}
+	t->t_rt_absdeadline = t->t_rt_release + t->t_rt_deadline;
+	t->t_rt_used = 0;
+	t->t_rt_throttled = false;
+	t->t_rt_exhausted = false;
+}
+
+int
+thread_set_realtime(unsigned period, unsigned budget, unsigned deadline)
+{
+	struct thread *cur = curthread;
+	struct cpu *c;
+	unsigned density;
+
+	if (budget == 0 || budget > deadline || deadline > period) {
+		return EINVAL;
+	}
+	density = thread_rt_density(budget, deadline);
+
+	spinlock_acquire(&cur->t_cpu->c_runqueue_lock);
+	c = cur->t_cpu;
+
+	if (cur->t_rt) {
+		/* Changing parameters; don't count the old ones twice */
+		c->c_rtutil -= thread_rt_density(cur->t_rt_budget,
+						 cur->t_rt_deadline);
+	}
+	if (c->c_rtutil + density > 1000) {
+		if (cur->t_rt) {
+			c->c_rtutil += thread_rt_density(cur->t_rt_budget,
+							 cur->t_rt_deadline);
+		}
+		spinlock_release(&c->c_runqueue_lock);
+		return EAGAIN;
+	}
+	c->c_rtutil += density;
+
+	if (!cur->t_rt) {
+		cur->t_rt_waspinned = cur->t_pinned;
+	}
+	cur->t_rt = true;
+	cur->t_pinned = true;
+	cur->t_rt_throttled = false;
+	cur->t_rt_exhausted = false;
+	cur->t_rt_period = period;
+	cur->t_rt_budget = budget;
+	cur->t_rt_deadline = deadline;
+	cur->t_rt_release = percpu_counter_read_cpu(&hardclocks, c);
+	cur->t_rt_absdeadline = cur->t_rt_release + deadline;
+	cur->t_rt_used = 0;
+	cur->t_rt_misses = 0;
+	cur->t_rt_overruns = 0;
+
+	spinlock_release(&c->c_runqueue_lock);
+	return 0;
+}
+
+void
+thread_clear_realtime(void)
+{
+	struct thread *cur = curthread;
+	struct cpu *c;
+
+	spinlock_acquire(&cur->t_cpu->c_runqueue_lock);
+	c = cur->t_cpu;
+	if (cur->t_rt) {
+		c->c_rtutil -= thread_rt_density(cur->t_rt_budget,
+						 cur->t_rt_deadline);
+		cur->t_rt = false;
+		cur->t_rt_throttled = false;
+		cur->t_rt_exhausted = false;
+		cur->t_pinned = cur->t_rt_waspinned;
+	}
+	spinlock_release(&c->c_runqueue_lock);
+}
+
+/*
+ * Finish the current job and wait for the next release.
+ *
+ * Interrupts are held off from marking ourselves throttled until
+ * we're off the cpu, so hardclock can't see the intermediate state.
+ */
+void
+thread_rt_waitperiod(void)
+{
+	struct thread *cur = curthread;
+	struct cpu *c;
+	int spl;
+
+	KASSERT(cur->t_rt);
+
+	spl = splhigh();
+	c = cur->t_cpu;
+	spinlock_acquire(&c->c_runqueue_lock);
+	if ((int)(percpu_counter_read_cpu(&hardclocks, c) -
+		  cur->t_rt_absdeadline) > 0) {
+		cur->t_rt_misses++;
+	}
+	cur->t_rt_throttled = true;
+	spinlock_release(&c->c_runqueue_lock);
+
+	thread_yield();
+	splx(spl);
+}
+
+/*
+ * Per-hardclock real-time work: charge the running thread for the
+ * tick, throttling it if it's out of budget, and release any waiting
+ * threads whose next period has begun. The hardclock code yields
+ * right after this, which does the actual preemption.
+ */
+void
+thread_rt_tick(void)
+{
+	struct cpu *c = curcpu->c_self;
+	struct thread *cur = curthread;
+	struct thread *t, *next;
+	unsigned now;
+
+	/* Unlocked peek; nothing to do on cpus without real-time work */
+	if (c->c_rtutil == 0) {
+		return;
+	}
+
+	spinlock_acquire(&c->c_runqueue_lock);
+	now = percpu_counter_read_cpu(&hardclocks, c);
+
+	if (!c->c_isidle && cur->t_rt && !cur->t_rt_throttled) {
+		cur->t_rt_used++;
+		/*
+		 * Never run past the budget; admission counts on it.
+		 * Whether that was an overrun depends on whether the
+		 * thread still wants the cpu, which thread_enqueue sees.
+		 */
+		if (cur->t_rt_used >= cur->t_rt_budget) {
+			cur->t_rt_throttled = true;
+			cur->t_rt_exhausted = true;
+		}
+	}
+
+	for (t = c->c_rtwait.tl_head.tln_next->tln_self; t != NULL; t = next) {
+		next = t->t_listnode.tln_next->tln_self;
+		if ((int)(now - (t->t_rt_release + t->t_rt_period)) >= 0) {
+			threadlist_remove(&c->c_rtwait, t);
+			thread_rt_release(t, now);
+			thread_rt_enqueue(c, t);
+		}
+	}
+
+	spinlock_release(&c->c_runqueue_lock);
+}
+
+////////////////////////////////////////////////////////////
+
 /*
  * Wait channel functions
  */
@@ -1006,12 +1566,58 @@ wchan_sleep(struct wchan *wc, struct spinlock *lk)
 	/* must not hold other spinlocks */
 	KASSERT(curcpu->c_spinlocks == 1);
 
-	thread_switch(S_SLEEP, wc, lk);
+	thread_switch(S_SLEEP, wc, lk, NULL);
 	spinlock_acquire(lk);
 }
 
 /*
- * Wake up one thread sleeping on a wait channel.
+ * Wake the first thread sleeping on WAKEWC and go to sleep on
+ * SLEEPWC, both protected by LK, which must be locked.
+ *
+ * If the woken thread is on this cpu the cpu goes straight to it,
+ * with no trip through the run queue; this is what makes synchronous
+ * request/reply cheap. If it is on another cpu and wake-affine is on,
+ * it is pulled over here first, since this cpu is about to be free
+ * and has the data the two share in its cache. Otherwise (or if it is
+ * a real-time or pinned thread, which stay put) it is woken normally.
+ */
+void
+wchan_sleep_handoff(struct wchan *sleepwc, struct wchan *wakewc,
+		    struct spinlock *lk)
+{
+	struct thread *target;
+
+	/* may not sleep in an interrupt handler */
+	KASSERT(!curthread->t_in_interrupt);
+
+	/* must hold the spinlock */
+	KASSERT(spinlock_do_i_hold(lk));
+
+	/* must not hold other spinlocks */
+	KASSERT(curcpu->c_spinlocks == 1);
+
+	target = thread_highest(&wakewc->wc_threads);
+	if (target != NULL) {
+		threadlist_remove(&wakewc->wc_threads, target);
+	}
+	if (target != NULL && target->t_cpu != curcpu->c_self &&
+	    wchan_wake_affine && !target->t_pinned && !target->t_rt) {
+		thread_pull(target);
+	}
+	if (target != NULL &&
+	    (target->t_cpu != curcpu->c_self || target->t_rt)) {
+		/* Same lock order as wchan_wakeone */
+		thread_make_runnable(target, false);
+		target = NULL;
+	}
+
+	thread_switch(S_SLEEP, sleepwc, lk, target);
+	spinlock_acquire(lk);
+}
+
+/*
+ * Wake up one thread sleeping on a wait channel: the most important
+ * one, and the one that has waited longest among equals.
  */
 void
 wchan_wakeone(struct wchan *wc, struct spinlock *lk)
@@ -1021,12 +1627,13 @@ wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 	KASSERT(spinlock_do_i_hold(lk));
 
 	/* Grab a thread from the channel */
-	target = threadlist_remhead(&wc->wc_threads);
+	target = thread_highest(&wc->wc_threads);
 
 	if (target == NULL) {
 		/* Nobody was sleeping. */
 		return;
 	}
+	threadlist_remove(&wc->wc_threads, target);
 
 	/*
 	 * Note that thread_make_runnable acquires a runqueue lock
@@ -1039,6 +1646,31 @@ wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 	thread_make_runnable(target, false);
 }
 
+/*
+ * Wake up one particular thread sleeping on a wait channel. Go by
+ * whether T is on the channel's list, which LK protects, not by
+ * t_state: thread_switch puts T on the list and drops LK before it
+ * sets S_SLEEP. (Making T runnable while it is still switching out
+ * is fine; see wchan_wakeone.)
+ */
+bool
+wchan_wakethread(struct wchan *wc, struct spinlock *lk, struct thread *t)
+{
+	struct threadlistnode *tln;
+
+	KASSERT(spinlock_do_i_hold(lk));
+
+	for (tln = wc->wc_threads.tl_head.tln_next; tln->tln_self != NULL;
+	     tln = tln->tln_next) {
+		if (tln->tln_self == t) {
+			threadlist_remove(&wc->wc_threads, t);
+			thread_make_runnable(t, false);
+			return true;
+		}
+	}
+	return false;
+}
+
 /*
  * Wake up all threads sleeping on a wait channel.
  */
@@ -1047,6 +1679,9 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 {
 	struct thread *target;
 	struct threadlist list;
+	struct cpu *c;
+	uint32_t unidle;
+	unsigned i;
 
 	KASSERT(spinlock_do_i_hold(lk));
 
@@ -1061,12 +1696,39 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 	}
 
 	/*
-	 * We could conceivably sort by cpu first to cause fewer lock
-	 * ops and fewer IPIs, but for now at least don't bother. Just
-	 * make each thread runnable.
+	 * Make each thread runnable. Keep a run queue locked for as
+	 * long as consecutive threads go to the same cpu, and collect
+	 * the idle cpus that need waking, so that each gets one IPI
+	 * however many threads it got. (Lock order as in
+	 * wchan_wakeone.)
 	 */
+	c = NULL;
+	unidle = 0;
 	while ((target = threadlist_remhead(&list)) != NULL) {
-		thread_make_runnable(target, false);
+		if (target->t_cpu != c) {
+			if (c != NULL) {
+				spinlock_release(&c->c_runqueue_lock);
+			}
+			c = target->t_cpu;
+			spinlock_acquire(&c->c_runqueue_lock);
+		}
+		if (thread_enqueue(target)) {
+			if (c->c_number < 32) {
+				unidle |= (uint32_t)1 << c->c_number;
+			}
+			else {
+				ipi_send(c, IPI_UNIDLE);
+			}
+		}
+	}
+	if (c != NULL) {
+		spinlock_release(&c->c_runqueue_lock);
+	}
+
+	for (i=0; unidle != 0; i++, unidle >>= 1) {
+		if (unidle & 1) {
+			ipi_send(cpuarray_get(&allcpus, i), IPI_UNIDLE);
+		}
 	}
 
 	threadlist_cleanup(&list);
@@ -1105,6 +1767,9 @@ ipi_send(struct cpu *target, int code)
 	target->c_ipi_pending |= (uint32_t)1 << code;
 	mainbus_send_ipi(target);
 	spinlock_release(&target->c_ipi_lock);
+#if OPT_SCHEDSTATS
+	curcpu->c_stats.ss_ipis_sent++;
+#endif
 }
 
 /*
@@ -1156,6 +1821,9 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 	mainbus_send_ipi(target);
 
 	spinlock_release(&target->c_ipi_lock);
+#if OPT_SCHEDSTATS
+	curcpu->c_stats.ss_ipis_sent++;
+#endif
 }
 
 /*
@@ -1169,6 +1837,9 @@ interprocessor_interrupt(void)
 
 	spinlock_acquire(&curcpu->c_ipi_lock);
 	bits = curcpu->c_ipi_pending;
+#if OPT_SCHEDSTATS
+	curcpu->c_stats.ss_ipis_received++;
+#endif
 
 	if (bits & (1U << IPI_PANIC)) {
 		/* panic on another cpu - just stop dead */
@@ -0,0 +1,272 @@
+/*
+ * Per-cpu workqueues. See workqueue.h for the interface.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <membar.h>
+#include <wchan.h>
+#include <thread.h>
+#include <current.h>
+#include <clock.h>
+#include <percpu.h>
+#include <workqueue.h>
+
+/* Number of worker threads per cpu. */
+#define WORKQUEUE_WORKERS	2
+
+struct workqueue {
+	struct spinlock wq_lock;	/* Protects everything here */
+	struct work *wq_head;		/* Work ready to run, FIFO */
+	struct work **wq_tailp;
+	struct work *wq_delayed;	/* Delayed work, sorted by w_due */
+	struct wchan *wq_wchan;		/* Idle workers sleep here */
+	unsigned wq_idle;		/* Number of idle workers */
+};
+
+/*
+ * Set up a work item.
+ */
+void
+work_init(struct work *w, void (*func)(void *), void *arg)
+{
+	w->w_next = NULL;
+	w->w_func = func;
+	w->w_arg = arg;
+	w->w_due = 0;
+	w->w_wq = NULL;
+	spinlock_data_set(&w->w_pending, 0);
+}
+
+/*
+ * Append W to the ready list. If the list was empty, wake a worker;
+ * if it wasn't, a worker is already on its way and will pick W up in
+ * the same batch.
+ */
+static
+void
+workqueue_ready(struct workqueue *wq, struct work *w)
+{
+	bool wasempty;
+
+	KASSERT(spinlock_do_i_hold(&wq->wq_lock));
+
+	wasempty = (wq->wq_head == NULL);
+	w->w_next = NULL;
+	*wq->wq_tailp = w;
+	wq->wq_tailp = &w->w_next;
+
+	if (wasempty && wq->wq_idle > 0) {
+		wchan_wakeone(wq->wq_wchan, &wq->wq_lock);
+	}
+}
+
+bool
+workqueue_enqueue(struct work *w)
+{
+	return workqueue_enqueue_delayed(w, 0);
+}
+
+bool
+workqueue_enqueue_delayed(struct work *w, unsigned ticks)
+{
+	struct workqueue *wq;
+	struct work **pp;
+
+	/*
+	 * Another cpu may be enqueueing W on its own queue, under its
+	 * own lock, so claim it atomically rather than under ours.
+	 */
+	if (spinlock_data_testandset(&w->w_pending) != 0) {
+		return false;
+	}
+
+	wq = curcpu->c_workqueue;
+	KASSERT(wq != NULL);
+
+	spinlock_acquire(&wq->wq_lock);
+	if (ticks == 0) {
+		workqueue_ready(wq, w);
+	}
+	else {
+		w->w_due = percpu_counter_read_cpu(&hardclocks,
+						   curcpu->c_self) + ticks;
+		for (pp = &wq->wq_delayed; *pp != NULL; pp = &(*pp)->w_next) {
+			if ((int)((*pp)->w_due - w->w_due) > 0) {
+				break;
+			}
+		}
+		w->w_next = *pp;
+		*pp = w;
+		w->w_wq = wq;
+	}
+	spinlock_release(&wq->wq_lock);
+	return true;
+}
+
+bool
+workqueue_cancel(struct work *w)
+{
+	struct workqueue *wq;
+	struct work **pp;
+	bool found;
+
+	/* Only delayed work can be caught; w_wq says on which queue */
+	wq = w->w_wq;
+	if (wq == NULL) {
+		return false;
+	}
+
+	found = false;
+	spinlock_acquire(&wq->wq_lock);
+	for (pp = &wq->wq_delayed; *pp != NULL; pp = &(*pp)->w_next) {
+		if (*pp == w) {
+			*pp = w->w_next;
+			w->w_next = NULL;
+			w->w_wq = NULL;
+			found = true;
+			break;
+		}
+	}
+	spinlock_release(&wq->wq_lock);
+
+	if (found) {
+		membar_any_any();
+		spinlock_data_set(&w->w_pending, 0);
+	}
+	return found;
+}
+
+/*
+ * Called from hardclock on each cpu: move delayed work whose time has
+ * come onto the ready list.
+ */
+void
+workqueue_tick(void)
+{
+	struct workqueue *wq;
+	struct work *w;
+	unsigned now;
+
+	wq = curcpu->c_workqueue;
+	if (wq == NULL) {
+		/* Not started yet. */
+		return;
+	}
+
+	/* Cheap unlocked check for the common case of nothing delayed */
+	if (wq->wq_delayed == NULL) {
+		return;
+	}
+
+	now = percpu_counter_read_cpu(&hardclocks, curcpu->c_self);
+	spinlock_acquire(&wq->wq_lock);
+	while ((w = wq->wq_delayed) != NULL && (int)(w->w_due - now) <= 0) {
+		wq->wq_delayed = w->w_next;
+		w->w_wq = NULL;
+		workqueue_ready(wq, w);
+	}
+	spinlock_release(&wq->wq_lock);
+}
+
+/*
+ * Worker thread. Grab everything on the ready list and run it, then
+ * sleep until there's more.
+ */
+static
+void
+workqueue_worker(void *data1, unsigned long data2)
+{
+	struct workqueue *wq = data1;
+	struct work *batch, *w;
+	void (*func)(void *);
+	void *arg;
+
+	(void)data2;
+
+	spinlock_acquire(&wq->wq_lock);
+	while (1) {
+		while (wq->wq_head == NULL) {
+			wq->wq_idle++;
+			wchan_sleep(wq->wq_wchan, &wq->wq_lock);
+			wq->wq_idle--;
+		}
+
+		batch = wq->wq_head;
+		wq->wq_head = NULL;
+		wq->wq_tailp = &wq->wq_head;
+		spinlock_release(&wq->wq_lock);
+
+		while (batch != NULL) {
+			w = batch;
+			batch = w->w_next;
+			w->w_next = NULL;
+			func = w->w_func;
+			arg = w->w_arg;
+			/*
+			 * Clear pending first so the function can requeue.
+			 * From then on another cpu may queue W, so all we
+			 * still use of it is read by now.
+			 */
+			membar_any_any();
+			spinlock_data_set(&w->w_pending, 0);
+			func(arg);
+		}
+
+		spinlock_acquire(&wq->wq_lock);
+	}
+}
+
+/*
+ * Create the workqueue for cpu C and start its workers.
+ */
+static
+void
+workqueue_create(struct cpu *c)
+{
+	struct workqueue *wq;
+	char name[32];
+	unsigned i;
+	int result;
+
+	wq = kmalloc(sizeof(*wq));
+	if (wq == NULL) {
+		panic("workqueue_create: Out of memory\n");
+	}
+	spinlock_init(&wq->wq_lock);
+	wq->wq_head = NULL;
+	wq->wq_tailp = &wq->wq_head;
+	wq->wq_delayed = NULL;
+	wq->wq_idle = 0;
+	wq->wq_wchan = wchan_create("workqueue");
+	if (wq->wq_wchan == NULL) {
+		panic("workqueue_create: wchan_create failed\n");
+	}
+
+	for (i=0; i<WORKQUEUE_WORKERS; i++) {
+		snprintf(name, sizeof(name), "worker/%u:%u", c->c_number, i);
+		result = thread_fork_oncpu(name, NULL, c, workqueue_worker,
+					   wq, 0);
+		if (result) {
+			panic("workqueue_create: thread_fork: %s\n",
+			      strerror(result));
+		}
+	}
+
+	c->c_workqueue = wq;
+}
+
+/*
+ * Start workqueues on all cpus.
+ */
+void
+workqueue_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<cpu_count(); i++) {
+		workqueue_create(cpu_get(i));
+	}
+}
@@ -289,6 +289,22 @@ dev_namefile(struct vnode *v, struct uio *uio)
 	return 0;
 }
 
+/*
+ * For poll() and select(). Devices that don't say otherwise never
+ * block, as far as we know.
+ */
+static
+int
+dev_poll(struct vnode *v, int events, struct pollwait *pw)
+{
+	struct device *d = v->vn_data;
+
+	if (d->d_ops->devop_poll == NULL) {
+		return vopstub_poll_ready(v, events, pw);
+	}
+	return DEVOP_POLL(d, events, pw);
+}
+
 /*
  * Name lookup.
  *
@@ -339,6 +355,7 @@ static const struct vnode_ops dev_vnode_ops = {
 	.vop_mmap = dev_mmap,
 	.vop_truncate = dev_truncate,
 	.vop_namefile = dev_namefile,
+	.vop_poll = dev_poll,
 	.vop_creat = vopfail_creat_notdir,
 	.vop_symlink = vopfail_symlink_notdir,
 	.vop_mkdir = vopfail_mkdir_notdir,
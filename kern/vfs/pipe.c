@@ -0,0 +1,494 @@
+/*
+ * Anonymous pipes. See pipe.h.
+ *
+ * The data lives in a PIPE_SIZE ring buffer. pi_head counts the bytes
+ * read and pi_tail the bytes written, both free-running, so the pipe
+ * holds pi_tail - pi_head bytes starting at pi_head % PIPE_SIZE.
+ *
+ * Each end is a single openfile (sys_pipe makes one per end, and dup2
+ * and fork share it), and the openfile's p_lock serializes I/O on it.
+ * So there's only ever one reader and one writer in here at a time.
+ * Only the reader stores pi_head and only the writer stores pi_tail,
+ * which lets them run without a lock between them: the writer fills
+ * bytes and then publishes pi_tail, the reader empties bytes and then
+ * publishes pi_head, with barriers in between.
+ *
+ * pi_lock is only for sleeping. A side that finds nothing to do sets
+ * its pi_*sleep flag and checks again under pi_lock before sleeping;
+ * the other side checks the flag after publishing, and takes pi_lock
+ * to wake it. Wakeups are batched: the reader wakes the writer once
+ * at the end of each read, and the writer wakes the reader at the end
+ * of each write or when it has to wait for room, not after every
+ * chunk.
+ *
+ * Closing an end (the last vfs_close of its vnode) marks it closed and
+ * wakes the other side. The pipe goes away when both ends have.
+ *
+ * Each end also has a pollq, woken along with the sleeper on that end,
+ * for poll() and select().
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/poll.h>
+#include <stat.h>
+#include <lib.h>
+#include <uio.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <membar.h>
+#include <vnode.h>
+#include <poll.h>
+#include <pipe.h>
+
+struct pipe {
+	struct vnode pi_rvn;		/* Read end */
+	struct vnode pi_wvn;		/* Write end */
+	char *pi_buf;			/* PIPE_SIZE bytes of data */
+	volatile unsigned pi_head;	/* Bytes read; only the reader stores */
+	volatile unsigned pi_tail;	/* Bytes written; only the writer stores */
+	volatile bool pi_rsleep;	/* Reader is going to sleep */
+	volatile bool pi_wsleep;	/* Writer is going to sleep */
+	volatile bool pi_rclosed;	/* Read end is gone */
+	volatile bool pi_wclosed;	/* Write end is gone */
+	unsigned pi_ends;		/* Ends not yet reclaimed */
+	struct spinlock pi_lock;	/* For sleeping, waking and closing */
+	struct wchan *pi_rwchan;	/* Reader sleeps here */
+	struct wchan *pi_wwchan;	/* Writer sleeps here */
+	struct pollq pi_rpq;		/* Pollers of the read end */
+	struct pollq pi_wpq;		/* Pollers of the write end */
+};
+
+static
+void
+pipe_destroy(struct pipe *pi)
+{
+	if (pi->pi_rwchan != NULL) {
+		wchan_destroy(pi->pi_rwchan);
+	}
+	if (pi->pi_wwchan != NULL) {
+		wchan_destroy(pi->pi_wwchan);
+	}
+	pollq_cleanup(&pi->pi_rpq);
+	pollq_cleanup(&pi->pi_wpq);
+	spinlock_cleanup(&pi->pi_lock);
+	kfree(pi->pi_buf);
+	kfree(pi);
+}
+
+/*
+ * Wake the side sleeping on WC (FLAG is its pi_*sleep), if it is, and
+ * anyone polling it on PQ. Called after publishing our counter.
+ */
+static
+void
+pipe_wake(struct pipe *pi, volatile bool *flag, struct wchan *wc,
+	  struct pollq *pq)
+{
+	/* Our counter has to be visible before we look at the flag */
+	membar_any_any();
+	pollq_wakeup(pq);
+	if (!*flag) {
+		return;
+	}
+	spinlock_acquire(&pi->pi_lock);
+	if (*flag) {
+		*flag = false;
+		wchan_wakeall(wc, &pi->pi_lock);
+	}
+	spinlock_release(&pi->pi_lock);
+}
+
+/*
+ * Wait until there's something to read past HEAD. Returns false if
+ * there isn't going to be: the write end is closed.
+ */
+static
+bool
+pipe_wait_data(struct pipe *pi, unsigned head)
+{
+	bool ret = true;
+
+	spinlock_acquire(&pi->pi_lock);
+	while (1) {
+		pi->pi_rsleep = true;
+		/* The flag has to be visible before we look at pi_tail */
+		membar_any_any();
+		if (pi->pi_tail != head) {
+			break;
+		}
+		if (pi->pi_wclosed) {
+			ret = false;
+			break;
+		}
+		wchan_sleep(pi->pi_rwchan, &pi->pi_lock);
+	}
+	pi->pi_rsleep = false;
+	spinlock_release(&pi->pi_lock);
+	return ret;
+}
+
+/*
+ * Wait until there's room to write at TAIL. Returns false if nobody is
+ * going to make any: the read end is closed.
+ */
+static
+bool
+pipe_wait_space(struct pipe *pi, unsigned tail)
+{
+	bool ret = true;
+
+	spinlock_acquire(&pi->pi_lock);
+	while (1) {
+		pi->pi_wsleep = true;
+		membar_any_any();
+		if (pi->pi_rclosed) {
+			ret = false;
+			break;
+		}
+		if (tail - pi->pi_head < PIPE_SIZE) {
+			break;
+		}
+		wchan_sleep(pi->pi_wwchan, &pi->pi_lock);
+	}
+	pi->pi_wsleep = false;
+	spinlock_release(&pi->pi_lock);
+	return ret;
+}
+
+static
+int
+pipe_read(struct vnode *vn, struct uio *uio)
+{
+	struct pipe *pi = vn->vn_data;
+	unsigned head, tail, off, len;
+	size_t start;
+	int result = 0;
+
+	if (vn != &pi->pi_rvn) {
+		return EBADF;
+	}
+
+	start = uio->uio_resid;
+	head = pi->pi_head;
+	while (uio->uio_resid > 0) {
+		tail = pi->pi_tail;
+		/* See pi_tail before the bytes it covers */
+		membar_load_load();
+		if (tail == head) {
+			/* Return what we have rather than wait for more */
+			if (uio->uio_resid < start || !pipe_wait_data(pi, head)) {
+				break;
+			}
+			continue;
+		}
+
+		off = head % PIPE_SIZE;
+		len = tail - head;
+		if (len > PIPE_SIZE - off) {
+			len = PIPE_SIZE - off;
+		}
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		result = uiomove(pi->pi_buf + off, len, uio);
+		if (result) {
+			break;
+		}
+
+		head += len;
+		/* Done with the bytes before handing them back */
+		membar_any_any();
+		pi->pi_head = head;
+	}
+
+	if (uio->uio_resid < start) {
+		pipe_wake(pi, &pi->pi_wsleep, pi->pi_wwchan, &pi->pi_wpq);
+	}
+	return result;
+}
+
+static
+int
+pipe_write(struct vnode *vn, struct uio *uio)
+{
+	struct pipe *pi = vn->vn_data;
+	unsigned head, tail, off, len;
+	size_t start;
+	int result = 0;
+
+	if (vn != &pi->pi_wvn) {
+		return EBADF;
+	}
+
+	start = uio->uio_resid;
+	tail = pi->pi_tail;
+	while (uio->uio_resid > 0) {
+		if (pi->pi_rclosed) {
+			result = EPIPE;
+			break;
+		}
+
+		head = pi->pi_head;
+		/* See pi_head before overwriting the bytes it freed */
+		membar_any_any();
+		if (tail - head == PIPE_SIZE) {
+			/* Let the reader at what we have, then wait */
+			pipe_wake(pi, &pi->pi_rsleep, pi->pi_rwchan, &pi->pi_rpq);
+			if (!pipe_wait_space(pi, tail)) {
+				result = EPIPE;
+				break;
+			}
+			continue;
+		}
+
+		off = tail % PIPE_SIZE;
+		len = PIPE_SIZE - (tail - head);
+		if (len > PIPE_SIZE - off) {
+			len = PIPE_SIZE - off;
+		}
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		result = uiomove(pi->pi_buf + off, len, uio);
+		if (result) {
+			break;
+		}
+
+		tail += len;
+		/* The bytes have to be there before pi_tail says so */
+		membar_store_store();
+		pi->pi_tail = tail;
+	}
+
+	if (uio->uio_resid < start) {
+		pipe_wake(pi, &pi->pi_rsleep, pi->pi_rwchan, &pi->pi_rpq);
+		/* Like any short write, report what got written */
+		result = 0;
+	}
+	return result;
+}
+
+static
+int
+pipe_eachopen(struct vnode *vn, int openflags)
+{
+	(void)vn;
+	(void)openflags;
+	return 0;
+}
+
+static
+int
+pipe_ioctl(struct vnode *vn, int op, userptr_t data)
+{
+	(void)vn;
+	(void)op;
+	(void)data;
+	return EINVAL;
+}
+
+static
+int
+pipe_stat(struct vnode *vn, struct stat *buf)
+{
+	struct pipe *pi = vn->vn_data;
+
+	bzero(buf, sizeof(*buf));
+	buf->st_mode = S_IFIFO | (vn == &pi->pi_rvn ? 0400 : 0200);
+	buf->st_size = pi->pi_tail - pi->pi_head;
+	buf->st_nlink = 1;
+	buf->st_blksize = PIPE_SIZE;
+	return 0;
+}
+
+static
+int
+pipe_gettype(struct vnode *vn, mode_t *ret)
+{
+	(void)vn;
+	*ret = S_IFIFO;
+	return 0;
+}
+
+static
+bool
+pipe_isseekable(struct vnode *vn)
+{
+	(void)vn;
+	return false;
+}
+
+static
+int
+pipe_fsync(struct vnode *vn)
+{
+	(void)vn;
+	return 0;
+}
+
+static
+int
+pipe_truncate(struct vnode *vn, off_t len)
+{
+	(void)vn;
+	(void)len;
+	return EINVAL;
+}
+
+/*
+ * Readiness. Each end only answers for its own direction: the read end
+ * is readable when there's data or the writer is gone (POLLHUP), the
+ * write end writable when there's room or the reader is gone
+ * (POLLERR, and the write fails with EPIPE).
+ */
+static
+int
+pipe_poll(struct vnode *vn, int events, struct pollwait *pw)
+{
+	struct pipe *pi = vn->vn_data;
+	int ret = 0;
+
+	if (vn == &pi->pi_rvn) {
+		pollq_register(&pi->pi_rpq, pw);
+		if (pi->pi_wclosed) {
+			ret |= POLLHUP | (events & POLLIN);
+		}
+		else if ((events & POLLIN) && pi->pi_tail != pi->pi_head) {
+			ret |= POLLIN;
+		}
+	}
+	else {
+		pollq_register(&pi->pi_wpq, pw);
+		if (pi->pi_rclosed) {
+			ret |= POLLERR | (events & POLLOUT);
+		}
+		else if ((events & POLLOUT) &&
+			 pi->pi_tail - pi->pi_head < PIPE_SIZE) {
+			ret |= POLLOUT;
+		}
+	}
+	return ret;
+}
+
+/*
+ * Reclaim: the last reference to one end is gone. Nobody can find a
+ * pipe vnode except through a reference they already have, so unlike
+ * in a filesystem there's no racing lookup to worry about.
+ */
+static
+int
+pipe_reclaim(struct vnode *vn)
+{
+	struct pipe *pi = vn->vn_data;
+	bool last;
+
+	spinlock_acquire(&pi->pi_lock);
+	if (vn == &pi->pi_rvn) {
+		pi->pi_rclosed = true;
+		pi->pi_wsleep = false;
+		wchan_wakeall(pi->pi_wwchan, &pi->pi_lock);
+	}
+	else {
+		pi->pi_wclosed = true;
+		pi->pi_rsleep = false;
+		wchan_wakeall(pi->pi_rwchan, &pi->pi_lock);
+	}
+	spinlock_release(&pi->pi_lock);
+
+	/*
+	 * Our end still counts in pi_ends, so the other end's reclaim
+	 * can't free the pipe under these. Once we drop it, only the
+	 * last one out may touch pi.
+	 */
+	pollq_wakeup(vn == &pi->pi_rvn ? &pi->pi_wpq : &pi->pi_rpq);
+	vnode_cleanup(vn);
+
+	spinlock_acquire(&pi->pi_lock);
+	KASSERT(pi->pi_ends > 0);
+	pi->pi_ends--;
+	last = (pi->pi_ends == 0);
+	spinlock_release(&pi->pi_lock);
+
+	if (last) {
+		pipe_destroy(pi);
+	}
+	return 0;
+}
+
+static const struct vnode_ops pipe_vnode_ops = {
+	.vop_magic = VOP_MAGIC,
+
+	.vop_eachopen = pipe_eachopen,
+	.vop_reclaim = pipe_reclaim,
+
+	.vop_read = pipe_read,
+	.vop_readlink = vopfail_uio_inval,
+	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_write = pipe_write,
+	.vop_ioctl = pipe_ioctl,
+	.vop_stat = pipe_stat,
+	.vop_gettype = pipe_gettype,
+	.vop_isseekable = pipe_isseekable,
+	.vop_fsync = pipe_fsync,
+	.vop_mmap = vopfail_mmap_perm,
+	.vop_truncate = pipe_truncate,
+	.vop_namefile = vopfail_uio_notdir,
+	.vop_poll = pipe_poll,
+
+	.vop_creat = vopfail_creat_notdir,
+	.vop_symlink = vopfail_symlink_notdir,
+	.vop_mkdir = vopfail_mkdir_notdir,
+	.vop_link = vopfail_link_notdir,
+	.vop_remove = vopfail_string_notdir,
+	.vop_rmdir = vopfail_string_notdir,
+	.vop_rename = vopfail_rename_notdir,
+	.vop_lookup = vopfail_lookup_notdir,
+	.vop_lookparent = vopfail_lookparent_notdir,
+};
+
+int
+pipe_create(struct vnode **ret_rvn, struct vnode **ret_wvn)
+{
+	struct pipe *pi;
+	int result;
+
+	pi = kmalloc(sizeof(*pi));
+	if (pi == NULL) {
+		return ENOMEM;
+	}
+	pi->pi_buf = kmalloc(PIPE_SIZE);
+	pi->pi_rwchan = wchan_create("pipe_r");
+	pi->pi_wwchan = wchan_create("pipe_w");
+	spinlock_init(&pi->pi_lock);
+	pollq_init(&pi->pi_rpq);
+	pollq_init(&pi->pi_wpq);
+	if (pi->pi_buf == NULL || pi->pi_rwchan == NULL ||
+	    pi->pi_wwchan == NULL) {
+		pipe_destroy(pi);
+		return ENOMEM;
+	}
+	pi->pi_head = 0;
+	pi->pi_tail = 0;
+	pi->pi_rsleep = false;
+	pi->pi_wsleep = false;
+	pi->pi_rclosed = false;
+	pi->pi_wclosed = false;
+	pi->pi_ends = 2;
+
+	result = vnode_init(&pi->pi_rvn, &pipe_vnode_ops, NULL, pi);
+	if (result) {
+		pipe_destroy(pi);
+		return result;
+	}
+	result = vnode_init(&pi->pi_wvn, &pipe_vnode_ops, NULL, pi);
+	if (result) {
+		vnode_cleanup(&pi->pi_rvn);
+		pipe_destroy(pi);
+		return result;
+	}
+
+	*ret_rvn = &pi->pi_rvn;
+	*ret_wvn = &pi->pi_wvn;
+	return 0;
+}
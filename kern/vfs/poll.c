@@ -0,0 +1,272 @@
+/*
+ * Readiness notification. See poll.h.
+ *
+ * Lock order: pq_lock, then pw_lock. A polltimer's lock comes before
+ * pw_lock too; it is never held together with a pq_lock.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/poll.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <membar.h>
+#include <workqueue.h>
+#include <vnode.h>
+#include <poll.h>
+
+/*
+ * Timeout for a pollwait. pollwait_cleanup cancels the work item if it
+ * can, but by then it may already be on its way, to fire after the
+ * poll is over and the pollwait is gone: it only touches the pollwait
+ * while pt_done is clear, and whichever of the two runs last frees
+ * this. The flags are protected by pt_lock.
+ */
+struct polltimer {
+	struct work pt_work;
+	struct spinlock pt_lock;
+	struct pollwait *pt_pw;
+	bool pt_expired;		/* Set by the work item */
+	bool pt_done;			/* Set by pollwait_cleanup */
+};
+
+////////////////////////////////////////////////////////////
+// pollq
+
+void
+pollq_init(struct pollq *pq)
+{
+	spinlock_init(&pq->pq_lock);
+	pq->pq_list = NULL;
+}
+
+void
+pollq_cleanup(struct pollq *pq)
+{
+	KASSERT(pq->pq_list == NULL);
+	spinlock_cleanup(&pq->pq_lock);
+}
+
+void
+pollq_register(struct pollq *pq, struct pollwait *pw)
+{
+	struct pollent *pe;
+
+	if (pw == NULL) {
+		return;
+	}
+
+	if (pw->pw_nents == pw->pw_maxents) {
+		/* No room; just keep the poller from sleeping */
+		spinlock_acquire(&pw->pw_lock);
+		pw->pw_woken = true;
+		spinlock_release(&pw->pw_lock);
+		return;
+	}
+
+	pe = &pw->pw_ents[pw->pw_nents++];
+	pe->pe_q = pq;
+	pe->pe_pw = pw;
+
+	spinlock_acquire(&pq->pq_lock);
+	pe->pe_next = pq->pq_list;
+	if (pe->pe_next != NULL) {
+		pe->pe_next->pe_prevp = &pe->pe_next;
+	}
+	pe->pe_prevp = (struct pollent **)&pq->pq_list;
+	pq->pq_list = pe;
+	spinlock_release(&pq->pq_lock);
+
+	/* Be on the list before the caller looks at the state */
+	membar_any_any();
+}
+
+void
+pollq_wakeup(struct pollq *pq)
+{
+	struct pollent *pe;
+	struct pollwait *pw;
+
+	/* The state change has to be visible before we look */
+	membar_any_any();
+	if (pq->pq_list == NULL) {
+		return;
+	}
+
+	spinlock_acquire(&pq->pq_lock);
+	for (pe = pq->pq_list; pe != NULL; pe = pe->pe_next) {
+		pw = pe->pe_pw;
+		spinlock_acquire(&pw->pw_lock);
+		if (!pw->pw_woken) {
+			pw->pw_woken = true;
+			wchan_wakeall(pw->pw_wchan, &pw->pw_lock);
+		}
+		spinlock_release(&pw->pw_lock);
+	}
+	spinlock_release(&pq->pq_lock);
+}
+
+////////////////////////////////////////////////////////////
+// pollwait
+
+int
+pollwait_init(struct pollwait *pw, struct pollent *ents, unsigned nents)
+{
+	pw->pw_wchan = wchan_create("poll");
+	if (pw->pw_wchan == NULL) {
+		return ENOMEM;
+	}
+	spinlock_init(&pw->pw_lock);
+	pw->pw_woken = false;
+	pw->pw_timedout = false;
+	pw->pw_interrupted = false;
+	pw->pw_ents = ents;
+	pw->pw_nents = 0;
+	pw->pw_maxents = nents;
+	pw->pw_timer = NULL;
+	pw->pw_next = NULL;
+	return 0;
+}
+
+static
+void
+polltimer_expire(void *data)
+{
+	struct polltimer *pt = data;
+	struct pollwait *pw;
+	bool done;
+
+	spinlock_acquire(&pt->pt_lock);
+	pt->pt_expired = true;
+	done = pt->pt_done;
+	if (!done) {
+		pw = pt->pt_pw;
+		spinlock_acquire(&pw->pw_lock);
+		pw->pw_timedout = true;
+		wchan_wakeall(pw->pw_wchan, &pw->pw_lock);
+		spinlock_release(&pw->pw_lock);
+	}
+	spinlock_release(&pt->pt_lock);
+
+	if (done) {
+		spinlock_cleanup(&pt->pt_lock);
+		kfree(pt);
+	}
+}
+
+int
+pollwait_settimeout(struct pollwait *pw, unsigned ticks)
+{
+	struct polltimer *pt;
+
+	KASSERT(pw->pw_timer == NULL);
+
+	pt = kmalloc(sizeof(*pt));
+	if (pt == NULL) {
+		return ENOMEM;
+	}
+	work_init(&pt->pt_work, polltimer_expire, pt);
+	spinlock_init(&pt->pt_lock);
+	pt->pt_pw = pw;
+	pt->pt_expired = false;
+	pt->pt_done = false;
+
+	pw->pw_timer = pt;
+	workqueue_enqueue_delayed(&pt->pt_work, ticks);
+	return 0;
+}
+
+void
+pollwait_prepare(struct pollwait *pw)
+{
+	spinlock_acquire(&pw->pw_lock);
+	pw->pw_woken = false;
+	spinlock_release(&pw->pw_lock);
+}
+
+int
+pollwait_sleep(struct pollwait *pw)
+{
+	int result;
+
+	spinlock_acquire(&pw->pw_lock);
+	while (!pw->pw_woken && !pw->pw_timedout && !pw->pw_interrupted) {
+		wchan_sleep(pw->pw_wchan, &pw->pw_lock);
+	}
+	if (pw->pw_interrupted) {
+		result = EINTR;
+	}
+	else if (pw->pw_woken) {
+		result = 0;
+	}
+	else {
+		result = ETIMEDOUT;
+	}
+	spinlock_release(&pw->pw_lock);
+	return result;
+}
+
+void
+pollwait_interrupt(struct pollwait *pw)
+{
+	spinlock_acquire(&pw->pw_lock);
+	pw->pw_interrupted = true;
+	wchan_wakeall(pw->pw_wchan, &pw->pw_lock);
+	spinlock_release(&pw->pw_lock);
+}
+
+void
+pollwait_cleanup(struct pollwait *pw)
+{
+	struct polltimer *pt;
+	struct pollent *pe;
+	struct pollq *pq;
+	unsigned i;
+	bool expired;
+
+	for (i=0; i<pw->pw_nents; i++) {
+		pe = &pw->pw_ents[i];
+		pq = pe->pe_q;
+		spinlock_acquire(&pq->pq_lock);
+		if (pe->pe_next != NULL) {
+			pe->pe_next->pe_prevp = pe->pe_prevp;
+		}
+		*pe->pe_prevp = pe->pe_next;
+		spinlock_release(&pq->pq_lock);
+	}
+	pw->pw_nents = 0;
+
+	pt = pw->pw_timer;
+	if (pt != NULL && workqueue_cancel(&pt->pt_work)) {
+		/* It will never fire; don't leave it queued till it would */
+		spinlock_cleanup(&pt->pt_lock);
+		kfree(pt);
+		pw->pw_timer = NULL;
+	}
+	else if (pt != NULL) {
+		spinlock_acquire(&pt->pt_lock);
+		pt->pt_done = true;
+		expired = pt->pt_expired;
+		spinlock_release(&pt->pt_lock);
+		if (expired) {
+			spinlock_cleanup(&pt->pt_lock);
+			kfree(pt);
+		}
+		pw->pw_timer = NULL;
+	}
+
+	spinlock_cleanup(&pw->pw_lock);
+	wchan_destroy(pw->pw_wchan);
+}
+
+////////////////////////////////////////////////////////////
+// vop_poll for objects that never block
+
+int
+vopstub_poll_ready(struct vnode *vn, int events, struct pollwait *pw)
+{
+	(void)vn;
+	(void)pw;
+	return events & (POLLIN | POLLOUT);
+}
@@ -90,6 +90,14 @@ DEFARRAY(knowndev, static __UNUSED inline);
 
 static struct knowndevarray *knowndevs;
 
+/*
+ * Lock for knowndevs and the knowndev entries. Looking up a device
+ * takes it shared, so path lookups don't serialize on each other;
+ * adding a device, mounting, and unmounting take it exclusive. It
+ * comes before vfs_biglock in the lock order.
+ */
+static struct rwlock *knowndevs_lock;
+
 /* The big lock for all FS ops. Remove for filesystem assignment. */
 static struct lock *vfs_biglock;
 static unsigned vfs_biglock_depth;
@@ -105,6 +113,10 @@ vfs_bootstrap(void)
 	if (knowndevs==NULL) {
 		panic("vfs: Could not create knowndevs array\n");
 	}
+	knowndevs_lock = rwlock_create("knowndevs");
+	if (knowndevs_lock==NULL) {
+		panic("vfs: Could not create knowndevs lock\n");
+	}
 
 	vfs_biglock = lock_create("vfs_biglock");
 	if (vfs_biglock==NULL) {
@@ -158,6 +170,7 @@ vfs_sync(void)
 	struct knowndev *dev;
 	unsigned i, num;
 
+	rwlock_acquire_read(knowndevs_lock);
 	vfs_biglock_acquire();
 
 	num = knowndevarray_num(knowndevs);
@@ -169,6 +182,7 @@ vfs_sync(void)
 	}
 
 	vfs_biglock_release();
+	rwlock_release_read(knowndevs_lock);
 
 	return 0;
 }
@@ -176,15 +190,16 @@ vfs_sync(void)
 /*
  * Given a device name (lhd0, emu0, somevolname, null, etc.), hand
  * back an appropriate vnode.
+ *
+ * getroot does the work; vfs_getroot locks the device table around it.
  */
+static
 int
-vfs_getroot(const char *devname, struct vnode **ret)
+getroot(const char *devname, struct vnode **ret)
 {
 	struct knowndev *kd;
 	unsigned i, num;
 
-	KASSERT(vfs_biglock_do_i_hold());
-
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
 		kd = knowndevarray_get(knowndevs, i);
@@ -253,6 +268,17 @@ vfs_getroot(const char *devname, struct vnode **ret)
 	return ENODEV;
 }
 
+int
+vfs_getroot(const char *devname, struct vnode **ret)
+{
+	int result;
+
+	rwlock_acquire_read(knowndevs_lock);
+	result = getroot(devname, ret);
+	rwlock_release_read(knowndevs_lock);
+	return result;
+}
+
 /*
  * Given a filesystem, hand back the name of the device it's mounted on.
  */
@@ -260,12 +286,12 @@ const char *
 vfs_getdevname(struct fs *fs)
 {
 	struct knowndev *kd;
+	const char *name = NULL;
 	unsigned i, num;
 
 	KASSERT(fs != NULL);
 
-	KASSERT(vfs_biglock_do_i_hold());
-
+	rwlock_acquire_read(knowndevs_lock);
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
 		kd = knowndevarray_get(knowndevs, i);
@@ -277,11 +303,13 @@ vfs_getdevname(struct fs *fs)
 			 * the fs cannot go away, and the device can't
 			 * go away until the fs goes away.
 			 */
-			return kd->kd_name;
+			name = kd->kd_name;
+			break;
 		}
 	}
+	rwlock_release_read(knowndevs_lock);
 
-	return NULL;
+	return name;
 }
 
 /*
@@ -341,7 +369,7 @@ badnames(const char *n1, const char *n2, const char *n3)
 	unsigned i, num;
 	struct knowndev *kd;
 
-	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(rwlock_do_i_hold_write(knowndevs_lock));
 
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
@@ -381,7 +409,7 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 	unsigned index;
 	int result;
 
-	vfs_biglock_acquire();
+	rwlock_acquire_write(knowndevs_lock);
 
 	name = kstrdup(dname);
 	if (name==NULL) {
@@ -433,7 +461,7 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 		dev->d_devnumber = index+1;
 	}
 
-	vfs_biglock_release();
+	rwlock_release_write(knowndevs_lock);
 	return 0;
 
  fail:
@@ -450,7 +478,7 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 		kfree(kd);
 	}
 
-	vfs_biglock_release();
+	rwlock_release_write(knowndevs_lock);
 	return result;
 }
 
@@ -489,7 +517,7 @@ findmount(const char *devname, struct knowndev **result)
 	unsigned i, num;
 	bool found = false;
 
-	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(rwlock_do_i_hold_write(knowndevs_lock));
 
 	num = knowndevarray_num(knowndevs);
 	for (i=0; !found && i<num; i++) {
@@ -523,16 +551,19 @@ vfs_mount(const char *devname, void *data,
 	struct fs *fs;
 	int result;
 
+	rwlock_acquire_write(knowndevs_lock);
 	vfs_biglock_acquire();
 
 	result = findmount(devname, &kd);
 	if (result) {
 		vfs_biglock_release();
+		rwlock_release_write(knowndevs_lock);
 		return result;
 	}
 
 	if (kd->kd_fs != NULL) {
 		vfs_biglock_release();
+		rwlock_release_write(knowndevs_lock);
 		return EBUSY;
 	}
 	KASSERT(kd->kd_rawname != NULL);
@@ -541,6 +572,7 @@ vfs_mount(const char *devname, void *data,
 	result = mountfunc(data, kd->kd_device, &fs);
 	if (result) {
 		vfs_biglock_release();
+		rwlock_release_write(knowndevs_lock);
 		return result;
 	}
 
@@ -554,6 +586,7 @@ vfs_mount(const char *devname, void *data,
 		volname ? volname : kd->kd_name, kd->kd_name);
 
 	vfs_biglock_release();
+	rwlock_release_write(knowndevs_lock);
 	return 0;
 }
 
@@ -581,6 +614,7 @@ vfs_swapon(const char *devname, struct vnode **ret)
 		devname = myname;
 	}
 
+	rwlock_acquire_write(knowndevs_lock);
 	vfs_biglock_acquire();
 
 	result = findmount(devname, &kd);
@@ -603,6 +637,7 @@ vfs_swapon(const char *devname, struct vnode **ret)
 
  out:
 	vfs_biglock_release();
+	rwlock_release_write(knowndevs_lock);
 	if (myname != NULL) {
 		kfree(myname);
 	}
@@ -620,6 +655,7 @@ vfs_unmount(const char *devname)
 	struct knowndev *kd;
 	int result;
 
+	rwlock_acquire_write(knowndevs_lock);
 	vfs_biglock_acquire();
 
 	result = findmount(devname, &kd);
@@ -654,6 +690,7 @@ vfs_unmount(const char *devname)
 
  fail:
 	vfs_biglock_release();
+	rwlock_release_write(knowndevs_lock);
 	return result;
 }
 
@@ -670,6 +707,7 @@ vfs_swapoff(const char *devname)
 	struct knowndev *kd;
 	int result;
 
+	rwlock_acquire_write(knowndevs_lock);
 	vfs_biglock_acquire();
 
 	result = findmount(devname, &kd);
@@ -691,6 +729,7 @@ vfs_swapoff(const char *devname)
 
  fail:
 	vfs_biglock_release();
+	rwlock_release_write(knowndevs_lock);
 	return result;
 }
 
@@ -704,6 +743,7 @@ vfs_unmountall(void)
 	unsigned i, num;
 	int result;
 
+	rwlock_acquire_write(knowndevs_lock);
 	vfs_biglock_acquire();
 
 	num = knowndevarray_num(knowndevs);
@@ -761,6 +801,7 @@ vfs_unmountall(void)
 	}
 
 	vfs_biglock_release();
+	rwlock_release_write(knowndevs_lock);
 
 	return 0;
 }
@@ -180,3 +180,40 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+
+int
+as_define_thread_stack(struct addrspace *as, int *slot, vaddr_t *stackptr)
+{
+	/*
+	 * Write this.
+	 */
+
+	(void)as;
+	(void)slot;
+	(void)stackptr;
+	return ENOSYS;
+}
+
+void
+as_release_thread_stack(struct addrspace *as, int slot)
+{
+	/*
+	 * Write this.
+	 */
+
+	(void)as;
+	(void)slot;
+}
+
+int
+as_translate(struct addrspace *as, vaddr_t vaddr, paddr_t *ret)
+{
+	/*
+	 * Write this.
+	 */
+
+	(void)as;
+	(void)vaddr;
+	(void)ret;
+	return ENOSYS;
+}
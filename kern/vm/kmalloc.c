@@ -30,6 +30,8 @@
 #include <types.h>
 #include <lib.h>
 #include <spinlock.h>
+#include <cpu.h>
+#include <percpu.h>
 #include <vm.h>
 
 /*
@@ -137,6 +139,15 @@ static const size_t sizes[NSIZES] = { 16, 32, 64, 128, 256, 512, 1024, 2048 };
 #error "Odd page size"
 #endif
 
+/*
+ * Number of kmalloc and kfree calls for each block size, plus (at
+ * NSIZES) whole-page allocations. These are per-cpu counters since
+ * kmalloc is about as hot as it gets; kheap_printstats adds them up.
+ * Until kheap_bootstrap runs they count into the discard slot.
+ */
+static struct percpu_counter kmalloc_allocs[NSIZES + 1];
+static struct percpu_counter kmalloc_frees[NSIZES + 1];
+
 ////////////////////////////////////////
 
 struct freelist {
@@ -794,6 +805,22 @@ subpage_stats(struct pageref *pr)
 	kprintf("\n");
 }
 
+/*
+ * Set up the allocation counters. Needs the boot cpu to exist.
+ */
+void
+kheap_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<NSIZES + 1; i++) {
+		if (percpu_counter_init(&kmalloc_allocs[i]) ||
+		    percpu_counter_init(&kmalloc_frees[i])) {
+			panic("kheap_bootstrap: Out of counters\n");
+		}
+	}
+}
+
 /*
  * Print the whole heap.
  */
@@ -801,6 +828,18 @@ void
 kheap_printstats(void)
 {
 	struct pageref *pr;
+	unsigned i;
+
+	kprintf("kmalloc calls:\n");
+	for (i=0; i<NSIZES; i++) {
+		kprintf("   size %-4lu  %u allocs, %u frees\n",
+			(unsigned long)sizes[i],
+			percpu_counter_read(&kmalloc_allocs[i]),
+			percpu_counter_read(&kmalloc_frees[i]));
+	}
+	kprintf("   pages      %u allocs, %u frees\n",
+		percpu_counter_read(&kmalloc_allocs[NSIZES]),
+		percpu_counter_read(&kmalloc_frees[NSIZES]));
 
 	/* print the whole thing with interrupts off */
 	spinlock_acquire(&kmalloc_spinlock);
@@ -909,6 +948,9 @@ subpage_kmalloc(size_t sz
 
 	spinlock_acquire(&kmalloc_spinlock);
 
+	/* Interrupts are off, so this count is exact */
+	percpu_counter_inc(&kmalloc_allocs[blktype]);
+
 	checksubpages();
 
 	for (pr = sizebases[blktype]; pr != NULL; pr = pr->next_samesize) {
@@ -1092,6 +1134,8 @@ subpage_kfree(void *ptr)
 		panic("kfree: subpage free of invalid addr %p\n", ptr);
 	}
 
+	percpu_counter_inc(&kmalloc_frees[blktype]);
+
 #ifdef GUARDS
 	blocksize = sizes[blktype];
 	smallerblocksize = blktype > 0 ? sizes[blktype - 1] : 0;
@@ -1190,6 +1234,7 @@ kmalloc(size_t sz)
 			return NULL;
 		}
 		KASSERT(address % PAGE_SIZE == 0);
+		percpu_counter_inc(&kmalloc_allocs[NSIZES]);
 
 		return (void *)address;
 	}
@@ -1214,6 +1259,7 @@ kfree(void *ptr)
 		return;
 	} else if (subpage_kfree(ptr)) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
+		percpu_counter_inc(&kmalloc_frees[NSIZES]);
 		free_kpages((vaddr_t)ptr);
 	}
 }